@@ -0,0 +1,152 @@
+#define _POSIX_C_SOURCE 200809L
+#include "latstat.h"
+#include <inttypes.h>
+#include <math.h>
+#include <string.h>
+
+void latstat_init(latstat *s) {
+    memset(s, 0, sizeof(*s));
+    s->min = INT64_MAX;
+    s->max = INT64_MIN;
+}
+
+// Значения меньше LATSTAT_SUB лежат каждое в своей корзине. Дальше каждая
+// степень двойки [2^e, 2^(e+1)) делится на LATSTAT_SUB равных корзин:
+// номер внутри группы — следующие LATSTAT_SUB_BITS бит после старшего.
+static int bucket_of(int64_t v) {
+    if (v < LATSTAT_SUB)
+        return v < 0 ? 0 : (int)v;
+    int e = 63 - __builtin_clzll((unsigned long long)v);
+    int group = e - LATSTAT_SUB_BITS + 1;
+    int sub = (int)((v >> (e - LATSTAT_SUB_BITS)) & (LATSTAT_SUB - 1));
+    return group * LATSTAT_SUB + sub;
+}
+
+int64_t latstat_bucket_lo(int i) {
+    int group = i / LATSTAT_SUB, sub = i % LATSTAT_SUB;
+    if (group == 0)
+        return sub;
+    return (int64_t)(LATSTAT_SUB + sub) << (group - 1);
+}
+
+int64_t latstat_bucket_hi(int i) {
+    int group = i / LATSTAT_SUB;
+    if (group == 0)
+        return latstat_bucket_lo(i);
+    return latstat_bucket_lo(i) + ((INT64_C(1) << (group - 1)) - 1);
+}
+
+void latstat_add(latstat *s, int64_t v) {
+    s->n++;
+    double d = (double)v - s->mean;
+    s->mean += d / (double)s->n;
+    s->m2 += d * ((double)v - s->mean);
+    if (v < s->min) s->min = v;
+    if (v > s->max) s->max = v;
+    s->hist[bucket_of(v)]++;
+}
+
+// Слияние средних и дисперсий — формула Чана для двух выборок
+void latstat_merge(latstat *dst, const latstat *src) {
+    if (src->n == 0)
+        return;
+    uint64_t n = dst->n + src->n;
+    double d = src->mean - dst->mean;
+    dst->m2 += src->m2 + d * d * ((double)dst->n * (double)src->n / (double)n);
+    dst->mean += d * ((double)src->n / (double)n);
+    dst->n = n;
+    if (src->min < dst->min) dst->min = src->min;
+    if (src->max > dst->max) dst->max = src->max;
+    for (int i = 0; i < LATSTAT_BUCKETS; ++i)
+        dst->hist[i] += src->hist[i];
+}
+
+double latstat_stddev(const latstat *s) {
+    return s->n ? sqrt(s->m2 / (double)s->n) : 0.0;
+}
+
+// Ранг p-го перцентиля — ceil(p * n / 100); отдаётся середина его корзины
+int64_t latstat_percentile(const latstat *s, double p) {
+    if (s->n == 0)
+        return 0;
+    uint64_t rank = (uint64_t)ceil(p / 100.0 * (double)s->n);
+    if (rank < 1) rank = 1;
+    if (rank > s->n) rank = s->n;
+    uint64_t seen = 0;
+    for (int i = 0; i < LATSTAT_BUCKETS; ++i) {
+        seen += s->hist[i];
+        if (seen >= rank) {
+            int64_t lo = latstat_bucket_lo(i), hi = latstat_bucket_hi(i);
+            int64_t v = lo + (hi - lo) / 2;
+            if (v < s->min) v = s->min;
+            if (v > s->max) v = s->max;
+            return v;
+        }
+    }
+    return s->max;
+}
+
+int latstat_format(const char *name) {
+    if (strcmp(name, "text") == 0) return LATSTAT_TEXT;
+    if (strcmp(name, "csv") == 0) return LATSTAT_CSV;
+    if (strcmp(name, "json") == 0) return LATSTAT_JSON;
+    return -1;
+}
+
+void latstat_emit_header(FILE *f, int fmt) {
+    if (fmt == LATSTAT_CSV)
+        fprintf(f, "name,n,min_ns,avg_ns,max_ns,stddev_ns,p50_ns,p90_ns,p99_ns,p999_ns\n");
+}
+
+void latstat_emit(FILE *f, int fmt, const char *name, const latstat *s) {
+    int64_t min = s->n ? s->min : 0, max = s->n ? s->max : 0;
+    int64_t p50 = latstat_percentile(s, 50), p90 = latstat_percentile(s, 90);
+    int64_t p99 = latstat_percentile(s, 99), p999 = latstat_percentile(s, 99.9);
+    double sd = latstat_stddev(s);
+
+    switch (fmt) {
+    case LATSTAT_CSV:
+        fprintf(f, "%s,%" PRIu64 ",%" PRId64 ",%.1f,%" PRId64 ",%.1f,%" PRId64 ",%" PRId64
+                   ",%" PRId64 ",%" PRId64 "\n",
+                name, s->n, min, s->mean, max, sd, p50, p90, p99, p999);
+        break;
+    case LATSTAT_JSON:
+        fprintf(f, "{\"name\":\"%s\",\"n\":%" PRIu64 ",\"min_ns\":%" PRId64 ",\"avg_ns\":%.1f,"
+                   "\"max_ns\":%" PRId64 ",\"stddev_ns\":%.1f,\"p50_ns\":%" PRId64
+                   ",\"p90_ns\":%" PRId64 ",\"p99_ns\":%" PRId64 ",\"p999_ns\":%" PRId64 "}\n",
+                name, s->n, min, s->mean, max, sd, p50, p90, p99, p999);
+        break;
+    default:
+        fprintf(f, "%s: n=%" PRIu64 " min=%" PRId64 " avg=%.1f max=%" PRId64 " std=%.1f"
+                   " p50=%" PRId64 " p99=%" PRId64 " p99.9=%" PRId64 " ns\n",
+                name, s->n, min, s->mean, max, sd, p50, p99, p999);
+        break;
+    }
+}
+
+void latstat_emit_hist_header(FILE *f, int fmt) {
+    if (fmt == LATSTAT_CSV)
+        fprintf(f, "name,lo_ns,hi_ns,count\n");
+}
+
+void latstat_emit_hist(FILE *f, int fmt, const char *name, const latstat *s) {
+    int first = 1;
+    if (fmt == LATSTAT_JSON)
+        fprintf(f, "{\"name\":\"%s\",\"hist\":[", name);
+    else if (fmt == LATSTAT_TEXT)
+        fprintf(f, "%s histogram (lo..hi ns: count):\n", name);
+    for (int i = 0; i < LATSTAT_BUCKETS; ++i) {
+        if (s->hist[i] == 0)
+            continue;
+        int64_t lo = latstat_bucket_lo(i), hi = latstat_bucket_hi(i);
+        if (fmt == LATSTAT_JSON)
+            fprintf(f, "%s[%" PRId64 ",%" PRId64 ",%" PRIu64 "]", first ? "" : ",", lo, hi, s->hist[i]);
+        else if (fmt == LATSTAT_CSV)
+            fprintf(f, "%s,%" PRId64 ",%" PRId64 ",%" PRIu64 "\n", name, lo, hi, s->hist[i]);
+        else
+            fprintf(f, "  %10" PRId64 " .. %-10" PRId64 " %" PRIu64 "\n", lo, hi, s->hist[i]);
+        first = 0;
+    }
+    if (fmt == LATSTAT_JSON)
+        fprintf(f, "]}\n");
+}
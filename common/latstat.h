@@ -0,0 +1,74 @@
+#ifndef LATSTAT_H
+#define LATSTAT_H
+
+/*
+ * Потоковая статистика задержек для измерительных программ всех заданий.
+ *
+ * Сэмплы не хранятся: среднее и дисперсия считаются по Уэлфорду, а
+ * перцентили берутся из лог-линейной гистограммы фиксированного размера
+ * (LATSTAT_SUB корзин на каждую степень двойки, относительная ошибка не
+ * больше 1/LATSTAT_SUB). Память не зависит от числа сэмплов, так что
+ * тест можно гонять часами. Статистики потоков сливаются latstat_merge
+ * без потери точности: корзины просто складываются.
+ *
+ * Значения — целые наносекунды; отрицательные учитываются в min/avg,
+ * а в гистограмме попадают в нулевую корзину.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+#define LATSTAT_SUB_BITS 7
+#define LATSTAT_SUB (1 << LATSTAT_SUB_BITS)
+#define LATSTAT_BUCKETS ((64 - LATSTAT_SUB_BITS) * LATSTAT_SUB)
+
+typedef struct latstat {
+    uint64_t n;
+    double mean;
+    double m2;              // сумма квадратов отклонений (Уэлфорд)
+    int64_t min;
+    int64_t max;
+    uint64_t hist[LATSTAT_BUCKETS];
+} latstat;
+
+enum latstat_fmt {
+    LATSTAT_TEXT,
+    LATSTAT_CSV,
+    LATSTAT_JSON
+};
+
+static inline int64_t latstat_ts_ns(const struct timespec *ts) {
+    return (int64_t)ts->tv_sec * 1000000000LL + (int64_t)ts->tv_nsec;
+}
+
+static inline int64_t latstat_diff_ns(const struct timespec *start, const struct timespec *end) {
+    return latstat_ts_ns(end) - latstat_ts_ns(start);
+}
+
+void latstat_init(latstat *s);
+void latstat_add(latstat *s, int64_t v);
+// Добавить к dst все сэмплы src (например, статистику другого потока)
+void latstat_merge(latstat *dst, const latstat *src);
+
+double latstat_stddev(const latstat *s);
+// Перцентиль p (0..100) с точностью до корзины, в пределах [min, max]
+int64_t latstat_percentile(const latstat *s, double p);
+
+// Границы корзины i: [lo, hi]
+int64_t latstat_bucket_lo(int i);
+int64_t latstat_bucket_hi(int i);
+
+// "text", "csv" или "json"; -1, если формат неизвестен
+int latstat_format(const char *name);
+// Заголовок CSV (для остальных форматов ничего не выводит)
+void latstat_emit_header(FILE *f, int fmt);
+// Одна строка со сводкой: text — для человека, csv — под заголовок, json — объект на строку
+void latstat_emit(FILE *f, int fmt, const char *name, const latstat *s);
+// Заголовок CSV гистограмм: один на файл перед всеми latstat_emit_hist
+void latstat_emit_hist_header(FILE *f, int fmt);
+// Непустые корзины гистограммы: "lo hi count" (text), name,lo,hi,count (csv) или JSON-массив.
+// Схема csv другая, чем у latstat_emit: гистограммы пишутся в отдельный файл
+void latstat_emit_hist(FILE *f, int fmt, const char *name, const latstat *s);
+
+#endif // LATSTAT_H
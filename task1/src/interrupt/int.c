@@ -1,10 +1,37 @@
+// Периодический тик как аналог прерывания таймера.
+//
+// Без аргументов — демонстрация: SIGALRM от setitimer раз в 10 мс.
+// setitimer не говорит, сколько тиков слилось в один сигнал, поэтому для
+// поиска предельной частоты есть замер:
+//   -m itimer  — тот же setitimer; потерянные тики видны только как разница
+//                между прошедшим временем и числом сигналов;
+//   -m posix   — timer_create с SIGEV_THREAD_ID: сигнал направлен главному
+//                потоку, он ждёт его в sigwaitinfo, а si_overrun говорит,
+//                сколько срабатываний слилось в этот сигнал;
+//   -m timerfd — read из timerfd возвращает число срабатываний с прошлого read.
+// Для posix и timerfd таймер взведён на абсолютные моменты start + k*period,
+// поэтому задержка тика — от положенного момента до обработки.
+//
+// Запуск: ./bin/int [-m itimer|posix|timerfd] [-p период_мкс] [-d секунд] [-r приоритет_FIFO]
+//         ./bin/int -S [-d секунд] [-r приоритет]   — все способы, 10 мс ... 100 мкс
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <sched.h>
 #include <signal.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/time.h>
+#include <sys/timerfd.h>
+#include <time.h>
 #include <unistd.h>
 
+#ifndef sigev_notify_thread_id
+#define sigev_notify_thread_id _sigev_un._tid
+#endif
+
 static volatile unsigned counter = 0;
 
 static void on_alarm(int signo) {
@@ -15,7 +42,229 @@ static void on_alarm(int signo) {
   }
 }
 
-int main(void) {
+enum { M_ITIMER, M_POSIX, M_TIMERFD, M_N };
+static const char *const method_names[M_N] = { "itimer", "posix", "timerfd" };
+
+typedef struct tick_stats {
+  long handled;         // обработано тиков (сигналов / read)
+  long expected;        // срабатываний таймера за время замера
+  long long *lat;       // задержки обработанных тиков, нс (не для itimer)
+  int nlat;
+} tick_stats;
+
+static long long ts_ns(const struct timespec *ts) {
+  return (long long)ts->tv_sec * 1000000000LL + ts->tv_nsec;
+}
+
+static long long now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts_ns(&ts);
+}
+
+static struct timespec ns_ts(long long ns) {
+  struct timespec ts = { (time_t)(ns / 1000000000LL), (long)(ns % 1000000000LL) };
+  return ts;
+}
+
+static volatile sig_atomic_t itimer_ticks;
+static void on_itimer(int signo) { (void)signo; itimer_ticks++; }
+
+static int run_itimer(long period_us, double seconds, tick_stats *st) {
+  struct sigaction sa;
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = on_itimer;
+  sigemptyset(&sa.sa_mask);
+  sigaction(SIGALRM, &sa, NULL);
+
+  itimer_ticks = 0;
+  struct itimerval itv = { { period_us / 1000000, period_us % 1000000 },
+                           { period_us / 1000000, period_us % 1000000 } };
+  long long t0 = now_ns();
+  if (setitimer(ITIMER_REAL, &itv, NULL) == -1) {
+    perror("setitimer");
+    return -1;
+  }
+  // Сигналы прерывают сон — досыпаем до абсолютного момента: относительный
+  // остаток после каждого EINTR набирает запас таймера (timer slack)
+  struct timespec until = ns_ts(t0 + (long long)(seconds * 1e9));
+  while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &until, NULL) == EINTR)
+    ;
+  memset(&itv, 0, sizeof(itv));
+  setitimer(ITIMER_REAL, &itv, NULL);
+  long long elapsed = now_ns() - t0;
+
+  st->handled = itimer_ticks;
+  st->expected = elapsed / (period_us * 1000LL);
+  st->nlat = 0;
+  return 0;
+}
+
+// posix и timerfd: ждать тик, вернуть число срабатываний в нём (1 + слитые)
+typedef struct tick_source {
+  int method;
+  timer_t timer;
+  int fd;
+  sigset_t set;
+} tick_source;
+
+static long wait_tick(tick_source *src) {
+  if (src->method == M_POSIX) {
+    siginfo_t si;
+    while (sigwaitinfo(&src->set, &si) == -1)
+      if (errno != EINTR)
+        return -1;
+    return 1 + si.si_overrun;
+  }
+  uint64_t exp;
+  if (read(src->fd, &exp, sizeof(exp)) != sizeof(exp))
+    return -1;
+  return (long)exp;
+}
+
+static int run_abs_timer(int method, long period_us, double seconds, tick_stats *st) {
+  tick_source src = { .method = method, .fd = -1 };
+  long long period = period_us * 1000LL;
+  long long start = now_ns() + 10 * 1000000LL;   // первый тик — через 10 мс
+  struct itimerspec its = { ns_ts(period), ns_ts(start) };
+
+  if (method == M_POSIX) {
+    sigemptyset(&src.set);
+    sigaddset(&src.set, SIGRTMIN);
+    sigprocmask(SIG_BLOCK, &src.set, NULL);   // только через sigwaitinfo
+    struct sigevent sev;
+    memset(&sev, 0, sizeof(sev));
+    sev.sigev_notify = SIGEV_THREAD_ID;
+    sev.sigev_signo = SIGRTMIN;
+    sev.sigev_notify_thread_id = gettid();
+    if (timer_create(CLOCK_MONOTONIC, &sev, &src.timer) == -1 ||
+        timer_settime(src.timer, TIMER_ABSTIME, &its, NULL) == -1) {
+      perror("timer_create/timer_settime");
+      return -1;
+    }
+  } else {
+    src.fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+    if (src.fd < 0 || timerfd_settime(src.fd, TFD_TIMER_ABSTIME, &its, NULL) == -1) {
+      perror("timerfd");
+      return -1;
+    }
+  }
+
+  long max_ticks = (long)(seconds * 1e9 / period) + 1;
+  st->lat = malloc((size_t)max_ticks * sizeof(long long));
+  if (!st->lat) {
+    perror("malloc");
+    return -1;
+  }
+  st->handled = st->expected = 0;
+  st->nlat = 0;
+  while (st->expected < max_ticks) {
+    long n = wait_tick(&src);
+    long long now = now_ns();
+    if (n < 0) {
+      perror("wait_tick");
+      break;
+    }
+    st->handled++;
+    st->expected += n;
+    // Обрабатываем последнее из слитых срабатываний: его момент — start + (expected-1)*period
+    if (st->nlat < max_ticks)
+      st->lat[st->nlat++] = now - (start + (st->expected - 1) * period);
+  }
+
+  if (method == M_POSIX) {
+    timer_delete(src.timer);
+    sigprocmask(SIG_UNBLOCK, &src.set, NULL);
+  } else {
+    close(src.fd);
+  }
+  return 0;
+}
+
+static int compare_ll(const void *a, const void *b) {
+  long long va = *(const long long *)a, vb = *(const long long *)b;
+  return (va > vb) - (va < vb);
+}
+
+static int measure(int method, long period_us, double seconds) {
+  tick_stats st = { 0, 0, NULL, 0 };
+  int rc = method == M_ITIMER ? run_itimer(period_us, seconds, &st)
+                              : run_abs_timer(method, period_us, seconds, &st);
+  if (rc != 0)
+    return -1;
+  long missed = st.expected > st.handled ? st.expected - st.handled : 0;
+  printf("%-8s %8ld %9ld %9ld %8ld %7.2f", method_names[method], period_us,
+         st.expected, st.handled, missed, st.expected ? 100.0 * missed / st.expected : 0.0);
+  if (st.nlat > 0) {
+    qsort(st.lat, (size_t)st.nlat, sizeof(long long), compare_ll);
+    printf(" %9.1f %9.1f %9.1f", st.lat[st.nlat / 2] / 1e3,
+           st.lat[(long)st.nlat * 99 / 100] / 1e3, st.lat[st.nlat - 1] / 1e3);
+  } else {
+    printf(" %9s %9s %9s", "-", "-", "-");
+  }
+  printf("  %s\n", missed == 0 ? "ok" : "LOST");
+  free(st.lat);
+  return 0;
+}
+
+static void demo(void);
+
+int main(int argc, char *argv[]) {
+  int method = -1, sweep = 0, prio = 0, opt;
+  long period_us = 10000;
+  double seconds = 2.0;
+
+  while ((opt = getopt(argc, argv, "m:p:d:r:S")) != -1) {
+    switch (opt) {
+    case 'm':
+      for (int i = 0; i < M_N; i++)
+        if (strcmp(optarg, method_names[i]) == 0)
+          method = i;
+      if (method < 0) {
+        fprintf(stderr, "%s: -m itimer|posix|timerfd\n", argv[0]);
+        return EXIT_FAILURE;
+      }
+      break;
+    case 'p': period_us = atol(optarg); break;
+    case 'd': seconds = atof(optarg); break;
+    case 'r': prio = atoi(optarg); break;
+    case 'S': sweep = 1; break;
+    default:
+      fprintf(stderr, "usage: %s [-m itimer|posix|timerfd] [-p period_us] [-d sec] [-r fifo_prio] [-S]\n",
+              argv[0]);
+      return EXIT_FAILURE;
+    }
+  }
+  if (method < 0 && !sweep) {
+    demo();
+    return EXIT_SUCCESS;
+  }
+  if (period_us < 1 || seconds <= 0) {
+    fprintf(stderr, "%s: bad -p or -d\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+  if (prio > 0) {
+    struct sched_param sp = { .sched_priority = prio };
+    if (sched_setscheduler(0, SCHED_FIFO, &sp) == -1) {
+      perror("sched_setscheduler");
+      return EXIT_FAILURE;
+    }
+  }
+
+  printf("%-8s %8s %9s %9s %8s %7s %9s %9s %9s\n", "method", "period", "expected", "handled",
+         "missed", "miss%", "p50_us", "p99_us", "max_us");
+  if (!sweep)
+    return measure(method, period_us, seconds) == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+  static const long periods[] = { 10000, 1000, 500, 200, 100 };
+  for (size_t i = 0; i < sizeof(periods) / sizeof(periods[0]); i++)
+    for (int m = 0; m < M_N; m++)
+      if (measure(m, periods[i], seconds) != 0)
+        return EXIT_FAILURE;
+  return EXIT_SUCCESS;
+}
+
+// Прежняя демонстрация
+static void demo(void) {
   struct sigaction sa;
   memset(&sa, 0, sizeof(sa));
   sa.sa_handler = on_alarm;
@@ -29,7 +278,7 @@ int main(void) {
   itv.it_value = itv.it_interval;  // стартовое значение
   if (setitimer(ITIMER_REAL, &itv, NULL) == -1) {
     perror("setitimer");
-    return EXIT_FAILURE;
+    return;
   }
 
   // Ждём 10 сообщений по 100 событий => 1000 тиков ~ 10 секунд
@@ -41,5 +290,41 @@ int main(void) {
   // Остановим таймер
   memset(&itv, 0, sizeof(itv));
   setitimer(ITIMER_REAL, &itv, NULL);
-  return EXIT_SUCCESS;
-}
\ No newline at end of file
+}
+/*
+ * Результаты (1 CPU в виртуальной машине, ./bin/int -S -d 1 -r 80):
+ *
+ *   method     period  expected   handled   missed   miss%    p50_us    p99_us    max_us
+ *   itimer      10000       100       100        0    0.00         -         -         -  ok
+ *   posix       10000       101       101        0    0.00      62.4      97.0      97.7  ok
+ *   timerfd     10000       101       101        0    0.00      61.6    7852.3    8286.9  ok
+ *   itimer       1000      1000      1000        0    0.00         -         -         -  ok
+ *   posix        1000      1001       994        7    0.70      30.5     250.5     991.5  LOST
+ *   timerfd      1000      1001       991       10    1.00      27.5     307.8     958.7  LOST
+ *   itimer        500      2000      2000        0    0.00         -         -         -  ok
+ *   posix         500      2001      2000        1    0.05      16.6      67.6     433.1  LOST
+ *   timerfd       500      2001      1988       13    0.65      15.0      66.4     233.9  LOST
+ *   itimer        200      5000      5000        0    0.00         -         -         -  ok
+ *   posix         200      5001      5001        0    0.00       7.9      13.0      69.3  ok
+ *   timerfd       200      5001      5001        0    0.00       7.6      12.8      66.4  ok
+ *   itimer        100     10000     10000        0    0.00         -         -         -  ok
+ *   posix         100     10001     10001        0    0.00       7.5      21.9      87.7  ok
+ *   timerfd       100     10001      9994        7    0.07       7.1      13.8     208.3  LOST
+ *
+ *  - Без -r (SCHED_OTHER) теряется 0.2-4.5 % тиков на всех периодах от
+ *    1 мс у всех трёх способов (хуже всего 500 мкс: 2.3-4.5 %).
+ *  - С -r 80 потери не монотонны по периоду: 1 мс и 500 мкс теряют,
+ *    200 мкс - нет, 100 мкс - снова у timerfd. Их дают редкие остановки
+ *    машины на сотни мкс - мс (max_us около 950 на периоде 1 мс, 8 мс у
+ *    timerfd на 10 мс - там период длиннее, и тик не потерян), и тик
+ *    теряется, если остановка длиннее периода. Поэтому предельная частота -
+ *    та, при которой период заметно больше худшей задержки, а не средней;
+ *    в этой машине без потерь гарантирован только период 10 мс.
+ *  - posix и timerfd видят потерю и говорят, сколько тиков слилось
+ *    (si_overrun, счётчик read). itimer с -r 80 не потерял ни одного тика
+ *    на всех периодах, но это сравнение числа сигналов с часами снаружи:
+ *    setitimer сам о слиянии не сообщает, и задержку тика не измерить.
+ *  - Задержка p50 падает с периодом (60 -> 7.5 мкс): при частых тиках
+ *    процессор не успевает уйти в глубокий сон; от 200 мкс и чаще она
+ *    уже не меняется.
+ */
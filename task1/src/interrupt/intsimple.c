@@ -1,12 +1,34 @@
 //  Демонстрация обработки "прерываний" на Linux: сигналы и ввод с клавиатуры.
+//
+//  По умолчанию главный цикл раз в 10 мс опрашивает флаги, которые ставят
+//  обработчики, и читает stdin без ожидания: реакция — до 10 мс, и 100
+//  пробуждений в секунду даже без событий.
+//
+//  -s — сигналы заблокированы и читаются через signalfd, а главный цикл
+//  спит в epoll_wait на signalfd и stdin сразу: реакция без задержки
+//  опроса, без событий пробуждений нет.
+//
+//  -m N — замер вместо клавиатуры: stdin подменяется каналом, и отдельный
+//  поток N раз шлёт процессу SIGUSR1 и N раз пишет в канал "клавишу",
+//  каждый раз со своей фазой. Печатается задержка от kill()/write() до
+//  обработки в главном цикле, а затем — пробуждения цикла за секунду без
+//  событий (её конец отмечает SIGUSR2).
+//
+//  Запуск: ./bin/intsimple [-s] [-m N]
 
+#define _GNU_SOURCE
 #include <errno.h>
 #include <fcntl.h>
+#include <pthread.h>
 #include <signal.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
 #include <termios.h>
+#include <time.h>
 #include <unistd.h>
 
 static const char *progname = "intsimple";
@@ -39,18 +61,71 @@ static void handle_sigterm(int signo) { (void)signo; got_sigterm = 1; }
 static void handle_sigusr1(int signo) { (void)signo; got_sigusr1 = 1; }
 static void handle_sigusr2(int signo) { (void)signo; got_sigusr2 = 1; }
 
-int main(void) {
-  setvbuf(stdout, NULL, _IOLBF, 0);
-  printf("%s: starting...\n", progname);
-  printf("Поддерживаемые сигналы: SIGINT(Ctrl+C), SIGTERM, SIGUSR1, SIGUSR2.\n");
-  printf("Замечание: SIGKILL нельзя перехватить или обработать на Linux.\n");
-  printf("Нажмите 'q' для выхода.\n");
+// Замер (-m)
+static int measure_n = 0;
+static long long *lat_sig, *lat_key;
+static int sig_n, key_n;            // пишет только главный цикл
+static atomic_int done;             // обработано событий замера
+static long long idle_t0;           // начало секунды без событий
+static unsigned long idle_w0;
+static atomic_llong sent_ns;
+static unsigned long loop_wakeups;
 
-  if (enable_raw_mode() == -1) {
-    perror("termios");
-    return EXIT_FAILURE;
+static long long now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// Событие замера обработано; после последнего начинается секунда без событий
+static void measure_event(void) {
+  if (atomic_fetch_add(&done, 1) + 1 == 2 * measure_n) {
+    idle_t0 = now_ns();
+    idle_w0 = loop_wakeups;
+  }
+}
+
+// Обработка сигнала в главном цикле; 1 — пора выходить
+static int on_signal(int signo) {
+  if (measure_n) {
+    if (signo == SIGUSR2)
+      return 1;
+    if (signo == SIGUSR1) {
+      lat_sig[sig_n++] = now_ns() - atomic_load(&sent_ns);
+      measure_event();
+    }
+    return 0;
+  }
+  switch (signo) {
+  case SIGINT:  printf("%s: получен SIGINT (Ctrl+C)\n", progname); break;
+  case SIGTERM: printf("%s: получен SIGTERM\n", progname); break;
+  case SIGUSR1: printf("%s: получен SIGUSR1\n", progname); break;
+  case SIGUSR2: printf("%s: получен SIGUSR2\n", progname); break;
+  }
+  return 0;
+}
+
+// Обработка клавиши; 1 — пора выходить
+static int on_key(char ch) {
+  if (measure_n) {
+    lat_key[key_n++] = now_ns() - atomic_load(&sent_ns);
+    measure_event();
+    return 0;
+  }
+  if (ch == 'q' || ch == 'Q') {
+    printf("%s: выход по клавише 'q'\n", progname);
+    return 1;
+  }
+  if (ch == '\n' || ch == '\r') {
+    // игнорировать переводы строк
+  } else {
+    printf("%s: клавиша '%c'\n", progname, ch);
   }
+  return 0;
+}
 
+// Прежний цикл: опрашиваем stdin и проверяем флаги сигналов
+static void poll_loop(void) {
   struct sigaction sa = {0};
   sa.sa_handler = handle_sigint; sigemptyset(&sa.sa_mask); sa.sa_flags = 0;
   sigaction(SIGINT, &sa, NULL);
@@ -58,27 +133,21 @@ int main(void) {
   sa.sa_handler = handle_sigusr1; sigaction(SIGUSR1, &sa, NULL);
   sa.sa_handler = handle_sigusr2; sigaction(SIGUSR2, &sa, NULL);
 
-  // Основной цикл: опрашиваем stdin и проверяем флаги сигналов
   for (;;) {
+    loop_wakeups++;
     // Проверка сигналов
-    if (got_sigint)  { got_sigint = 0;  printf("%s: получен SIGINT (Ctrl+C)\n", progname); }
-    if (got_sigterm) { got_sigterm = 0; printf("%s: получен SIGTERM\n", progname); }
-    if (got_sigusr1) { got_sigusr1 = 0; printf("%s: получен SIGUSR1\n", progname); }
-    if (got_sigusr2) { got_sigusr2 = 0; printf("%s: получен SIGUSR2\n", progname); }
+    int quit = 0;
+    if (got_sigint)  { got_sigint = 0;  quit |= on_signal(SIGINT); }
+    if (got_sigterm) { got_sigterm = 0; quit |= on_signal(SIGTERM); }
+    if (got_sigusr1) { got_sigusr1 = 0; quit |= on_signal(SIGUSR1); }
+    if (got_sigusr2) { got_sigusr2 = 0; quit |= on_signal(SIGUSR2); }
+    if (quit) break;
 
     // Неблокирующее чтение клавиатуры
     char ch;
     ssize_t n = read(STDIN_FILENO, &ch, 1);
     if (n == 1) {
-      if (ch == 'q' || ch == 'Q') {
-        printf("%s: выход по клавише 'q'\n", progname);
-        break;
-      }
-      if (ch == '\n' || ch == '\r') {
-        // игнорировать переводы строк
-      } else {
-        printf("%s: клавиша '%c'\n", progname, ch);
-      }
+      if (on_key(ch)) break;
     } else if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
       perror("read");
       break;
@@ -87,7 +156,181 @@ int main(void) {
     // Немного подождём, чтобы не крутить CPU
     usleep(10 * 1000);
   }
+}
+
+// Сигналы заблокированы (маска выставлена в main до создания потоков)
+// и приходят через signalfd; ждём его и stdin в одном epoll_wait
+static void signalfd_loop(const sigset_t *mask) {
+  int sfd = signalfd(-1, mask, SFD_CLOEXEC);
+  int ep = epoll_create1(EPOLL_CLOEXEC);
+  if (sfd < 0 || ep < 0) {
+    perror("signalfd/epoll_create1");
+    return;
+  }
+  struct epoll_event ev = { .events = EPOLLIN, .data.fd = sfd };
+  epoll_ctl(ep, EPOLL_CTL_ADD, sfd, &ev);
+  ev.data.fd = STDIN_FILENO;
+  if (epoll_ctl(ep, EPOLL_CTL_ADD, STDIN_FILENO, &ev) == -1)
+    perror("epoll_ctl (stdin)");
+
+  for (int quit = 0; !quit;) {
+    struct epoll_event evs[2];
+    int n = epoll_wait(ep, evs, 2, -1);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      perror("epoll_wait");
+      break;
+    }
+    loop_wakeups++;
+    for (int i = 0; i < n; i++) {
+      if (evs[i].data.fd == sfd) {
+        struct signalfd_siginfo si[8];
+        ssize_t r = read(sfd, si, sizeof(si));
+        for (ssize_t k = 0; k < r / (ssize_t)sizeof(si[0]); k++)
+          quit |= on_signal((int)si[k].ssi_signo);
+      } else {
+        char ch;
+        ssize_t r = read(STDIN_FILENO, &ch, 1);
+        if (r == 1)
+          quit |= on_key(ch);
+        else if (r == 0 || (r < 0 && errno != EAGAIN)) {
+          quit = 1;   // stdin закрыт
+        }
+      }
+    }
+  }
+  close(ep);
+  close(sfd);
+}
+
+static int compare_ll(const void *a, const void *b) {
+  long long va = *(const long long *)a, vb = *(const long long *)b;
+  return (va > vb) - (va < vb);
+}
+
+// Поток замера: по очереди шлёт SIGUSR1 и пишет байт в канал stdin, каждый
+// раз дожидаясь обработки. Паузы разные, чтобы фаза относительно 10-мс
+// опроса менялась равномерно.
+static void *sender(void *arg) {
+  int wfd = (int)(long)arg;
+  sigset_t all;
+  sigfillset(&all);
+  pthread_sigmask(SIG_BLOCK, &all, NULL);   // сигналы — только главному потоку
+  for (int i = 0; i < 2 * measure_n; i++) {
+    usleep(1000 + (unsigned)(i * 7919) % 9000);
+    atomic_store(&sent_ns, now_ns());
+    if (i % 2 == 0) {
+      kill(getpid(), SIGUSR1);
+    } else if (write(wfd, "k", 1) != 1) {
+      perror("write");
+      exit(EXIT_FAILURE);
+    }
+    while (atomic_load(&done) <= i)
+      usleep(100);
+  }
+  sleep(1);
+  kill(getpid(), SIGUSR2);
+  return NULL;
+}
+
+static void print_latency(const char *mode, const char *what, long long *lat, int n) {
+  qsort(lat, (size_t)n, sizeof(long long), compare_ll);
+  printf("%-8s %-6s samples %d  latency us: p50 %8.1f  p99 %8.1f  max %8.1f\n", mode, what, n,
+         lat[n / 2] / 1e3, lat[n * 99 / 100] / 1e3, lat[n - 1] / 1e3);
+}
+
+int main(int argc, char *argv[]) {
+  int use_signalfd = 0, opt;
+  int key_pipe[2] = { -1, -1 };
+  while ((opt = getopt(argc, argv, "sm:")) != -1) {
+    switch (opt) {
+    case 's': use_signalfd = 1; break;
+    case 'm': measure_n = atoi(optarg); break;
+    default:
+      fprintf(stderr, "usage: %s [-s] [-m samples]\n", progname);
+      return EXIT_FAILURE;
+    }
+  }
+  if (measure_n < 0) measure_n = 0;
+
+  setvbuf(stdout, NULL, _IOLBF, 0);
+  if (!measure_n) {
+    printf("%s: starting%s...\n", progname, use_signalfd ? " (signalfd + epoll)" : "");
+    printf("Поддерживаемые сигналы: SIGINT(Ctrl+C), SIGTERM, SIGUSR1, SIGUSR2.\n");
+    printf("Замечание: SIGKILL нельзя перехватить или обработать на Linux.\n");
+    printf("Нажмите 'q' для выхода.\n");
+
+    if (enable_raw_mode() == -1) {
+      perror("termios");
+      return EXIT_FAILURE;
+    }
+  } else {
+    lat_sig = calloc((size_t)measure_n, sizeof(long long));
+    lat_key = calloc((size_t)measure_n, sizeof(long long));
+    // Вместо клавиатуры — канал, в который пишет поток замера
+    if (!lat_sig || !lat_key || pipe(key_pipe) == -1 ||
+        dup2(key_pipe[0], STDIN_FILENO) == -1 ||
+        fcntl(STDIN_FILENO, F_SETFL, O_NONBLOCK) == -1) {
+      perror("measure setup");
+      return EXIT_FAILURE;
+    }
+  }
+
+  sigset_t mask;
+  sigemptyset(&mask);
+  sigaddset(&mask, SIGINT);
+  sigaddset(&mask, SIGTERM);
+  sigaddset(&mask, SIGUSR1);
+  sigaddset(&mask, SIGUSR2);
+  if (use_signalfd && sigprocmask(SIG_BLOCK, &mask, NULL) == -1) {
+    perror("sigprocmask");
+    return EXIT_FAILURE;
+  }
+
+  pthread_t th;
+  if (measure_n && pthread_create(&th, NULL, sender, (void *)(long)key_pipe[1]) != 0) {
+    perror("pthread_create");
+    return EXIT_FAILURE;
+  }
+
+  if (use_signalfd)
+    signalfd_loop(&mask);
+  else
+    poll_loop();
+
+  if (measure_n) {
+    pthread_join(th, NULL);
+    double idle_secs = (now_ns() - idle_t0) / 1e9;
+    const char *mode = use_signalfd ? "signalfd" : "poll";
+    print_latency(mode, "signal", lat_sig, sig_n);
+    print_latency(mode, "key", lat_key, key_n);
+    // Последнее пробуждение — SIGUSR2, он не в счёт
+    printf("%-8s idle loop wakeups/s %.1f\n", mode, (loop_wakeups - idle_w0 - 1) / idle_secs);
+    free(lat_sig);
+    free(lat_key);
+    return EXIT_SUCCESS;
+  }
 
   printf("%s: exiting...\n", progname);
   return EXIT_SUCCESS;
-}
\ No newline at end of file
+}
+
+/*
+ * Результаты (1 CPU, ./bin/intsimple -m 200 и -s -m 200):
+ *
+ *   poll     signal  latency us: p50     27.1  p99    111.2  max    175.1
+ *   poll     key     latency us: p50   4483.6  p99  10047.4  max  10056.4
+ *   poll     idle loop wakeups/s 98.0
+ *   signalfd signal  latency us: p50     24.7  p99     76.9  max    175.2
+ *   signalfd key     latency us: p50     17.2  p99     33.1  max    108.7
+ *   signalfd idle loop wakeups/s 0.0
+ *
+ *  - Сигнал в режиме опроса обрабатывается почти сразу: обработчик
+ *    прерывает usleep (EINTR), и цикл проверяет флаги без ожидания. Разница
+ *    с signalfd по сигналам — в пределах шума.
+ *  - Клавиша в режиме опроса ждёт следующего витка: в среднем половина
+ *    периода (4.5 мс), в худшем — весь (10 мс). epoll будит цикл сразу
+ *    (17 мкс).
+ *  - Без событий опрос просыпается 100 раз в секунду, signalfd + epoll —
+ *    ни разу.
+ */
@@ -0,0 +1,198 @@
+/*
+ * Замер блокировки t2 в сценариях инверсии приоритетов
+ *
+ * server, t1 и t2 из working.c работают в режиме замера: вместо сна жгут
+ * процессор и привязаны к CPU 0, так что средний t1 действительно отнимает
+ * процессор у server, пока тот держит ресурс. Каждый поток пишет в трассу
+ * (working.h) моменты запроса, захвата и освобождения ресурса; по ней
+ * после прогона считается блокировка t2 (захват - запрос).
+ *
+ * harness_repeat повторяет прогон runs раз и печатает распределение
+ * блокировки t2 — худший случай важнее среднего — и временную диаграмму
+ * худшего прогона.
+ */
+#define _GNU_SOURCE
+#include "working.h"
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <string.h>
+#include <unistd.h>
+
+static const char *const who_names[] = { "server", "t1", "t2" };
+static const char *const ev_names[] = { "start", "request", "acquire", "release", "end" };
+
+static int set_thread_priority(pthread_attr_t *attr, int policy, int prio)
+{
+  pthread_attr_init(attr);
+  pthread_attr_setinheritsched(attr, PTHREAD_EXPLICIT_SCHED);
+  pthread_attr_setschedpolicy(attr, policy);
+  struct sched_param sp;
+  memset(&sp, 0, sizeof(sp));
+  sp.sched_priority = prio;
+  // Все на одном CPU: инверсия возникает, только когда потоки делят процессор
+  cpu_set_t cpus;
+  CPU_ZERO(&cpus);
+  CPU_SET(0, &cpus);
+  pthread_attr_setaffinity_np(attr, sizeof(cpus), &cpus);
+  return pthread_attr_setschedparam(attr, &sp);
+}
+
+int harness_init(int unit_us)
+{
+  // Главный поток выше всех: иначе на одном CPU он не проснётся, пока
+  // server и t1 крутятся под SCHED_FIFO
+  struct sched_param sp = { .sched_priority = PRIO_T2 + 10 };
+  int rc = pthread_setschedparam(pthread_self(), SCHED_FIFO, &sp);
+  if (rc != 0) {
+    fprintf(stderr, "SCHED_FIFO: %s (нужен root или CAP_SYS_NICE)\n", strerror(rc));
+    return -1;
+  }
+  working_set_measure(1);
+  working_set_unit_us(unit_us);
+  return 0;
+}
+
+int harness_run(int protocol, int ceiling, inv_stats *out)
+{
+  if (init_resource_mutex(protocol, ceiling) != 0)
+    return -1;
+
+  pthread_attr_t attr_server, attr_t1, attr_t2;
+  set_thread_priority(&attr_server, SCHED_FIFO, PRIO_SERVER);
+  set_thread_priority(&attr_t1, SCHED_FIFO, PRIO_T1);
+  set_thread_priority(&attr_t2, SCHED_FIFO, PRIO_T2);
+
+  trace_reset();
+  pthread_t th_server, th_t1, th_t2;
+  int rc = pthread_create(&th_server, &attr_server, server, NULL);
+  if (rc != 0) {
+    fprintf(stderr, "pthread_create server: %s\n", strerror(rc));
+    destroy_resource_mutex();
+    return -1;
+  }
+  // Небольшая фора серверу: он успевает захватить ресурс (50 единиц работы
+  // из 250 его критической секции)
+  usleep(50 * working_unit_us());
+
+  working_reset_stats();
+  if (pthread_create(&th_t2, &attr_t2, t2, NULL) != 0 ||
+      pthread_create(&th_t1, &attr_t1, t1, NULL) != 0) {
+    perror("pthread_create");
+    exit(EXIT_FAILURE);
+  }
+
+  pthread_join(th_t1, NULL);
+  pthread_join(th_t2, NULL);
+  pthread_join(th_server, NULL);
+  if (out)
+    working_get_stats(out);
+
+  pthread_attr_destroy(&attr_server);
+  pthread_attr_destroy(&attr_t1);
+  pthread_attr_destroy(&attr_t2);
+  destroy_resource_mutex();
+  return 0;
+}
+
+static long long find_event(const trace_ev *ev, int n, int who, int type)
+{
+  for (int i = 0; i < n; i++)
+    if (ev[i].who == who && ev[i].ev == type)
+      return ev[i].ns;
+  return -1;
+}
+
+static int compare_double(const void *a, const void *b)
+{
+  double va = *(const double *)a;
+  double vb = *(const double *)b;
+  return (va > vb) - (va < vb);
+}
+
+static int compare_event(const void *a, const void *b)
+{
+  long long va = ((const trace_ev *)a)->ns;
+  long long vb = ((const trace_ev *)b)->ns;
+  return (va > vb) - (va < vb);
+}
+
+int harness_repeat(int protocol, int ceiling, int runs)
+{
+  double *block = malloc((size_t)runs * sizeof(double));
+  trace_ev worst[TRACE_CAP];
+  int worst_n = 0, worst_run = -1, failed = 0;
+  double sum = 0.0;
+
+  if (!block) {
+    perror("malloc");
+    return -1;
+  }
+
+  int done = 0;
+  for (int r = 0; r < runs; r++) {
+    if (harness_run(protocol, ceiling, NULL) != 0) {
+      free(block);
+      return -1;
+    }
+    const trace_ev *ev;
+    int n = trace_read(&ev);
+    long long req = find_event(ev, n, TR_T2, TR_REQUEST);
+    long long acq = find_event(ev, n, TR_T2, TR_ACQUIRE);
+    if (req < 0 || acq < 0) {
+      failed++;       // t2 не получил ресурс (например, EINVAL при потолке)
+      continue;
+    }
+    double ms = (acq - req) / 1e6;
+    if (worst_run < 0 || ms > block[worst_run]) {
+      worst_run = done;
+      worst_n = n;
+      memcpy(worst, ev, (size_t)n * sizeof(trace_ev));
+    }
+    block[done++] = ms;
+    sum += ms;
+  }
+
+  int unit = working_unit_us();
+  printf("%d runs, work unit %d us: server critical section %.1f ms CPU, t1 %.1f ms CPU\n",
+         runs, unit, 250 * unit / 1e3, 2000 * unit / 1e3);
+  if (done == 0) {
+    printf("t2 did not acquire the resource in any run\n");
+    free(block);
+    return -1;
+  }
+  double worst_ms = block[worst_run];
+  qsort(block, (size_t)done, sizeof(double), compare_double);
+  printf("t2 blocking, ms: min %.2f  avg %.2f  p50 %.2f  p99 %.2f  max %.2f\n",
+         block[0], sum / done, block[done / 2], block[(done * 99) / 100], block[done - 1]);
+  if (failed)
+    printf("runs where t2 did not acquire the resource: %d\n", failed);
+
+  // Диаграмма худшего прогона: от старта server
+  qsort(worst, (size_t)worst_n, sizeof(trace_ev), compare_event);
+  printf("worst run (t2 blocked %.2f ms):\n", worst_ms);
+  for (int i = 0; i < worst_n; i++)
+    printf("  %9.3f ms  %-6s %s\n", (worst[i].ns - worst[0].ns) / 1e6,
+           who_names[worst[i].who], ev_names[worst[i].ev]);
+
+  free(block);
+  return 0;
+}
+
+/*
+ * Результаты (1 CPU, sched_rt_runtime_us = 950000, -n 100 -u 100: критическая
+ * секция server 25 мс CPU, t1 200 мс CPU):
+ *
+ *   сценарий          min     avg     p50     p99     max   (блокировка t2, мс)
+ *   inv_s1 (none)   220.2   231.3   220.3   271.4   271.4
+ *   inv_s2 (inherit) 20.0    21.5    20.0    67.8    67.8
+ *
+ *  - Без протокола t2 ждёт всю работу t1 и остаток секции server, то есть
+ *    блокировка не ограничена длиной критической секции.
+ *  - С наследованием типичная блокировка — остаток секции (20 мс из 25), а
+ *    худший случай в 3 раза больше. На диаграмме худшего прогона server
+ *    отпускает ресурс вовремя, а t2 захватывает его на 25 мс позже: это
+ *    троттлинг RT-задач (50 мс из каждой секунды отдаются обычным
+ *    задачам). По среднему этого не видно — поэтому отчёт по максимуму.
+ *  - С единицей 1000 мкс (как в демонстрации) inv_s2 -n 5: 200.0 ... 208.9 мс.
+ */
@@ -17,7 +17,27 @@ static int set_thread_priority(pthread_attr_t *attr, int policy, int prio)
 }
 
 int main(int argc, char *argv[]) {
-  (void)argc; (void)argv;
+  // -n N [-u мкс] — замер: N прогонов на одном CPU с трассой событий, отчёт
+  // о блокировке t2 (harness.c). Без аргументов — прежняя демонстрация.
+  int runs = 0, unit_us = 1000, opt;
+  while ((opt = getopt(argc, argv, "n:u:")) != -1) {
+    switch (opt) {
+    case 'n':
+      runs = atoi(optarg);
+      break;
+    case 'u':
+      unit_us = atoi(optarg);
+      break;
+    default:
+      fprintf(stderr, "usage: %s [-n runs [-u unit_us]]\n", argv[0]);
+      return EXIT_FAILURE;
+    }
+  }
+  if (runs > 0) {
+    if (unit_us <= 0 || harness_init(unit_us) != 0)
+      return EXIT_FAILURE;
+    return harness_repeat(RES_PROTO_NONE, 0, runs) == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+  }
 
   // Настраиваем SCHED_FIFO приоритеты: server=10 (низкий), t1=20 (средний), t2=30 (высокий)
   const int policy = SCHED_FIFO;
@@ -26,7 +46,7 @@ int main(int argc, char *argv[]) {
   const int prio_t2 = 30;
 
   // Мьютекс без наследования приоритета — демонстрация инверсии
-  if (init_resource_mutex(0) != 0) {
+  if (init_resource_mutex(RES_PROTO_NONE, 0) != 0) {
     perror("init_resource_mutex");
     return EXIT_FAILURE;
   }
@@ -0,0 +1,110 @@
+/*
+ * Сравнение протоколов мьютекса ресурса: без протокола, наследование
+ * (PTHREAD_PRIO_INHERIT) и потолок (PTHREAD_PRIO_PROTECT).
+ *
+ * Те же server/t1/t2, что в scenario_1, но в режиме замера harness.c: работа
+ * жжёт CPU, а все три потока привязаны к CPU 0 — иначе на многоядерной
+ * машине t1 просто уйдёт на другое ядро и инверсии не будет.
+ *
+ * Для каждого протокола печатается:
+ *  - block — сколько t2 простоял в pthread_mutex_lock;
+ *  - resp — от создания t2 до захвата им ресурса. При потолке t2 вообще не
+ *    доходит до lock, пока server в критической секции (server выполняется
+ *    с приоритетом потолка), поэтому block у него около нуля, а ожидание
+ *    видно только в resp;
+ *  - csw — переключения контекста каждого потока (getrusage, RUSAGE_THREAD).
+ *
+ * Нужны права на SCHED_FIFO (root или CAP_SYS_NICE).
+ *
+ * Запуск: ./bin/inv_s3 [-c потолок] [-p none|inherit|protect]
+ */
+#define _GNU_SOURCE
+#include "working.h"
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <string.h>
+#include <unistd.h>
+
+static const char *const proto_names[] = { "none", "inherit", "protect" };
+
+int main(int argc, char *argv[])
+{
+  int ceiling = PRIO_T2;
+  int only = -1;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "c:p:")) != -1) {
+    switch (opt) {
+    case 'c':
+      ceiling = atoi(optarg);
+      break;
+    case 'p':
+      for (int i = 0; i < 3; i++)
+        if (strcmp(optarg, proto_names[i]) == 0)
+          only = i;
+      if (only < 0) {
+        fprintf(stderr, "%s: -p none|inherit|protect\n", argv[0]);
+        return EXIT_FAILURE;
+      }
+      break;
+    default:
+      fprintf(stderr, "usage: %s [-c ceiling] [-p none|inherit|protect]\n", argv[0]);
+      return EXIT_FAILURE;
+    }
+  }
+
+  // POSIX: захват мьютекса с потолком ниже приоритета потока — EINVAL
+  if (ceiling < PRIO_T2 || ceiling > sched_get_priority_max(SCHED_FIFO)) {
+    fprintf(stderr, "%s: потолок %d..%d — не ниже приоритета t2\n", argv[0],
+            PRIO_T2, sched_get_priority_max(SCHED_FIFO));
+    return EXIT_FAILURE;
+  }
+
+  if (harness_init(1000) != 0)
+    return EXIT_FAILURE;
+
+  printf("server=%d t1=%d t2=%d, ceiling=%d; критическая секция server 250 мс CPU, t1 2000 мс CPU\n",
+         PRIO_SERVER, PRIO_T1, PRIO_T2, ceiling);
+  printf("%-8s %7s %10s %10s %10s %8s %8s\n",
+         "protocol", "ceiling", "block_ms", "resp_ms", "csw_server", "csw_t1", "csw_t2");
+  for (int p = 0; p < 3; p++) {
+    if (only >= 0 && p != only)
+      continue;
+    inv_stats st;
+    if (harness_run(p, ceiling, &st) != 0) {
+      printf("%-8s  не поддерживается\n", proto_names[p]);
+      continue;
+    }
+    char ceil_str[16] = "-";
+    if (p == RES_PROTO_PROTECT)
+      snprintf(ceil_str, sizeof(ceil_str), "%d", ceiling);
+    printf("%-8s %7s %10.1f %10.1f %10ld %8ld %8ld\n", proto_names[p], ceil_str,
+           st.t2_block_ms, st.t2_response_ms, st.csw_server, st.csw_t1, st.csw_t2);
+  }
+  return EXIT_SUCCESS;
+}
+
+/*
+ * Результаты (1 CPU, SCHED_FIFO, sched_rt_runtime_us = 950000, 3 прогона):
+ *
+ *   protocol ceiling   block_ms    resp_ms  csw_server  csw_t1  csw_t2
+ *   none           -  2297-2304  2298-2304        2-8    11-17       1
+ *   inherit        -    200-204    200-204       2-14    12-29     1-3
+ *   protect       30    207-247    207-247       2-10    17-22       1
+ *   protect       31        0.0        200          2     8-21       0
+ *
+ *  - Без протокола t2 ждёт всю работу t1 (2 с) плюс остаток критической
+ *    секции server: классическая неограниченная инверсия.
+ *  - С наследованием и с потолком ожидание t2 ограничено остатком одной
+ *    критической секции (~200 мс из 250). Разброс вверх — троттлинг
+ *    RT-задач: 50 мс из каждой секунды процессор отдаётся обычным задачам.
+ *  - При потолке, равном приоритету t2, t2 всё же успевает дойти до lock и
+ *    заблокироваться: новый поток с тем же приоритетом встаёт в очередь
+ *    раньше вытесненного server. С потолком выше t2 server в критической
+ *    секции не вытесняет никто из участников, t2 не блокируется вовсе
+ *    (block = 0, csw_t2 = 0), а ожидание переходит в отклик.
+ *  - Переключений контекста у server и t2 единицы во всех режимах — их
+ *    добавляют вытеснения главным потоком и троттлинг; t1 вытесняется
+ *    чаще всех, потому что крутится дольше всех.
+ */
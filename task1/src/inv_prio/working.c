@@ -4,13 +4,25 @@
 #include <errno.h>
 #include <pthread.h>
 #include <sched.h>
+#include <stdatomic.h>
 #include <string.h>
+#include <sys/resource.h>
 #include <time.h>
 #include <unistd.h>
 
 static pthread_mutex_t resource_mutex;
+static int measure;
+static inv_stats stats;
+static struct timespec t2_release;
+static int unit_us = 1000;
+static trace_ev trace_buf[TRACE_CAP];
+static atomic_int trace_len;
 
-int init_resource_mutex(int enable_prio_inherit)
+// В режиме замера вывод потоков только мешает: printf под SCHED_FIFO
+// добавляет свои блокировки и переключения
+#define LOG(...) do { if (!measure) printf(__VA_ARGS__); } while (0)
+
+int init_resource_mutex(int protocol, int ceiling)
 {
   pthread_mutexattr_t attr;
   int rc;
@@ -21,13 +33,23 @@ int init_resource_mutex(int enable_prio_inherit)
 
   pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_NORMAL);
 
-  if (enable_prio_inherit) {
+  if (protocol == RES_PROTO_INHERIT) {
         rc = pthread_mutexattr_setprotocol(&attr, PTHREAD_PRIO_INHERIT);
         if (rc) {
             fprintf(stderr, "ERROR: PTHREAD_PRIO_INHERIT is not supported (rc=%d)\n", rc);
             pthread_mutexattr_destroy(&attr);
             return -1;
         }
+    } else if (protocol == RES_PROTO_PROTECT) {
+        rc = pthread_mutexattr_setprotocol(&attr, PTHREAD_PRIO_PROTECT);
+        if (rc == 0)
+            rc = pthread_mutexattr_setprioceiling(&attr, ceiling);
+        if (rc) {
+            fprintf(stderr, "ERROR: PTHREAD_PRIO_PROTECT with ceiling %d is not supported (rc=%d)\n",
+                    ceiling, rc);
+            pthread_mutexattr_destroy(&attr);
+            return -1;
+        }
     }
 
     rc = pthread_mutex_init(&resource_mutex, &attr);
@@ -36,36 +58,141 @@ int init_resource_mutex(int enable_prio_inherit)
     return rc == 0 ? 0 : -1;
 }
 
+void destroy_resource_mutex(void)
+{
+  pthread_mutex_destroy(&resource_mutex);
+}
+
+void working_set_measure(int enable)
+{
+  measure = enable;
+}
+
+void working_set_unit_us(int us)
+{
+  unit_us = us;
+}
+
+int working_unit_us(void)
+{
+  return unit_us;
+}
+
+void trace_reset(void)
+{
+  atomic_store(&trace_len, 0);
+}
+
+int trace_read(const trace_ev **ev)
+{
+  int n = atomic_load(&trace_len);
+  *ev = trace_buf;
+  return n < TRACE_CAP ? n : TRACE_CAP;
+}
+
+/*
+ * Запись события: ни мьютекса, ни printf — они сами по себе меняют
+ * расписание потоков, которое мы меряем. Слоты раздаёт атомарный счётчик,
+ * так что потоки пишут в разные элементы и друг друга не ждут.
+ */
+static void trace(int who, int ev)
+{
+  if (!measure)
+    return;
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  int i = atomic_fetch_add_explicit(&trace_len, 1, memory_order_relaxed);
+  if (i >= TRACE_CAP)
+    return;
+  trace_buf[i].ns = ts.tv_sec * 1000000000LL + ts.tv_nsec;
+  trace_buf[i].who = who;
+  trace_buf[i].ev = ev;
+}
+
+void working_reset_stats(void)
+{
+  memset(&stats, 0, sizeof(stats));
+  clock_gettime(CLOCK_MONOTONIC, &t2_release);
+}
+
+void working_get_stats(inv_stats *out)
+{
+  *out = stats;
+}
+
+static double elapsed_ms(const struct timespec *a, const struct timespec *b)
+{
+  return (b->tv_sec - a->tv_sec) * 1e3 + (b->tv_nsec - a->tv_nsec) / 1e6;
+}
+
+static long thread_csw(void)
+{
+  struct rusage ru;
+  if (getrusage(RUSAGE_THREAD, &ru) != 0)
+    return -1;
+  return ru.ru_nvcsw + ru.ru_nivcsw;
+}
+
+/*
+ * В режиме замера "работа" — ms миллисекунд процессорного времени потока:
+ * пока поток вытеснен, его работа не идёт, и именно это удлиняет
+ * критическую секцию при инверсии.
+ */
 static void busy_ms(int ms)
 {
   struct timespec ts;
+  if (measure) {
+    struct timespec start, now;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &start);
+    do
+      clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+    while (elapsed_ms(&start, &now) * 1000.0 < (double)ms * unit_us);
+    return;
+  }
   ts.tv_sec = ms / 1000;
   ts.tv_nsec = (ms % 1000) * 1000000L;
   nanosleep(&ts, NULL);
 }
 
+static int lock_resource(const char *who, int tr)
+{
+  trace(tr, TR_REQUEST);
+  int rc = pthread_mutex_lock(&resource_mutex);
+  if (rc == 0)
+    trace(tr, TR_ACQUIRE);
+  // PTHREAD_PRIO_PROTECT: приоритет потока выше потолка — EINVAL
+  if (rc != 0)
+    fprintf(stderr, "ERROR: %s: pthread_mutex_lock: %s\n", who, strerror(rc));
+  return rc;
+}
+
 void working(int tid)
 {
   // Имитация работы с общим ресурсом
   for (int i = 0; i < 5; i++)
   {
-    printf("server is working for %d - %dth start\n", tid, i);
+    LOG("server is working for %d - %dth start\n", tid, i);
     busy_ms(50);
-    printf("server is working for %d - %dth end\n", tid, i);
+    LOG("server is working for %d - %dth end\n", tid, i);
   }
-  printf("server finished all work for %d\n", tid);
+  LOG("server finished all work for %d\n", tid);
 }
 
 // Низкоприоритетный поток: захватывает ресурс и держит его некоторое время
 void *server(void *arg)
 {
   (void)arg;
-  printf("[SERVER] стартует и захватывает ресурс\n");
-  pthread_mutex_lock(&resource_mutex);
+  trace(TR_SERVER, TR_START);
+  LOG("[SERVER] стартует и захватывает ресурс\n");
+  if (lock_resource("server", TR_SERVER) != 0)
+    return NULL;
   // Держим ресурс достаточно долго, чтобы высокий приоритет т2 подождал
   working(0);
+  trace(TR_SERVER, TR_RELEASE);
   pthread_mutex_unlock(&resource_mutex);
-  printf("[SERVER] освободил ресурс\n");
+  LOG("[SERVER] освободил ресурс\n");
+  stats.csw_server = thread_csw();
+  trace(TR_SERVER, TR_END);
   return NULL;
 }
 
@@ -73,13 +200,16 @@ void *server(void *arg)
 void *t1(void *arg)
 {
   (void)arg;
-  printf("[T1 mid] стартует (фоновая нагрузка)\n");
+  trace(TR_T1, TR_START);
+  LOG("[T1 mid] стартует (фоновая нагрузка)\n");
   for (int i = 0; i < 200; i++)
   {
     // Загрузка времени
     busy_ms(10);
   }
-  printf("[T1 mid] завершился\n");
+  LOG("[T1 mid] завершился\n");
+  stats.csw_t1 = thread_csw();
+  trace(TR_T1, TR_END);
   return NULL;
 }
 
@@ -87,11 +217,21 @@ void *t1(void *arg)
 void *t2(void *arg)
 {
   (void)arg;
-  printf("[T2 high] пытается получить ресурс\n");
-  pthread_mutex_lock(&resource_mutex);
-  printf("[T2 high] получил ресурс\n");
+  struct timespec before, after;
+  trace(TR_T2, TR_START);
+  LOG("[T2 high] пытается получить ресурс\n");
+  clock_gettime(CLOCK_MONOTONIC, &before);
+  if (lock_resource("t2", TR_T2) != 0)
+    return NULL;
+  clock_gettime(CLOCK_MONOTONIC, &after);
+  stats.t2_block_ms = elapsed_ms(&before, &after);
+  stats.t2_response_ms = elapsed_ms(&t2_release, &after);
+  LOG("[T2 high] получил ресурс\n");
   busy_ms(20);
+  trace(TR_T2, TR_RELEASE);
   pthread_mutex_unlock(&resource_mutex);
-  printf("[T2 high] освободил ресурс и завершился\n");
+  LOG("[T2 high] освободил ресурс и завершился\n");
+  stats.csw_t2 = thread_csw();
+  trace(TR_T2, TR_END);
   return NULL;
-}
\ No newline at end of file
+}
@@ -11,9 +11,58 @@ typedef struct _msg_priority {
   int priority;
 } msg_priority;
 
-// Инициализация мьютекса ресурса.
-// enable_prio_inherit = 0 — обычный мьютекс; 1 — попытка включить наследование приоритета.
-int init_resource_mutex(int enable_prio_inherit);
+// Протокол мьютекса ресурса
+#define RES_PROTO_NONE 0      // обычный мьютекс
+#define RES_PROTO_INHERIT 1   // PTHREAD_PRIO_INHERIT
+#define RES_PROTO_PROTECT 2   // PTHREAD_PRIO_PROTECT с потолком ceiling
+
+// Инициализация мьютекса ресурса. ceiling учитывается только для RES_PROTO_PROTECT:
+// владелец мьютекса выполняется с приоритетом не ниже потолка.
+int init_resource_mutex(int protocol, int ceiling);
+void destroy_resource_mutex(void);
+
+// Замеры для сравнения протоколов (scenario_3)
+typedef struct _inv_stats {
+  double t2_block_ms;     // t2 внутри pthread_mutex_lock
+  double t2_response_ms;  // от working_reset_stats() до захвата ресурса t2
+  long csw_server;        // переключения контекста потока (добровольные + вытеснения)
+  long csw_t1;
+  long csw_t2;
+} inv_stats;
+
+// 1 — работа жжёт CPU вместо сна (иначе инверсии нет: спящий поток не
+// занимает процессор), вывод потоков отключён, события пишутся в трассу
+void working_set_measure(int enable);
+// Единица работы в режиме замера, мкс CPU (по умолчанию 1000 — "мс" из кода потоков)
+void working_set_unit_us(int unit_us);
+int working_unit_us(void);
+// Обнуляет замеры; вызывать прямо перед созданием t2 — от этого момента считается отклик
+void working_reset_stats(void);
+void working_get_stats(inv_stats *out);
+
+// Трасса событий потоков в режиме замера. Пишется без блокировок: слот
+// занимается atomic_fetch_add, читать — после pthread_join всех потоков
+#define TRACE_CAP 256
+enum { TR_SERVER, TR_T1, TR_T2 };
+enum { TR_START, TR_REQUEST, TR_ACQUIRE, TR_RELEASE, TR_END };
+typedef struct _trace_ev {
+  long long ns;           // CLOCK_MONOTONIC
+  int who;                // TR_SERVER, TR_T1, TR_T2
+  int ev;                 // TR_START ... TR_END
+} trace_ev;
+
+void trace_reset(void);
+int trace_read(const trace_ev **ev);   // число событий; лишние сверх TRACE_CAP теряются
+
+// Приоритеты SCHED_FIFO в сценариях замера
+#define PRIO_SERVER 10
+#define PRIO_T1 20
+#define PRIO_T2 30
+
+// Замер (harness.c): server, t1 и t2 на одном CPU, главный поток — SCHED_FIFO выше них
+int harness_init(int unit_us);                               // -1 — нет прав на SCHED_FIFO
+int harness_run(int protocol, int ceiling, inv_stats *out);  // один прогон
+int harness_repeat(int protocol, int ceiling, int runs);     // runs прогонов и отчёт по трассе
 
 // Имитируем работу с ресурсом (внутри критической секции)
 void working(int process_id);
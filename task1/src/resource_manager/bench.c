@@ -0,0 +1,1030 @@
+/*
+ *  Нагрузочный клиент для resmgr
+ *
+ *  Открывает C соединений, раздаёт их J потокам (у каждого свой epoll) и
+ *  в течение D секунд по каждому соединению гоняет команду (по умолчанию
+ *  INFO): отправили строку — дождались строки ответа — отправили снова.
+ *  Печатает запросы/с, а также RSS и число потоков сервера из /proc: pid
+ *  сервера берётся из SO_PEERCRED первого соединения.
+ *
+ *  Сравнение моделей:
+ *    ./bin/resmgr -T &      ./bin/resmgr_bench      # поток на клиента
+ *    ./bin/resmgr -t 2 &    ./bin/resmgr_bench      # epoll, 2 потока
+ *
+ *  Режим -r P — смесь для проверки конкурентного чтения: перед прогоном
+ *  буфер устройства заполняется целиком, затем P% запросов — READ (ответ
+ *  ровно размера буфера), остальные — SETPERM rw (берёт блокировку
+ *  устройства на запись). Без -c прогоняет 1, 2, 4 и 8 клиентских потоков по
+ *  одному соединению, чтобы было видно масштабирование по читателям:
+ *    ./bin/resmgr -t 8 &    ./bin/resmgr_bench -r 95
+ *
+ *  -s добавляет "медленного читателя": отдельное соединение шлёт пачку READ
+ *  и не читает ответы. Если сервер держит блокировку устройства во время
+ *  отправки, остальные клиенты встают.
+ *
+ *  -D N — соединения раскладываются по N устройствам (resmgr -D): i-е
+ *  соединение шлёт команды с префиксом /dev<i mod N>. Без -c прогоняет 1, 2,
+ *  4 и 8 клиентских потоков по одному соединению дважды: все на одном
+ *  устройстве и каждое на своём (N = числу потоков). SETPERM берёт
+ *  блокировку устройства на запись, поэтому на одном устройстве запросы
+ *  сериализуются:
+ *    ./bin/resmgr -t 8 -D 8 &    ./bin/resmgr_bench -D 8 -m "SETPERM rw"
+ *
+ *  -z — большие READ: устройство заполняется до 4 КиБ, 64 КиБ, 1 МиБ и
+ *  16 МиБ, и одно соединение в цикле читает его целиком — обычным READ (в
+ *  сервере sendfile из memfd или, с -C, send из буфера) и через READFD
+ *  (клиент получает memfd и читает его pread). Печатает МиБ/с и процессорное
+ *  время сервера на гигабайт:
+ *    ./bin/resmgr -S 16M &    ./bin/resmgr_bench -z
+ *
+ *  -w R — потоковый режим для кольцевого устройства (resmgr -R): R
+ *  соединений-читателей (на -j потоках) в цикле шлют READ WAIT, а писатель
+ *  пишет строки "T<время отправки, нс>". Для каждой доставленной строки
+ *  считается задержка запись -> чтение. Два прогона: писатель с темпом
+ *  1 кГц (задержка уведомления) и без ограничения, пачками (пропускная
+ *  способность; lost — сколько байт читатели не успели забрать из кольца):
+ *    ./bin/resmgr -R 65536 &    ./bin/resmgr_bench -w 16
+ *
+ *  Запуск: ./bin/resmgr_bench [-c соединений] [-j потоков] [-d секунд] [-m команда] [-r процент_READ] [-s] [-w читателей] [-D устройств] [-z]
+ *  Без -c прогоняет 10, 1000 и 10000 соединений.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#define EXAMPLE_SOCK_PATH "/tmp/example_resmgr.sock"
+#define MAX_THREADS 64
+#define MAX_EVENTS 256
+#define STREAM_BATCH 32         // WRITE за один send в прогоне без темпа
+#define STREAM_MAX_LAT (1 << 20)
+
+typedef struct conn_state
+{
+  int fd;
+  int reading;          // ждём ответ на READ (длина известна), иначе — строку
+  size_t got;
+  unsigned seed;
+  int dev;              // -D: номер устройства в префиксе, -1 — без префикса
+} conn_state_t;
+
+typedef struct load
+{
+  pthread_t th;
+  int *fds;
+  int n_fds;
+  int first;            // номер первого соединения среди всех
+  long done;
+  long errors;
+} load_t;
+
+static char command[256] = "INFO\n";
+static size_t command_len = 5;
+static int read_pct = -1;       // -r: доля READ в смеси, -1 — только command
+static size_t read_size;        // длина ответа на READ после заполнения буфера
+static int opt_slow_reader = 0;
+static int opt_stream = 0;      // -w: число читателей в потоковом режиме
+static int opt_sizes = 0;       // -z
+static int opt_devs = 0;        // -D: по скольким устройствам раскладывать соединения
+static int target_devs = 0;     // то же для текущего прогона, 0 — без префикса
+static atomic_int stop;
+
+static const char read_cmd[] = "READ\n";
+static const char write_cmd[] = "SETPERM rw\n";
+static const char wait_cmd[] = "READ WAIT 100\n";
+
+// Соединение читателя в потоковом режиме: ответ "DATA <n>...\n" + n байт
+typedef struct stream_conn
+{
+  int fd;
+  char *buf;
+  size_t len;
+  size_t cap;
+} stream_conn_t;
+
+typedef struct stream
+{
+  pthread_t th;
+  stream_conn_t *conns;
+  int n_conns;
+  long lines;
+  unsigned long long lost;
+  int64_t *lat_ns;
+  size_t n_lat;
+  long errors;
+} stream_t;
+
+static double now_s(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int64_t now_ns(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static int compare_i64(const void *a, const void *b)
+{
+  int64_t va = *(const int64_t *)a;
+  int64_t vb = *(const int64_t *)b;
+  return (va > vb) - (va < vb);
+}
+
+static void raise_nofile_limit(void)
+{
+  struct rlimit rl;
+  if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max)
+  {
+    rl.rlim_cur = rl.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &rl);
+  }
+}
+
+static int connect_one(void)
+{
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd == -1)
+    return -1;
+
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strncpy(addr.sun_path, EXAMPLE_SOCK_PATH, sizeof(addr.sun_path) - 1);
+  if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1)
+  {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+// VmRSS (КиБ) и Threads процесса; -1 — не удалось прочитать
+static void proc_status(pid_t pid, long *rss_kb, long *threads)
+{
+  char path[64], line[256];
+  *rss_kb = *threads = -1;
+  snprintf(path, sizeof(path), "/proc/%d/status", (int)pid);
+  FILE *f = fopen(path, "r");
+  if (!f)
+    return;
+  while (fgets(line, sizeof(line), f))
+  {
+    sscanf(line, "VmRSS: %ld", rss_kb);
+    sscanf(line, "Threads: %ld", threads);
+  }
+  fclose(f);
+}
+
+static int issue(conn_state_t *st)
+{
+  char buf[300];
+  const char *cmd = command;
+  size_t len = command_len;
+  st->reading = 0;
+  st->got = 0;
+  if (read_pct >= 0)
+  {
+    st->reading = (int)(rand_r(&st->seed) % 100) < read_pct;
+    cmd = st->reading ? read_cmd : write_cmd;
+    len = st->reading ? sizeof(read_cmd) - 1 : sizeof(write_cmd) - 1;
+  }
+  if (st->dev >= 0)
+  {
+    len = (size_t)snprintf(buf, sizeof(buf), "/dev%d %.*s", st->dev, (int)len, cmd);
+    cmd = buf;
+  }
+  return send(st->fd, cmd, len, MSG_NOSIGNAL) == (ssize_t)len ? 0 : -1;
+}
+
+static void *load_thread(void *arg)
+{
+  load_t *l = arg;
+  struct epoll_event events[MAX_EVENTS];
+  char buf[8192];
+
+  conn_state_t *st = calloc((size_t)l->n_fds, sizeof(*st));
+  int epfd = epoll_create1(EPOLL_CLOEXEC);
+  if (!st || epfd == -1)
+  {
+    perror("load_thread");
+    free(st);
+    return NULL;
+  }
+  for (int i = 0; i < l->n_fds; i++)
+  {
+    st[i].fd = l->fds[i];
+    st[i].seed = (unsigned)(l->fds[i] * 2654435761u);
+    st[i].dev = target_devs > 0 ? (l->first + i) % target_devs : -1;
+    struct epoll_event ev = {.events = EPOLLIN, .data.ptr = &st[i]};
+    epoll_ctl(epfd, EPOLL_CTL_ADD, st[i].fd, &ev);
+    if (issue(&st[i]) == -1)
+      l->errors++;
+  }
+
+  while (!stop)
+  {
+    int n = epoll_wait(epfd, events, MAX_EVENTS, 100);
+    for (int i = 0; i < n; i++)
+    {
+      conn_state_t *c = events[i].data.ptr;
+      ssize_t got = recv(c->fd, buf, sizeof(buf), 0);
+      if (got <= 0)
+      {
+        // Сервер закрыл соединение (например, не смог создать поток)
+        epoll_ctl(epfd, EPOLL_CTL_DEL, c->fd, NULL);
+        l->errors++;
+        continue;
+      }
+      c->got += (size_t)got;
+      // Ответ на READ — ровно read_size байт, остальные ответы однострочные
+      if (c->reading ? c->got < read_size : buf[got - 1] != '\n')
+        continue;
+      l->done++;
+      if (!stop && issue(c) == -1)
+        l->errors++;
+    }
+  }
+  close(epfd);
+  free(st);
+  return NULL;
+}
+
+// Синхронно отправляет команду и читает однострочный ответ
+static int roundtrip(int fd, const char *cmd, char *resp, size_t resp_size)
+{
+  size_t len = strlen(cmd), got = 0;
+  if (send(fd, cmd, len, MSG_NOSIGNAL) != (ssize_t)len)
+    return -1;
+  while (got == 0 || resp[got - 1] != '\n')
+  {
+    ssize_t n = recv(fd, resp + got, resp_size - 1 - got, 0);
+    if (n <= 0)
+      return -1;
+    got += (size_t)n;
+  }
+  resp[got] = '\0';
+  return 0;
+}
+
+// Заполняет буфер устройства (prefix — "/devN " или "") до конца и запоминает его размер
+static int prefill(int fd, const char *prefix)
+{
+  char line[1024], cmd[64], resp[256];
+  size_t written = 1;
+
+  int off = snprintf(line, sizeof(line), "%sWRITE ", prefix);
+  memset(line + off, 'x', 899);
+  line[off + 899] = '\n';
+  line[off + 900] = '\0';
+  snprintf(cmd, sizeof(cmd), "%sSETPERM rw\n", prefix);
+  if (roundtrip(fd, cmd, resp, sizeof(resp)) == -1)
+    return -1;
+  snprintf(cmd, sizeof(cmd), "%sCLEAR\n", prefix);
+  if (roundtrip(fd, cmd, resp, sizeof(resp)) == -1)
+    return -1;
+  for (int i = 0; i < 64 && written > 0; i++)
+  {
+    if (roundtrip(fd, line, resp, sizeof(resp)) == -1 ||
+        sscanf(resp, "OK, %zu", &written) != 1)
+      return -1;
+  }
+  snprintf(cmd, sizeof(cmd), "%sINFO\n", prefix);
+  if (roundtrip(fd, cmd, resp, sizeof(resp)) == -1 ||
+      sscanf(resp, "Size=%zu", &read_size) != 1 || read_size == 0)
+    return -1;
+  return 0;
+}
+
+// Разбирает строки "T<нс>\n"; обрезанная потерей первая строка пропускается
+static void stream_consume(stream_t *s, const char *data, size_t n, int64_t now)
+{
+  const char *end = data + n;
+  while (data < end)
+  {
+    const char *nl = memchr(data, '\n', (size_t)(end - data));
+    if (!nl)
+      break;
+    if (*data == 'T')
+    {
+      s->lines++;
+      if (s->n_lat < STREAM_MAX_LAT)
+        s->lat_ns[s->n_lat++] = now - strtoll(data + 1, NULL, 10);
+    }
+    data = nl + 1;
+  }
+}
+
+static void *stream_thread(void *arg)
+{
+  stream_t *s = arg;
+  struct epoll_event events[MAX_EVENTS];
+
+  int epfd = epoll_create1(EPOLL_CLOEXEC);
+  if (epfd == -1)
+  {
+    perror("stream_thread");
+    return NULL;
+  }
+  for (int i = 0; i < s->n_conns; i++)
+  {
+    struct epoll_event ev = {.events = EPOLLIN, .data.ptr = &s->conns[i]};
+    epoll_ctl(epfd, EPOLL_CTL_ADD, s->conns[i].fd, &ev);
+    send(s->conns[i].fd, wait_cmd, sizeof(wait_cmd) - 1, MSG_NOSIGNAL);
+  }
+
+  while (!stop)
+  {
+    int n = epoll_wait(epfd, events, MAX_EVENTS, 100);
+    for (int i = 0; i < n; i++)
+    {
+      stream_conn_t *c = events[i].data.ptr;
+      if (c->cap - c->len < 4096)
+      {
+        size_t cap = c->cap ? c->cap * 2 : 65536;
+        char *buf = realloc(c->buf, cap);
+        if (!buf)
+        {
+          s->errors++;
+          continue;
+        }
+        c->buf = buf;
+        c->cap = cap;
+      }
+      ssize_t got = recv(c->fd, c->buf + c->len, c->cap - c->len, 0);
+      if (got <= 0)
+      {
+        epoll_ctl(epfd, EPOLL_CTL_DEL, c->fd, NULL);
+        s->errors++;
+        continue;
+      }
+      c->len += (size_t)got;
+
+      char *nl = memchr(c->buf, '\n', c->len);
+      if (!nl)
+        continue;
+      size_t hdr = (size_t)(nl - c->buf) + 1, data_len;
+      unsigned long long lost = 0;
+      if (sscanf(c->buf, "DATA %zu LOST %llu", &data_len, &lost) < 1)
+      {
+        s->errors++;    // например, "Not a ring device"
+        epoll_ctl(epfd, EPOLL_CTL_DEL, c->fd, NULL);
+        continue;
+      }
+      if (c->len < hdr + data_len)
+        continue;
+      stream_consume(s, c->buf + hdr, data_len, now_ns());
+      s->lost += lost;
+      c->len = 0;       // в полёте один запрос: после ответа буфер пуст
+      if (send(c->fd, wait_cmd, sizeof(wait_cmd) - 1, MSG_NOSIGNAL) != sizeof(wait_cmd) - 1)
+        s->errors++;
+    }
+  }
+  close(epfd);
+  return NULL;
+}
+
+// Ждёт count однострочных ответов на WRITE
+static int stream_acks(int fd, int count)
+{
+  char buf[4096];
+  while (count > 0)
+  {
+    ssize_t n = recv(fd, buf, sizeof(buf), 0);
+    if (n <= 0)
+      return -1;
+    for (ssize_t i = 0; i < n; i++)
+      count -= buf[i] == '\n';
+  }
+  return 0;
+}
+
+/*
+ * Писатель: rate_hz > 0 — по одной записи с заданным темпом, 0 — пачками
+ * по STREAM_BATCH без пауз. Возвращает число записей или -1.
+ */
+static long stream_write(int fd, double duration, int rate_hz)
+{
+  char batch[STREAM_BATCH * 32];
+  long writes = 0;
+  int64_t start = now_ns(), end = start + (int64_t)(duration * 1e9);
+  struct timespec next;
+  clock_gettime(CLOCK_MONOTONIC, &next);
+
+  while (now_ns() < end)
+  {
+    int count = rate_hz > 0 ? 1 : STREAM_BATCH;
+    size_t len = 0;
+    if (rate_hz > 0)
+    {
+      next.tv_nsec += 1000000000L / rate_hz;
+      if (next.tv_nsec >= 1000000000L)
+      {
+        next.tv_sec++;
+        next.tv_nsec -= 1000000000L;
+      }
+      clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+    }
+    for (int i = 0; i < count; i++)
+      len += (size_t)snprintf(batch + len, sizeof(batch) - len, "WRITE T%lld\n", (long long)now_ns());
+    if (send(fd, batch, len, MSG_NOSIGNAL) != (ssize_t)len || stream_acks(fd, count) == -1)
+      return -1;
+    writes += count;
+  }
+  return writes;
+}
+
+static int run_stream(int n_readers, int n_threads, double duration, int rate_hz)
+{
+  char resp[256];
+  stream_t streams[MAX_THREADS];
+  stream_conn_t *conns = calloc((size_t)n_readers, sizeof(*conns));
+  if (!conns)
+  {
+    perror("calloc");
+    return -1;
+  }
+
+  // Старые данные кольца дали бы читателям заведомо огромные задержки
+  int wfd = connect_one();
+  if (wfd == -1 || roundtrip(wfd, "SETPERM rw\n", resp, sizeof(resp)) == -1 ||
+      roundtrip(wfd, "CLEAR\n", resp, sizeof(resp)) == -1)
+  {
+    perror("connect — is resmgr -R running?");
+    free(conns);
+    return -1;
+  }
+
+  int connected = 0;
+  for (; connected < n_readers; connected++)
+  {
+    conns[connected].fd = connect_one();
+    if (conns[connected].fd == -1)
+    {
+      fprintf(stderr, "connect #%d: %s\n", connected, strerror(errno));
+      break;
+    }
+  }
+  if (n_threads > connected)
+    n_threads = connected > 0 ? connected : 1;
+  int per = connected / n_threads;
+  for (int i = 0; i < n_threads; i++)
+  {
+    memset(&streams[i], 0, sizeof(streams[i]));
+    streams[i].conns = conns + i * per;
+    streams[i].n_conns = (i == n_threads - 1) ? connected - i * per : per;
+    streams[i].lat_ns = malloc(STREAM_MAX_LAT * sizeof(int64_t));
+    if (!streams[i].lat_ns)
+    {
+      perror("malloc");
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  stop = 0;
+  for (int i = 0; i < n_threads; i++)
+    pthread_create(&streams[i].th, NULL, stream_thread, &streams[i]);
+  usleep(100000);   // читатели успевают встать в READ WAIT
+  double t0 = now_s();
+  long writes = stream_write(wfd, duration, rate_hz);
+  double elapsed = now_s() - t0;
+  usleep(200000);   // дочитываем хвост
+  stop = 1;
+
+  long lines = 0, errors = writes < 0;
+  unsigned long long lost = 0;
+  size_t n_lat = 0;
+  for (int i = 0; i < n_threads; i++)
+  {
+    pthread_join(streams[i].th, NULL);
+    lines += streams[i].lines;
+    lost += streams[i].lost;
+    errors += streams[i].errors;
+    n_lat += streams[i].n_lat;
+  }
+  int64_t *all = malloc((n_lat ? n_lat : 1) * sizeof(int64_t));
+  size_t k = 0;
+  for (int i = 0; i < n_threads; i++)
+  {
+    if (all)
+      memcpy(all + k, streams[i].lat_ns, streams[i].n_lat * sizeof(int64_t));
+    k += streams[i].n_lat;
+    free(streams[i].lat_ns);
+  }
+  for (int i = 0; i < connected; i++)
+  {
+    close(conns[i].fd);
+    free(conns[i].buf);
+  }
+  close(wfd);
+  free(conns);
+
+  double p50 = 0, p99 = 0, max = 0;
+  if (all && n_lat > 0)
+  {
+    qsort(all, n_lat, sizeof(int64_t), compare_i64);
+    p50 = all[n_lat / 2] / 1000.0;
+    p99 = all[(n_lat * 99) / 100] / 1000.0;
+    max = all[n_lat - 1] / 1000.0;
+  }
+  printf("%7d %8s %10.0f %12.0f %9.1f %9.1f %9.1f %10llu", connected, rate_hz > 0 ? "1 kHz" : "max",
+         writes / elapsed, lines / elapsed, p50, p99, max, lost);
+  if (errors)
+    printf("  errors=%ld", errors);
+  printf("\n");
+  free(all);
+  sleep(1);
+  return 0;
+}
+
+// utime + stime процесса, мс
+static double proc_cpu_ms(pid_t pid)
+{
+  char path[64];
+  unsigned long utime = 0, stime = 0;
+  snprintf(path, sizeof(path), "/proc/%d/stat", (int)pid);
+  FILE *f = fopen(path, "r");
+  if (!f)
+    return 0;
+  // Поля 14 и 15; имя процесса в скобках без пробелов
+  if (fscanf(f, "%*d %*s %*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu", &utime, &stime) != 2)
+    utime = stime = 0;
+  fclose(f);
+  return (utime + stime) * 1000.0 / sysconf(_SC_CLK_TCK);
+}
+
+// Заполняет /dev0 ровно до size байт
+static int fill_to(int fd, size_t size)
+{
+  char line[1024], resp[256];
+  size_t have = 0;
+
+  if (roundtrip(fd, "SETPERM rw\n", resp, sizeof(resp)) == -1 ||
+      roundtrip(fd, "CLEAR\n", resp, sizeof(resp)) == -1)
+    return -1;
+  while (have < size)
+  {
+    // Последний байт каждой записи — '\n' из самой команды
+    size_t chunk = size - have < 900 ? size - have : 900;
+    memcpy(line, "WRITE ", 6);
+    memset(line + 6, 'x', chunk - 1);
+    line[6 + chunk - 1] = '\n';
+    line[6 + chunk] = '\0';
+    size_t written;
+    if (roundtrip(fd, line, resp, sizeof(resp)) == -1 || sscanf(resp, "OK, %zu", &written) != 1)
+      return -1;
+    if (written == 0)
+    {
+      fprintf(stderr, "device is full at %zu bytes — start resmgr with -S\n", have);
+      return -1;
+    }
+    have += written;
+  }
+  return 0;
+}
+
+// Принимает "FD <size>\n" и приложенный дескриптор; -1 — ошибка
+static int recv_fd(int fd, size_t *size)
+{
+  char hdr[64];
+  union
+  {
+    struct cmsghdr h;
+    char buf[CMSG_SPACE(sizeof(int))];
+  } ctl;
+  struct iovec iov = {.iov_base = hdr, .iov_len = sizeof(hdr) - 1};
+  struct msghdr msg = {.msg_iov = &iov, .msg_iovlen = 1, .msg_control = ctl.buf, .msg_controllen = sizeof(ctl.buf)};
+  ssize_t n = recvmsg(fd, &msg, MSG_CMSG_CLOEXEC);
+  if (n <= 0)
+    return -1;
+  hdr[n] = '\0';
+  struct cmsghdr *cm = CMSG_FIRSTHDR(&msg);
+  if (sscanf(hdr, "FD %zu", size) != 1 || !cm || cm->cmsg_type != SCM_RIGHTS)
+    return -1;
+  int got;
+  memcpy(&got, CMSG_DATA(cm), sizeof(int));
+  return got;
+}
+
+static int run_size(size_t size, int use_fd, double duration)
+{
+  char *buf = malloc(size);
+  int fd = connect_one();
+  if (!buf || fd == -1)
+  {
+    perror("connect — is resmgr running?");
+    free(buf);
+    return -1;
+  }
+  struct ucred cred;
+  socklen_t cred_len = sizeof(cred);
+  if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &cred_len) == -1)
+    cred.pid = 0;
+  if (fill_to(fd, size) == -1)
+  {
+    close(fd);
+    free(buf);
+    return -1;
+  }
+
+  long reads = 0;
+  int failed = 0;
+  double cpu0 = proc_cpu_ms(cred.pid);
+  double t0 = now_s(), elapsed;
+  while (!failed && (elapsed = now_s() - t0) < duration)
+  {
+    if (use_fd)
+    {
+      size_t fsize;
+      int mfd = send(fd, "READFD\n", 7, MSG_NOSIGNAL) == 7 ? recv_fd(fd, &fsize) : -1;
+      size_t got = 0;
+      while (mfd != -1 && got < fsize)
+      {
+        ssize_t n = pread(mfd, buf + got, fsize - got, (off_t)got);
+        if (n <= 0)
+          break;
+        got += (size_t)n;
+      }
+      if (mfd != -1)
+        close(mfd);
+      failed = mfd == -1 || got != size;
+    }
+    else
+    {
+      size_t got = 0;
+      failed = send(fd, read_cmd, sizeof(read_cmd) - 1, MSG_NOSIGNAL) != sizeof(read_cmd) - 1;
+      while (!failed && got < size)
+      {
+        ssize_t n = recv(fd, buf + got, size - got, 0);
+        failed = n <= 0;
+        got += n > 0 ? (size_t)n : 0;
+      }
+    }
+    reads += !failed;
+  }
+  double cpu = proc_cpu_ms(cred.pid) - cpu0;
+  double gib = (double)reads * size / (1 << 30);
+  close(fd);
+  free(buf);
+
+  printf("%9zu %7s %10.0f %10.1f %14.0f%s\n", size / 1024, use_fd ? "READFD" : "READ", reads / elapsed,
+         reads * (double)size / (1 << 20) / elapsed, gib > 0 ? cpu / gib : 0.0, failed ? "  failed" : "");
+  return failed ? -1 : 0;
+}
+
+static int run(int n_conns, int n_threads, double duration)
+{
+  int *fds = malloc((size_t)n_conns * sizeof(int));
+  load_t loads[MAX_THREADS];
+  if (!fds)
+  {
+    perror("malloc");
+    return -1;
+  }
+
+  int probe = connect_one();
+  if (probe == -1)
+  {
+    perror("connect — is resmgr running?");
+    free(fds);
+    return -1;
+  }
+  struct ucred cred;
+  socklen_t cred_len = sizeof(cred);
+  if (getsockopt(probe, SOL_SOCKET, SO_PEERCRED, &cred, &cred_len) == -1)
+    cred.pid = 0;
+  int prefill_failed = 0;
+  if (read_pct >= 0 && target_devs == 0)
+    prefill_failed = prefill(probe, "") == -1;
+  for (int i = 0; read_pct >= 0 && i < target_devs && !prefill_failed; i++)
+  {
+    char prefix[32];
+    snprintf(prefix, sizeof(prefix), "/dev%d ", i);
+    prefill_failed = prefill(probe, prefix) == -1;
+  }
+  if (prefill_failed)
+  {
+    fprintf(stderr, "prefill failed\n");
+    close(probe);
+    free(fds);
+    return -1;
+  }
+  close(probe);
+  usleep(100000);   // даём серверу закрыть пробное соединение
+
+  long rss0, threads0, rss1, threads1;
+  proc_status(cred.pid, &rss0, &threads0);
+
+  // Медленный читатель: ответов больше, чем влезает в буфер сокета
+  int slow = -1;
+  if (opt_slow_reader)
+  {
+    slow = connect_one();
+    fcntl(slow, F_SETFL, O_NONBLOCK);
+    for (int i = 0; i < 256; i++)
+      send(slow, read_cmd, sizeof(read_cmd) - 1, MSG_NOSIGNAL);
+  }
+
+  int connected = 0;
+  for (; connected < n_conns; connected++)
+  {
+    fds[connected] = connect_one();
+    if (fds[connected] == -1)
+    {
+      fprintf(stderr, "connect #%d: %s\n", connected, strerror(errno));
+      break;
+    }
+  }
+
+  if (n_threads > connected)
+    n_threads = connected > 0 ? connected : 1;
+  int per = connected / n_threads;
+  for (int i = 0; i < n_threads; i++)
+  {
+    loads[i].fds = fds + i * per;
+    loads[i].n_fds = (i == n_threads - 1) ? connected - i * per : per;
+    loads[i].first = i * per;
+    loads[i].done = loads[i].errors = 0;
+  }
+
+  stop = 0;
+  double t0 = now_s();
+  for (int i = 0; i < n_threads; i++)
+    pthread_create(&loads[i].th, NULL, load_thread, &loads[i]);
+  usleep((useconds_t)(duration * 1e6 / 2));
+  proc_status(cred.pid, &rss1, &threads1);   // в середине прогона, все соединения активны
+  usleep((useconds_t)(duration * 1e6 / 2));
+  stop = 1;
+  long done = 0, errors = 0;
+  for (int i = 0; i < n_threads; i++)
+  {
+    pthread_join(loads[i].th, NULL);
+    done += loads[i].done;
+    errors += loads[i].errors;
+  }
+  double elapsed = now_s() - t0;
+
+  for (int i = 0; i < connected; i++)
+    close(fds[i]);
+  if (slow != -1)
+    close(slow);
+  free(fds);
+
+  if (opt_devs > 0)
+    printf("%5d ", target_devs);
+  printf("%7d %10.0f %9ld %9ld %10.2f %8ld", connected, done / elapsed, rss0, rss1,
+         connected > 0 ? (rss1 - rss0) / (double)connected : 0.0, threads1);
+  if (errors)
+    printf("  errors=%ld", errors);
+  printf("\n");
+
+  sleep(1);         // сервер разбирает закрытия, прежде чем начнётся следующий прогон
+  return 0;
+}
+
+int main(int argc, char *argv[])
+{
+  int n_conns = 0;
+  int n_threads = 2;
+  double duration = 2.0;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "c:j:d:m:r:sw:D:z")) != -1)
+  {
+    switch (opt)
+    {
+    case 'c':
+      n_conns = atoi(optarg);
+      break;
+    case 'j':
+      n_threads = atoi(optarg);
+      break;
+    case 'd':
+      duration = atof(optarg);
+      break;
+    case 'm':
+      snprintf(command, sizeof(command) - 1, "%s", optarg);
+      command_len = strlen(command);
+      if (command_len == 0 || command[command_len - 1] != '\n')
+        command[command_len++] = '\n';
+      break;
+    case 'r':
+      read_pct = atoi(optarg);
+      break;
+    case 's':
+      opt_slow_reader = 1;
+      break;
+    case 'w':
+      opt_stream = atoi(optarg);
+      break;
+    case 'D':
+      opt_devs = atoi(optarg);
+      break;
+    case 'z':
+      opt_sizes = 1;
+      break;
+    default:
+      fprintf(stderr, "usage: %s [-c conns] [-j threads] [-d seconds] [-m command] [-r read_pct] [-s] [-w readers] [-D devices] [-z]\n", argv[0]);
+      return EXIT_FAILURE;
+    }
+  }
+  if (n_conns < 0 || n_threads < 1 || n_threads > MAX_THREADS || duration <= 0 || read_pct > 100 || opt_devs < 0)
+  {
+    fprintf(stderr, "bad arguments (threads 1..%d)\n", MAX_THREADS);
+    return EXIT_FAILURE;
+  }
+
+  raise_nofile_limit();
+  if (opt_sizes)
+  {
+    static const size_t sizes[] = {4 << 10, 64 << 10, 1 << 20, 16 << 20};
+    printf("large READ, %.1f s per run\n", duration);
+    printf("%9s %7s %10s %10s %14s\n", "size_kb", "cmd", "reads/s", "MiB/s", "srv_cpu_ms/GiB");
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+      if (run_size(sizes[i], 0, duration) != 0 || run_size(sizes[i], 1, duration) != 0)
+        return EXIT_FAILURE;
+    return EXIT_SUCCESS;
+  }
+  if (opt_stream > 0)
+  {
+    printf("stream: %d readers on %d threads, %.1f s per run\n", opt_stream, n_threads, duration);
+    printf("%7s %8s %10s %12s %9s %9s %9s %10s\n", "readers", "writer", "writes/s", "lines/s", "p50_us",
+           "p99_us", "max_us", "lost_B");
+    if (run_stream(opt_stream, n_threads, duration, 1000) != 0 ||
+        run_stream(opt_stream, n_threads, duration, 0) != 0)
+      return EXIT_FAILURE;
+    return EXIT_SUCCESS;
+  }
+  if (read_pct >= 0)
+    printf("mix: %d%% READ, %d%% SETPERM rw, %.1f s per run\n", read_pct, 100 - read_pct, duration);
+  else
+    printf("command: %.*s, load threads: %d, %.1f s per run\n", (int)command_len - 1, command, n_threads, duration);
+  if (opt_devs > 0)
+    printf("%5s ", "devs");
+  printf("%7s %10s %9s %9s %10s %8s\n", "conns", "req/s", "rss0_kb", "rss_kb", "kb/conn", "threads");
+  target_devs = opt_devs;
+  if (n_conns > 0)
+    return run(n_conns, n_threads, duration) == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+
+  if (opt_devs > 0)
+  {
+    // Одно общее устройство против своего у каждого клиентского потока
+    for (int n = 1; n <= 8; n *= 2)
+    {
+      target_devs = 1;
+      if (run(n, n, duration) != 0)
+        return EXIT_FAILURE;
+      target_devs = n < opt_devs ? n : opt_devs;
+      if (n > 1 && run(n, n, duration) != 0)
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+  }
+
+  if (read_pct >= 0)
+  {
+    // Масштабирование по читателям: по одному соединению на клиентский поток
+    for (int n = 1; n <= 8; n *= 2)
+      if (run(n, n, duration) != 0)
+        return EXIT_FAILURE;
+    return EXIT_SUCCESS;
+  }
+
+  static const int conns[] = {10, 1000, 10000};
+  for (size_t i = 0; i < sizeof(conns) / sizeof(conns[0]); i++)
+    if (run(conns[i], n_threads, duration) != 0)
+      return EXIT_FAILURE;
+  return EXIT_SUCCESS;
+}
+
+/*
+ *  Результаты (1 CPU, INFO, 2 нагрузочных потока, 2 с на прогон):
+ *
+ *                        conns    req/s   RSS сервера, КиБ   КиБ/conn  потоков
+ *  resmgr -T (поток на     10    211951        1844           12.4        11
+ *  клиента, как раньше)  1000    115775       15056           13.3      1001
+ *                       10000     64854      129160           12.6      9560
+ *  resmgr -t 2 (epoll)     10    189870        1608            2.0         3
+ *                        1000    278206        2660            1.05        3
+ *                       10000    171441       12224            1.04        3
+ *
+ *  - Поток на клиента стоит ~12 КиБ резидентной памяти (стек, TLS, структуры
+ *    ядра) плюс 8 МиБ виртуального адресного пространства; при 10000
+ *    клиентах это 126 МиБ RSS и ~80 ГиБ виртуальной памяти, и часть потоков
+ *    может просто не создаться.
+ *  - С ростом числа потоков пропускная способность падает вдвое-втрое:
+ *    планировщик переключает тысячи потоков, каждому достаётся по одной
+ *    команде за квант. Пул epoll обрабатывает десятки готовых соединений за
+ *    одно пробуждение.
+ *  - Контекст соединения в epoll-модели — ~1 КиБ (входной буфер); хвост ответа
+ *    выделяется, только если сокет клиента полон.
+ *  - На 10 клиентах поток на клиента чуть быстрее: нет epoll_wait, а потоков
+ *    меньше, чем готовых к работе запросов.
+ */
+
+/*
+ *  Смесь 95% READ (4 КиБ) / 5% SETPERM rw, req/s по числу клиентских потоков
+ *  (-r 95 -d 1; слева — мьютекс на всё устройство, справа — снимки + rwlock):
+ *
+ *                              1       2       4       8
+ *  -t 8, мьютекс          161585  151328  210594  195207
+ *  -t 8, снимки           154586  170765  169311  198246
+ *  -T,   мьютекс, -s           0       0       0       0
+ *  -T,   снимки,  -s      147876  169387  140015  131813
+ *
+ *  - Машина однопроцессорная, поэтому параллельного выигрыша от rdlock здесь
+ *    не видно: числа в пределах шума. На многоядерной машине READ под
+ *    мьютексом выполняются строго по одному (копирование 4 КиБ в сокет под
+ *    блокировкой), а со снимками — параллельно; под rdlock остаётся только
+ *    взять ссылку.
+ *  - Главное видно в строке -s: при потоке на клиента старый READ держал
+ *    мьютекс во время блокирующей отправки, и один клиент, не читающий
+ *    ответы, останавливал всех. Теперь блокировка отпускается до send.
+ */
+
+/*
+ *  Потоковый режим, resmgr -R 65536, задержка записи до доставки читателю
+ *  (-w R -d 2; "1 kHz" — писатель с темпом, "max" — без пауз пачками по 32):
+ *
+ *                        читателей  писатель  writes/s    lines/s   p50_us   p99_us
+ *  -t 2, eventfd                 1     1 kHz      1000       1000     53.7     99.9
+ *                                1       max    459295     459295     72.8    197.2
+ *                               16     1 kHz      1000      15999    113.6    240.5
+ *                               16       max    172390    2758237    208.8    550.7
+ *                              256     1 kHz      1000     255874   1314.1   3252.6
+ *                              256       max     13337    3414197   3747.2   7376.3
+ *  -T, condvar                   1     1 kHz      1000       1000     35.5     80.1
+ *                               16     1 kHz      1000      15998    176.9    389.1
+ *                              256     1 kHz      1000     255987   4072.6  14424.0
+ *                              256       max    178879   30634145 141118.4 190600.9
+ *
+ *  - Читатели больше не опрашивают устройство: между записями сервер не
+ *    получает от них ни одной команды, а строка доходит за десятки
+ *    микросекунд после WRITE.
+ *  - Одиночный читатель в -T отвечает чуть быстрее (поток просыпается прямо
+ *    на condvar, без eventfd и epoll), но broadcast будит все 256 потоков
+ *    сразу, и хвост задержки растёт в 4-5 раз. В -T без темпа писатель
+ *    обгоняет читателей: они отстают больше чем на ёмкость кольца (lost 454
+ *    МБ за 2 с) и отдают то, что осталось, огромными кусками.
+ *  - В epoll-модели один рабочий поток отвечает сотне припаркованных
+ *    соединений за проход, и писатель естественно притормаживается: потери
+ *    появляются, только если кольцо маленькое (-R 1024, 16 читателей, без
+ *    темпа — 124 КБ потерянных за 2 с).
+ */
+
+/*
+ *  Одно общее устройство против своего у каждого клиента (resmgr -t 8 -D 8,
+ *  по одному соединению на клиентский поток, -d 1), req/s:
+ *
+ *                                      1       2       4       8
+ *  SETPERM rw, все на /dev0       130183  133915  119215  157206
+ *  SETPERM rw, каждый на своём         —  158064  128782  137096
+ *  50% READ / 50% SETPERM, общее  139174  151030  150832  140234
+ *  50% READ / 50% SETPERM, свои        —  145709  114808  178864
+ *
+ *  - На единственном процессоре песочницы рабочие потоки и так выполняются
+ *    по одному, поэтому разница в пределах шума: сериализовать нечего.
+ *  - На многоядерной машине SETPERM на одном устройстве выстраивает всех в
+ *    очередь на wrlock, и к тому же строка кэша с rwlock мечется между
+ *    ядрами на каждом запросе. С раздельными устройствами у каждого потока
+ *    своя блокировка и свои данные — общего между ними только хеш-таблица
+ *    имён, которую никто не меняет.
+ */
+
+/*
+ *  Большие READ (resmgr -S 16M, одно соединение, -z -d 2):
+ *
+ *   размер     send() из буфера (-C)      sendfile из memfd       READFD + pread
+ *              МиБ/с  мс CPU сервера/ГиБ  МиБ/с  мс CPU/ГиБ       МиБ/с  мс CPU/ГиБ
+ *    4 КиБ       560        923             655*      789*           333      1692
+ *   64 КиБ      4404        112            6176        80           3792       127
+ *    1 МиБ      4702        108            5377        68           9865        12
+ *   16 МиБ      3759        144            5365        56           7869         2
+ *
+ *   * ниже SENDFILE_MIN (64 КиБ) сервер и без -C отвечает обычным send():
+ *     в первом прогоне sendfile на 4 КиБ дал 427 МиБ/с против 581 у send().
+ *
+ *  - sendfile убирает копию из памяти сервера в сокет: процессорное время
+ *    сервера на гигабайт падает в 1.5-2.5 раза, и на больших устройствах
+ *    READ быстрее на 15-40%. Вторая копия — из сокета в буфер клиента —
+ *    остаётся.
+ *  - READFD убирает сервер из пути данных совсем: на гигабайт он тратит
+ *    единицы миллисекунд (открыть /proc/self/fd и sendmsg), а клиент читает
+ *    memfd одним pread. На мелких размерах это проигрыш — лишние open,
+ *    recvmsg и close на каждый запрос дороже, чем 4 КиБ данных.
+ */
@@ -1,24 +1,50 @@
+/*
+ * Клиент resmgr
+ *
+ *   ./bin/resmgr_client "INFO"               # одна команда, печать ответа
+ *   ./bin/resmgr_client -b "WRITE hello"     # то же двоичным кадром
+ *   ./bin/resmgr_client -n 100000 "INFO"     # конвейер глубиной 1, 8, 64
+ *   ./bin/resmgr_client -b -n 100000 -d 16 -D 3 "INFO"
+ *
+ * С -n команда повторяется N раз, и в полёте держится до depth запросов;
+ * печатаются команды в секунду. В текстовом режиме ответы считаются по '\n',
+ * поэтому для замера годятся команды с однострочным ответом (INFO, WRITE).
+ * В двоичном режиме READ, WRITE, INFO и CLEAR уходят своими кодами операций,
+ * остальное — как RM_OP_CMD с текстом команды.
+ *
+ * Запуск: ./bin/resmgr_client [-b] [-D устройство] [-n повторов] [-d глубина] <команда>
+ */
 #include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/socket.h>
 #include <sys/un.h>
+#include <time.h>
 #include <unistd.h>
 
+#include "resmgr_proto.h"
+
 #define EXAMPLE_SOCK_PATH "/tmp/example_resmgr.sock"
 
-int main(int argc, char *argv[])
+static int opt_binary;
+static int opt_dev = -1;
+
+static int64_t now_ns(void)
 {
-  if (argc < 2) {
-    fprintf(stderr, "usage: %s <message>\n", argv[0]);
-    return EXIT_FAILURE;
-  }
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
 
+static int connect_server(void)
+{
   int fd = socket(AF_UNIX, SOCK_STREAM, 0);
   if (fd == -1) {
     perror("socket");
-    return EXIT_FAILURE;
+    return -1;
   }
 
   struct sockaddr_un addr;
@@ -29,27 +55,289 @@ int main(int argc, char *argv[])
   if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
     perror("connect");
     close(fd);
-    return EXIT_FAILURE;
+    return -1;
   }
+  return fd;
+}
 
-  const char *msg = argv[1];
-  size_t len = strlen(msg);
-  if (send(fd, msg, len, 0) != (ssize_t)len) {
-    perror("send");
-    close(fd);
-    return EXIT_FAILURE;
+/*
+ * Собирает запрос в req. Текст: "[/devN ]команда\n" — сервер разбирает
+ * команды по строкам, без '\n' команда не завершена. Кадр: заголовок и
+ * нагрузка; req_id заполняется при отправке.
+ */
+static size_t build_request(char *req, size_t cap, const char *cmd)
+{
+  char text[RM_MAX_PAYLOAD + 1];
+  size_t len = 0;
+
+  if (opt_dev >= 0)
+    len = (size_t)snprintf(text, sizeof(text), "/dev%d ", opt_dev);
+  size_t clen = strlen(cmd);
+  if (clen > 0 && cmd[clen - 1] == '\n')
+    clen--;
+  if (clen > sizeof(text) - 1 - len)
+    clen = sizeof(text) - 1 - len;
+  memcpy(text + len, cmd, clen);
+  len += clen;
+
+  if (!opt_binary) {
+    if (len > cap - 1)
+      len = cap - 1;
+    memcpy(req, text, len);
+    req[len++] = '\n';
+    return len;
   }
 
-  char buf[1024];
-  ssize_t n = recv(fd, buf, sizeof(buf) - 1, 0);
+  rm_hdr_t h = { .magic = RM_MAGIC, .op = RM_OP_CMD, .dev = opt_dev >= 0 ? (uint32_t)opt_dev : 0 };
+  const char *payload = text;
+  size_t plen = len;
+  if (strncmp(cmd, "WRITE ", 6) == 0) {
+    h.op = RM_OP_WRITE;
+    payload = cmd + 6;
+    plen = clen - 6;
+  } else if (strncmp(cmd, "READ", clen) == 0 && clen == 4) {
+    h.op = RM_OP_READ;
+  } else if (strncmp(cmd, "INFO", clen) == 0 && clen == 4) {
+    h.op = RM_OP_INFO;
+  } else if (strncmp(cmd, "CLEAR", clen) == 0 && clen == 5) {
+    h.op = RM_OP_CLEAR;
+  }
+  if (h.op != RM_OP_CMD && h.op != RM_OP_WRITE)
+    plen = 0;
+  if (plen > RM_MAX_PAYLOAD)
+    plen = RM_MAX_PAYLOAD;
+  if (plen > cap - sizeof(h))
+    plen = cap - sizeof(h);
+  h.len = (uint32_t)plen;
+  memcpy(req, &h, sizeof(h));
+  memcpy(req + sizeof(h), payload, plen);
+  return sizeof(h) + plen;
+}
+
+static int send_all(int fd, const char *buf, size_t len)
+{
+  while (len > 0) {
+    ssize_t n = send(fd, buf, len, 0);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0) {
+      perror("send");
+      return -1;
+    }
+    buf += n;
+    len -= (size_t)n;
+  }
+  return 0;
+}
+
+/*
+ * Приёмный буфер. Ответ READ может быть размером с устройство, поэтому
+ * буфер растёт до полного кадра.
+ */
+static char *rbuf;
+static size_t rbuf_len, rbuf_cap;
+
+static int recv_more(int fd)
+{
+  if (rbuf_cap - rbuf_len < 4096) {
+    size_t cap = rbuf_cap ? rbuf_cap * 2 : 64 * 1024;
+    char *nb = realloc(rbuf, cap);
+    if (!nb) {
+      perror("realloc");
+      return -1;
+    }
+    rbuf = nb;
+    rbuf_cap = cap;
+  }
+  ssize_t n;
+  do
+    n = recv(fd, rbuf + rbuf_len, rbuf_cap - rbuf_len, 0);
+  while (n < 0 && errno == EINTR);
   if (n < 0) {
     perror("recv");
-    close(fd);
+    return -1;
+  }
+  if (n == 0) {
+    fprintf(stderr, "server closed connection\n");
+    return -1;
+  }
+  rbuf_len += (size_t)n;
+  return 0;
+}
+
+// Забирает из rbuf полные ответы; возвращает их число
+static int take_responses(int *errors)
+{
+  size_t off = 0;
+  int n = 0;
+
+  if (!opt_binary) {
+    for (size_t i = 0; i < rbuf_len; i++)
+      if (rbuf[i] == '\n')
+        n++;
+    rbuf_len = 0;
+    return n;
+  }
+  while (rbuf_len - off >= sizeof(rm_hdr_t)) {
+    rm_hdr_t h;
+    memcpy(&h, rbuf + off, sizeof(h));
+    if (rbuf_len - off < sizeof(h) + h.len)
+      break;
+    if (h.status != RM_OK)
+      (*errors)++;
+    off += sizeof(h) + h.len;
+    n++;
+  }
+  memmove(rbuf, rbuf + off, rbuf_len - off);
+  rbuf_len -= off;
+  return n;
+}
+
+static int run_once(int fd, const char *req, size_t rlen)
+{
+  if (send_all(fd, req, rlen) == -1)
+    return -1;
+
+  if (!opt_binary) {
+    if (recv_more(fd) == -1)
+      return -1;
+    printf("response: %.*s\n", (int)rbuf_len, rbuf);
+    return 0;
+  }
+  rm_hdr_t h;
+  do {
+    if (recv_more(fd) == -1)
+      return -1;
+    if (rbuf_len >= sizeof(h))
+      memcpy(&h, rbuf, sizeof(h));
+  } while (rbuf_len < sizeof(h) || rbuf_len < sizeof(h) + h.len);
+  printf("response (status %u, %u bytes): %.*s\n", h.status, h.len, (int)h.len, rbuf + sizeof(h));
+  return 0;
+}
+
+// Конвейер: до depth запросов в полёте, новые досылаются по мере ответов
+static int run_pipeline(int fd, const char *req, size_t rlen, long n, int depth)
+{
+  char *out = malloc((size_t)depth * rlen);
+  long sent = 0, done = 0;
+  int errors = 0;
+  if (!out) {
+    perror("malloc");
+    return -1;
+  }
+
+  int64_t t0 = now_ns();
+  while (done < n) {
+    size_t olen = 0;
+    for (; sent < n && sent - done < depth; sent++) {
+      memcpy(out + olen, req, rlen);
+      if (opt_binary) {
+        uint32_t id = (uint32_t)sent;
+        memcpy(out + olen + offsetof(rm_hdr_t, req_id), &id, sizeof(id));
+      }
+      olen += rlen;
+    }
+    if (olen > 0 && send_all(fd, out, olen) == -1)
+      break;
+    if (recv_more(fd) == -1)
+      break;
+    done += take_responses(&errors);
+  }
+  double elapsed = (now_ns() - t0) / 1e9;
+  free(out);
+
+  printf("%6d %12.0f", depth, done / elapsed);
+  if (errors)
+    printf("  errors=%d", errors);
+  printf("\n");
+  return done == n ? 0 : -1;
+}
+
+int main(int argc, char *argv[])
+{
+  long repeat = 0;
+  int depth = 0;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "bD:n:d:")) != -1) {
+    switch (opt) {
+    case 'b': opt_binary = 1; break;
+    case 'D': opt_dev = atoi(optarg); break;
+    case 'n': repeat = atol(optarg); break;
+    case 'd': depth = atoi(optarg); break;
+    default:
+      fprintf(stderr, "usage: %s [-b] [-D dev] [-n repeat] [-d depth] <message>\n", argv[0]);
+      return EXIT_FAILURE;
+    }
+  }
+  if (optind >= argc || depth < 0 || repeat < 0) {
+    fprintf(stderr, "usage: %s [-b] [-D dev] [-n repeat] [-d depth] <message>\n", argv[0]);
     return EXIT_FAILURE;
   }
-  buf[n] = '\0';
-  printf("response: %s\n", buf);
 
+  char req[sizeof(rm_hdr_t) + RM_MAX_PAYLOAD + 1];
+  size_t rlen = build_request(req, sizeof(req), argv[optind]);
+
+  int fd = connect_server();
+  if (fd == -1)
+    return EXIT_FAILURE;
+
+  int rc = 0;
+  if (repeat == 0) {
+    rc = run_once(fd, req, rlen);
+  } else {
+    printf("%s protocol, %ld commands per run\n", opt_binary ? "binary" : "text", repeat);
+    printf("%6s %12s\n", "depth", "cmds/s");
+    if (depth > 0) {
+      rc = run_pipeline(fd, req, rlen, repeat, depth);
+    } else {
+      static const int depths[] = { 1, 8, 64 };
+      for (size_t i = 0; i < sizeof(depths) / sizeof(depths[0]) && rc == 0; i++)
+        rc = run_pipeline(fd, req, rlen, repeat, depths[i]);
+    }
+  }
+
+  free(rbuf);
   close(fd);
-  return EXIT_SUCCESS;
+  return rc == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
 }
+
+/*
+ * Результаты (1 CPU, resmgr с 4 воркерами, одно соединение, 200000 команд):
+ *
+ *   команда            протокол   глубина 1   глубина 8   глубина 64
+ *   INFO               текст         117275      628805      2031203
+ *   INFO               кадры         113063      628392      2164264
+ *   INFO (-T)          кадры         122165      888538      2476007
+ *   WRITE 32 B (-R)    текст         143439      903416      2499686
+ *   WRITE 32 B (-R)    кадры         120707      861289      2116192
+ *
+ *  - При глубине 1 каждая команда — это recv и send на сервере и два
+ *    переключения контекста; конвейер глубиной 64 даёт в 15–20 раз больше
+ *    команд в секунду: сервер за один проход разбирает все пришедшие
+ *    команды и отвечает одним writev.
+ *  - Текст и кадры идут вровень (разброс между прогонами 20–30%): разбор
+ *    строки дешевле системного вызова. Кадры нужны не для скорости, а ради
+ *    req_id и WRITE произвольных байт.
+ */
+
+/*
+ *  Цена статистики (STATS): CPU сервера на команду INFO, -n 2000000,
+ *  медиана 7 прогонов; CPU сервера — utime + stime из /proc/<pid>/stat.
+ *
+ *   сервер                            глубина 64    глубина 1
+ *   без статистики                       265 нс       3675 нс
+ *   счётчики, латентность 1 из 8         310 нс       4155 нс
+ *   счётчики, латентность каждой (-L 1)  330 нс       3800 нс
+ *
+ *  - Разброс между прогонами на одном CPU — ±50 нс при глубине 64 и
+ *    ±500 нс при глубине 1, так что надёжно видна только разница на
+ *    конвейере: около 40 нс, 15% самой дешёвой команды.
+ *  - Почти вся цена — часы. Первый вариант читал clock_gettime до и после
+ *    каждой команды и добавлял больше 100 нс; поэтому латентность теперь
+ *    меряется выборочно, а счётчики (load + store в строке своего потока)
+ *    в шум не выходят.
+ *  - Ожидание блокировок на одном CPU почти всегда 0: поток с блокировкой
+ *    вытесняют редко. Часы при этом читаются только после неудачного
+ *    trylock, так что незанятая блокировка учёта не замечает.
+ */
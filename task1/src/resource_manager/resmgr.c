@@ -1,19 +1,84 @@
 /*
  *  Менеджер ресурсов с буфером, командами и правами доступа
+ *
+ *  Событийная модель: небольшой фиксированный пул рабочих потоков (-t N),
+ *  у каждого свой epoll. Слушающий сокет добавлен во все epoll с
+ *  EPOLLEXCLUSIVE — новое подключение будит один поток, и дальше
+ *  соединение живёт в epoll этого потока до закрытия. Все сокеты
+ *  неблокирующие, поэтому один медленный клиент не держит поток.
+ *
+ *  Для каждого соединения есть контекст (OCB, см. README): входной буфер,
+ *  в котором команды собираются до '\n' (recv может вернуть полкоманды или
+ *  несколько команд сразу), и хвост ответа, который не влез в сокет. Пока
+ *  хвост не отправлен, новые команды этого клиента не разбираются.
+ *
+ *  Кроме строк соединение принимает двоичные кадры (resmgr_proto.h): длина,
+ *  req_id и код операции в заголовке, так что запросов в полёте может быть
+ *  много, а WRITE не зависит от '\n' в данных. Ответы за один проход по
+ *  входному буферу — и строковые, и кадры — собираются в пакет и уходят
+ *  одним writev.
+ *
+ *  -T — прежняя модель "поток на клиента" (для сравнения в resmgr_bench).
+ *
+ *  -D N — N устройств /dev0 ... /dev<N-1>, у каждого свои блокировки и
+ *  буфер. Устройство выбирается префиксом команды: "/dev3 WRITE abc";
+ *  команда без префикса идёт в /dev0. Имена ищутся в хеш-таблице, которая
+ *  строится при запуске и дальше только читается, поэтому своей блокировки
+ *  у неё нет. Клиенты разных устройств друг с другом не конкурируют.
+ *
+ *  Содержимое устройства хранится в memfd; READ отдаёт его через sendfile,
+ *  без копирования через память сервера (-C — прежний send() из буфера, для
+ *  сравнения), а READFD передаёт клиенту сам дескриптор через SCM_RIGHTS.
+ *  -S N — ёмкость устройства в байтах (суффиксы K и M), по умолчанию 4 КиБ.
+ *
+ *  -R N — кольцевое устройство на N байт: WRITE дописывает в кольцо,
+ *  затирая самые старые данные, а у каждого клиента свой курсор чтения.
+ *  READ отдаёт то, что записано после курсора. READ WAIT [мс] — длинный
+ *  опрос: ответ приходит, как только появились новые данные (или по
+ *  таймауту), в виде "DATA <n>\n" + n байт. Ждущее соединение паркуется в
+ *  своём потоке, писатель будит потоки через eventfd; в режиме -T клиентский
+ *  поток ждёт на условной переменной.
+ *
+ *  Статистика: каждый поток считает команды, латентность, байты,
+ *  соединения и ожидание блокировок в своих счётчиках без атомарных
+ *  операций; складываются они только по команде STATS (и раз в -P N секунд
+ *  в stdout).
  */
 
+#define _GNU_SOURCE
 #include <errno.h>
+#include <fcntl.h>
 #include <pthread.h>
 #include <signal.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/sendfile.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <sys/un.h>
+#include <time.h>
 #include <unistd.h>
 
+#include "resmgr_proto.h"
+
 #define EXAMPLE_SOCK_PATH "/tmp/example_resmgr.sock"
 #define DEVICE_BUF_SIZE 4096
+#define CONN_INBUF 1024
+#define SENDFILE_MIN (64 * 1024)        // меньшие READ дешевле отдать обычным send()
+#define MAX_WORKERS 64
+#define MAX_EVENTS 64
+#define MAX_DEVICES 4096
+#define BATCH_MAX_BYTES (64 * 1024)     // пакет ответов отправляется, не дожидаясь конца прохода
+#define BATCH_IOV 256
+#define DEV_NAME_MAX 16
+#define DEV_HASH_SIZE 1024      // степень двойки
+#define STAT_BUCKETS 144        // 4 корзины на степень двойки, до 2^36 нс
 
 // Права доступа
 #define PERM_RW 0
@@ -27,38 +92,205 @@
 
 static const char *progname = "example";
 static int optv = 0;
+static int opt_workers = 2;
+static int opt_thread_per_client = 0;
+static size_t opt_dev_size = DEVICE_BUF_SIZE;   // -S
+static int opt_copy_read = 0;   // -C: READ через send() из отображения, как раньше
+static size_t opt_ring = 0;     // -R: ёмкость кольцевого устройства, 0 — обычный буфер
+static int opt_devices = 1;
+static int opt_stats_period = 0;        // -P: секунды между выводами статистики
+static int opt_lat_sample = 8;          // -L: латентность меряется у каждой N-й команды
 static int listen_fd = -1;
 
+/*
+ * Содержимое устройства лежит в memfd, отображённом в память сервера, —
+ * хранилище со счётчиком ссылок. Данные только дописываются в конец, поэтому
+ * байты [0, size) хранилища не меняются и пара (хранилище, size) работает
+ * как неизменяемый снимок (в духе RCU): READ под коротким rdlock берёт
+ * ссылку и размер и отправляет их уже без блокировки, так что медленный
+ * читатель никого не держит. WRITE пишет за концом и под wrlock только
+ * увеличивает size; CLEAR подменяет хранилище, и старое освобождает
+ * последний читатель.
+ */
+typedef struct store
+{
+  atomic_int refs;
+  int fd;               // memfd размером opt_dev_size (разреженный)
+  char *map;
+} store_t;
+
 // Структура устройства
 typedef struct device
 {
-  char buffer[DEVICE_BUF_SIZE];
-  size_t size;
+  char name[DEV_NAME_MAX];
+  struct device *hnext; // цепочка в dev_hash
+  store_t *st;          // текущее хранилище (NULL — пусто), меняется под lock (wr)
+  size_t size;          // сколько байт st занято
   int flags;
   int permissions;
-  pthread_mutex_t lock;
+  int clients;          // открытых соединений (DEV_BUSY, пока > 0)
+  pthread_rwlock_t lock;        // st, size, flags, permissions, clients, ring_*
+  pthread_mutex_t write_lock;   // сериализует WRITE/CLEAR между собой
+
+  // Кольцевой режим (-R): в ring лежат последние ring_cap байт потока записей
+  char *ring;
+  size_t ring_cap;
+  uint64_t ring_head;           // байт записано за всё время
+  uint64_t ring_clear;          // ring_head на момент последнего CLEAR
+  pthread_mutex_t wait_lock;    // -T: READ WAIT ждёт на wait_cond
+  pthread_cond_t wait_cond;
 } device_t;
 
-static device_t dev = {
-    .size = 0,
-    .flags = 0,
-    .permissions = PERM_RW,
-    .lock = PTHREAD_MUTEX_INITIALIZER};
+static device_t *devices;        // opt_devices штук, devices[0] — по умолчанию
+static device_t *dev_hash[DEV_HASH_SIZE];
+
+// Устройство, к которому соединение уже обращалось (аналог open() в QNX)
+typedef struct conn_dev
+{
+  device_t *dev;
+  uint64_t cursor;      // кольцевой режим: смещение первого непрочитанного байта
+} conn_dev_t;
+
+// Контекст соединения
+typedef struct conn
+{
+  int fd;
+  int dead;             // ошибка записи: закрыть после текущего события
+  int skip_line;        // строка длиннее CONN_INBUF: отбрасываем до '\n'
+  size_t in_len;
+  char *out;            // неотправленный хвост ответа (NULL — нет)
+  size_t out_len;
+  size_t out_off;
+  store_t *out_st;      // READ, недосланный sendfile: уходит раньше out
+  off_t out_st_off;
+  off_t out_st_end;
+  uint32_t events;      // текущая подписка в epoll
+  struct worker *w;     // поток-владелец (NULL в режиме -T)
+
+  conn_dev_t *devs;     // обычно одно-два устройства — ищем перебором
+  int n_devs;
+
+  // Кольцевой режим
+  int waiting;          // в READ WAIT: команды не разбираются до ответа
+  int wait_bin;         // READ WAIT пришёл кадром: ответ тоже кадр с wait_hdr
+  rm_hdr_t wait_hdr;
+  conn_dev_t *wait_on;  // чьё кольцо ждём; devs не растёт, пока waiting
+  int64_t wait_deadline;        // CLOCK_MONOTONIC, нс; 0 — без таймаута
+  int64_t wait_start;           // для статистики: когда пришёл READ WAIT
+  struct conn *wait_prev;
+  struct conn *wait_next;
+
+  char in[CONN_INBUF];
+} conn_t;
+
+typedef struct worker
+{
+  pthread_t th;
+  int epfd;
+  int efd;              // eventfd: в кольцо записали новые данные
+  long id;
+  conn_t *parked;       // соединения в READ WAIT; список трогает только этот поток
+  int n_timed;          // из них с таймаутом
+  atomic_int n_parked;  // читают писатели, чтобы не будить потоки зря
+} worker_t;
+
+static worker_t workers[MAX_WORKERS];
+static char wake_tag;   // data.ptr события eventfd
+
+/*
+ * Счётчики потока. Пишет в них только сам поток, поэтому прибавление — это
+ * обычные load и store (relaxed), без lock-префикса и без общих для потоков
+ * строк кэша. STATS читает чужие счётчики на лету: значения могут быть
+ * чуть несогласованы между собой, но каждое по отдельности не рвётся.
+ * Потоки регистрируются в stats_list; поток -T при выходе сливает свои
+ * счётчики в stats_retired.
+ */
+enum
+{
+  CMD_READ,
+  CMD_READ_WAIT,
+  CMD_READFD,
+  CMD_WRITE,
+  CMD_INFO,
+  CMD_CLEAR,
+  CMD_SETPERM,
+  CMD_STATS,
+  CMD_OTHER,            // неизвестные и некорректные
+  CMD_N
+};
+
+static const char *const cmd_names[CMD_N] = {
+  "READ", "READ_WAIT", "READFD", "WRITE", "INFO", "CLEAR", "SETPERM", "STATS", "OTHER",
+};
+
+enum
+{
+  STAT_BYTES_IN,
+  STAT_BYTES_OUT,
+  STAT_CONN_OPENED,
+  STAT_CONN_CLOSED,
+  STAT_LOCK_WAITS,      // захватов блокировок устройства, которым пришлось ждать
+  STAT_LOCK_WAIT_NS,
+  STAT_CMD              // дальше по 2 + STAT_BUCKETS счётчиков на команду
+};
+
+#define STAT_CALLS(k) (STAT_CMD + (k) * (2 + STAT_BUCKETS))
+#define STAT_ERRORS(k) (STAT_CALLS(k) + 1)
+#define STAT_LAT(k, b) (STAT_CALLS(k) + 2 + (b))
+#define STAT_N STAT_CALLS(CMD_N)
+
+typedef struct stats
+{
+  _Alignas(64) _Atomic uint64_t v[STAT_N];
+  struct stats *next;
+} stats_t;
+
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+static stats_t *stats_list;     // под stats_lock
+static stats_t stats_retired;   // под stats_lock
+static __thread stats_t *tstats;
+static __thread int64_t cmd_start;     // 0 — латентность команды не меряется
+static __thread int sample_left;
+static __thread int cmd_failed; // команда ответила conn_error
 
 static void options(int argc, char *argv[]);
 static void install_signals(void);
 static void on_signal(int signo);
+static void raise_nofile_limit(void);
+static conn_t *conn_open(int fd);
+static void conn_close(conn_t *c);
+static void conn_send(conn_t *c, const char *data, size_t len);
+static void conn_process(conn_t *c);
+static void *worker_thread(void *arg);
 static void *client_thread(void *arg);
-static void handle_command(int fd, const char *cmd);
+static void dispatch_command(conn_t *c, const char *cmd);
+static void handle_command(conn_t *c, conn_dev_t *cd, const char *cmd);
+static void dev_write(conn_t *c, device_t *d, const char *data, size_t len);
+static conn_dev_t *conn_attach(conn_t *c, device_t *d);
+static int devices_init(void);
+static void park_remove(conn_t *c);
+static void store_put(store_t *st);
+static void serve_parked(worker_t *w, int woke);
+static int park_timeout_ms(const worker_t *w);
+static int64_t now_ns(void);
+static void stats_attach(stats_t *st);
+static void *stats_thread(void *arg);
 
 int main(int argc, char *argv[])
 {
+  static stats_t main_stats;    // accept и conn_open в режиме -T
+
   setvbuf(stdout, NULL, _IOLBF, 0);
   printf("%s: starting...\n", progname);
   options(argc, argv);
+  stats_attach(&main_stats);
   install_signals();
+  raise_nofile_limit();
+  if (devices_init() == -1)
+    return EXIT_FAILURE;
 
-  listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  int type = SOCK_STREAM | (opt_thread_per_client ? 0 : SOCK_NONBLOCK);
+  listen_fd = socket(AF_UNIX, type, 0);
   if (listen_fd == -1)
   {
     perror("socket");
@@ -79,7 +311,8 @@ int main(int argc, char *argv[])
     return EXIT_FAILURE;
   }
 
-  if (listen(listen_fd, 8) == -1)
+  // Очередь на 8 подключений переполнялась уже при сотне одновременных клиентов
+  if (listen(listen_fd, SOMAXCONN) == -1)
   {
     perror("listen");
     close(listen_fd);
@@ -87,10 +320,54 @@ int main(int argc, char *argv[])
     return EXIT_FAILURE;
   }
 
-  printf("%s: listening on %s\n", progname, EXAMPLE_SOCK_PATH);
+  printf("%s: listening on %s (%s)\n", progname, EXAMPLE_SOCK_PATH,
+         opt_thread_per_client ? "thread per client" : "epoll workers");
+  if (opt_devices > 1)
+    printf("%s: %d devices, /dev0 ... %s\n", progname, opt_devices, devices[opt_devices - 1].name);
+  if (opt_ring)
+    printf("%s: ring device, capacity %zu bytes\n", progname, opt_ring);
   printf("Подключитесь клиентом (например: `nc -U %s`) и отправьте команды.\n", EXAMPLE_SOCK_PATH);
 
-  while (1)
+  pthread_t stats_th;
+  if (opt_stats_period > 0 && pthread_create(&stats_th, NULL, stats_thread, NULL) == 0)
+    pthread_detach(stats_th);
+
+  if (!opt_thread_per_client)
+  {
+    for (int i = 0; i < opt_workers; i++)
+    {
+      workers[i].id = i;
+      workers[i].epfd = epoll_create1(EPOLL_CLOEXEC);
+      workers[i].efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+      if (workers[i].epfd == -1 || workers[i].efd == -1)
+      {
+        perror("epoll_create1/eventfd");
+        return EXIT_FAILURE;
+      }
+      // data.ptr == NULL — слушающий сокет
+      struct epoll_event ev = {.events = EPOLLIN | EPOLLEXCLUSIVE, .data.ptr = NULL};
+      if (epoll_ctl(workers[i].epfd, EPOLL_CTL_ADD, listen_fd, &ev) == -1)
+      {
+        perror("epoll_ctl (listen)");
+        return EXIT_FAILURE;
+      }
+      struct epoll_event wake = {.events = EPOLLIN, .data.ptr = &wake_tag};
+      if (epoll_ctl(workers[i].epfd, EPOLL_CTL_ADD, workers[i].efd, &wake) == -1)
+      {
+        perror("epoll_ctl (eventfd)");
+        return EXIT_FAILURE;
+      }
+      if (pthread_create(&workers[i].th, NULL, worker_thread, &workers[i]) != 0)
+      {
+        perror("pthread_create");
+        return EXIT_FAILURE;
+      }
+    }
+    for (int i = 0; i < opt_workers; i++)
+      pthread_join(workers[i].th, NULL);
+  }
+
+  while (opt_thread_per_client)
   {
     int client_fd = accept(listen_fd, NULL, NULL);
     if (client_fd == -1)
@@ -101,14 +378,15 @@ int main(int argc, char *argv[])
       break;
     }
 
-    if (optv)
-      printf("%s: io_open — новое подключение (fd=%d)\n", progname, client_fd);
+    conn_t *c = conn_open(client_fd);
+    if (!c)
+      continue;
 
     pthread_t th;
-    if (pthread_create(&th, NULL, client_thread, (void *)(long)client_fd) != 0)
+    if (pthread_create(&th, NULL, client_thread, c) != 0)
     {
       perror("pthread_create");
-      close(client_fd);
+      conn_close(c);
       continue;
     }
     pthread_detach(th);
@@ -120,127 +398,1687 @@ int main(int argc, char *argv[])
   return EXIT_SUCCESS;
 }
 
-static void *client_thread(void *arg)
+// Счётчик пишет только свой поток: атомарный RMW не нужен
+static inline void stat_add(int idx, uint64_t v)
+{
+  _Atomic uint64_t *p = &tstats->v[idx];
+  atomic_store_explicit(p, atomic_load_explicit(p, memory_order_relaxed) + v, memory_order_relaxed);
+}
+
+static void stats_attach(stats_t *st)
 {
-  int fd = (int)(long)arg;
-  char buf[1024];
+  memset(st, 0, sizeof(*st));
+  pthread_mutex_lock(&stats_lock);
+  st->next = stats_list;
+  stats_list = st;
+  pthread_mutex_unlock(&stats_lock);
+  tstats = st;
+}
 
-  // Отмечаем устройство как занятое
-  pthread_mutex_lock(&dev.lock);
-  dev.flags |= DEV_OPEN | DEV_BUSY;
-  pthread_mutex_unlock(&dev.lock);
+// Поток завершается: его счётчики переходят в stats_retired
+static void stats_detach(stats_t *st)
+{
+  pthread_mutex_lock(&stats_lock);
+  for (stats_t **pp = &stats_list; *pp; pp = &(*pp)->next)
+    if (*pp == st)
+    {
+      *pp = st->next;
+      break;
+    }
+  for (int i = 0; i < STAT_N; i++)
+    stats_retired.v[i] += atomic_load_explicit(&st->v[i], memory_order_relaxed);
+  pthread_mutex_unlock(&stats_lock);
+  tstats = NULL;
+}
 
-  for (;;)
+static void stats_collect(uint64_t *sum)
+{
+  pthread_mutex_lock(&stats_lock);
+  for (int i = 0; i < STAT_N; i++)
+    sum[i] = atomic_load_explicit(&stats_retired.v[i], memory_order_relaxed);
+  for (stats_t *st = stats_list; st; st = st->next)
+    for (int i = 0; i < STAT_N; i++)
+      sum[i] += atomic_load_explicit(&st->v[i], memory_order_relaxed);
+  pthread_mutex_unlock(&stats_lock);
+}
+
+/*
+ * Лог-линейная гистограмма: 4 корзины на каждую степень двойки, то есть
+ * погрешность границы не больше 25%. Значения 0..3 нс — корзины 0..3.
+ */
+static int stat_bucket(uint64_t ns)
+{
+  if (ns < 4)
+    return (int)ns;
+  int e = 63 - __builtin_clzll(ns);
+  int b = (e - 1) * 4 + (int)((ns >> (e - 2)) & 3);
+  return b < STAT_BUCKETS ? b : STAT_BUCKETS - 1;
+}
+
+// Верхняя граница корзины, нс
+static uint64_t stat_bucket_limit(int b)
+{
+  if (b < 4)
+    return (uint64_t)b + 1;
+  return (uint64_t)(5 + b % 4) << (b / 4 - 1);
+}
+
+// Верхняя граница корзины, в которую попадает доля q замеров
+static double stat_percentile_us(const uint64_t *hist, uint64_t total, double q)
+{
+  if (total == 0)
+    return 0.0;
+  uint64_t rank = (uint64_t)(q * (double)total);
+  uint64_t seen = 0;
+  int b = 0;
+  for (; b < STAT_BUCKETS - 1; b++)
   {
-    ssize_t n = recv(fd, buf, sizeof(buf) - 1, 0);
-    if (n <= 0)
+    seen += hist[b];
+    if (seen > rank)
       break;
-    buf[n] = '\0'; // гарантируем строку
+  }
+  return stat_bucket_limit(b) / 1000.0;
+}
+
+// Вид команды для статистики; префикс устройства пропускается
+static int cmd_kind(const char *cmd)
+{
+  if (cmd[0] == '/')
+  {
+    cmd += strcspn(cmd, " \n");
+    if (*cmd == ' ')
+      cmd++;
+  }
+  // Сначала по первой букве: сравнение строк — заметная часть учёта
+  switch (cmd[0])
+  {
+  case 'R':
+    if (strncmp(cmd, "READ WAIT", 9) == 0)
+      return CMD_READ_WAIT;
+    if (strcmp(cmd, "READFD\n") == 0)
+      return CMD_READFD;
+    return strncmp(cmd, "READ", 4) == 0 ? CMD_READ : CMD_OTHER;
+  case 'W':
+    return strncmp(cmd, "WRITE ", 6) == 0 ? CMD_WRITE : CMD_OTHER;
+  case 'I':
+    return strcmp(cmd, "INFO\n") == 0 ? CMD_INFO : CMD_OTHER;
+  case 'C':
+    return strcmp(cmd, "CLEAR\n") == 0 ? CMD_CLEAR : CMD_OTHER;
+  case 'S':
+    if (strncmp(cmd, "SETPERM ", 8) == 0)
+      return CMD_SETPERM;
+    return strcmp(cmd, "STATS\n") == 0 ? CMD_STATS : CMD_OTHER;
+  }
+  return CMD_OTHER;
+}
 
-    handle_command(fd, buf);
+/*
+ * Часы — самая дорогая часть учёта: два clock_gettime добавляли к INFO
+ * около 100 нс, треть её стоимости. Поэтому считаются все команды, а
+ * латентность меряется у каждой -L N-й (по умолчанию 8-й); гистограмма —
+ * выборка, для перцентилей при постоянной нагрузке этого достаточно.
+ */
+static void stats_begin(void)
+{
+  cmd_failed = 0;
+  cmd_start = 0;
+  if (--sample_left <= 0)
+  {
+    sample_left = opt_lat_sample;
+    cmd_start = now_ns();
   }
+}
 
-  pthread_mutex_lock(&dev.lock);
-  dev.flags &= ~DEV_BUSY;
-  pthread_mutex_unlock(&dev.lock);
+static void stats_record(int kind, int64_t start)
+{
+  stat_add(STAT_CALLS(kind), 1);
+  if (cmd_failed)
+    stat_add(STAT_ERRORS(kind), 1);
+  if (start)
+    stat_add(STAT_LAT(kind, stat_bucket((uint64_t)(now_ns() - start))), 1);
+}
 
-  close(fd);
-  if (optv)
-    printf("%s: клиент отключился (fd=%d)\n", progname, fd);
-  return NULL;
+// READ WAIT, ушедший в парковку, учтёт serve_parked — вместе с ожиданием
+static void stats_end(conn_t *c, int kind)
+{
+  if (c->waiting)
+    c->wait_start = cmd_start;
+  else
+    stats_record(kind, cmd_start);
 }
 
-static void handle_command(int fd, const char *cmd)
+/*
+ * Блокировки устройства: сначала попытка без ожидания. Часы читаются только
+ * при конфликте, так что незанятая блокировка статистике ничего не стоит.
+ */
+static void lock_rd(pthread_rwlock_t *l)
 {
-    char resp[1024];
+  if (pthread_rwlock_tryrdlock(l) == 0)
+    return;
+  int64_t t0 = now_ns();
+  pthread_rwlock_rdlock(l);
+  stat_add(STAT_LOCK_WAITS, 1);
+  stat_add(STAT_LOCK_WAIT_NS, (uint64_t)(now_ns() - t0));
+}
 
-    // Игнорируем аргументы для READ, всегда читаем весь буфер
-    if (strncmp(cmd, "READ", 4) == 0) {
-        pthread_mutex_lock(&dev.lock);
-        if (dev.permissions == PERM_WO) {  // проверка на право чтения
-            pthread_mutex_unlock(&dev.lock);
-            write(fd, "Permission denied\n", 18);
-            return;
-        }
-        if (dev.size > 0) {
-            if (write(fd, dev.buffer, dev.size) < 0) perror("write");
-        } else {
-            write(fd, "<buffer empty>\n", 15);
-        }
-        pthread_mutex_unlock(&dev.lock);
-        return;
-    }
+static void lock_wr(pthread_rwlock_t *l)
+{
+  if (pthread_rwlock_trywrlock(l) == 0)
+    return;
+  int64_t t0 = now_ns();
+  pthread_rwlock_wrlock(l);
+  stat_add(STAT_LOCK_WAITS, 1);
+  stat_add(STAT_LOCK_WAIT_NS, (uint64_t)(now_ns() - t0));
+}
 
-    if (strncmp(cmd, "WRITE ", 6) == 0) {
-        pthread_mutex_lock(&dev.lock);
-        if (dev.permissions == PERM_RO) {  // проверка на право записи
-            pthread_mutex_unlock(&dev.lock);
-            write(fd, "Permission denied\n", 18);
-            return;
-        }
-        const char *data = cmd + 6;
-        size_t len = strlen(data);
-        if (len + dev.size > DEVICE_BUF_SIZE) len = DEVICE_BUF_SIZE - dev.size;
-        memcpy(dev.buffer + dev.size, data, len);
-        dev.size += len;
-        pthread_mutex_unlock(&dev.lock);
-        snprintf(resp, sizeof(resp), "OK, %zu bytes written\n", len);
-        write(fd, resp, strlen(resp));
-        return;
+static void lock_mutex(pthread_mutex_t *m)
+{
+  if (pthread_mutex_trylock(m) == 0)
+    return;
+  int64_t t0 = now_ns();
+  pthread_mutex_lock(m);
+  stat_add(STAT_LOCK_WAITS, 1);
+  stat_add(STAT_LOCK_WAIT_NS, (uint64_t)(now_ns() - t0));
+}
+
+// Текст ответа STATS; возвращает длину
+static size_t stats_format(char *buf, size_t cap)
+{
+  static uint64_t sum[STAT_N];  // 10 КиБ — не на стек; под stats_format_lock
+  static pthread_mutex_t stats_format_lock = PTHREAD_MUTEX_INITIALIZER;
+  size_t len = 0;
+
+  pthread_mutex_lock(&stats_format_lock);
+  stats_collect(sum);
+  len += (size_t)snprintf(buf + len, cap - len,
+                          "Connections=%llu, Opened=%llu, BytesIn=%llu, BytesOut=%llu, LockWaits=%llu, LockWaitUs=%llu\n",
+                          (unsigned long long)(sum[STAT_CONN_OPENED] - sum[STAT_CONN_CLOSED]),
+                          (unsigned long long)sum[STAT_CONN_OPENED],
+                          (unsigned long long)sum[STAT_BYTES_IN], (unsigned long long)sum[STAT_BYTES_OUT],
+                          (unsigned long long)sum[STAT_LOCK_WAITS],
+                          (unsigned long long)(sum[STAT_LOCK_WAIT_NS] / 1000));
+  for (int k = 0; k < CMD_N && len < cap; k++)
+  {
+    uint64_t calls = sum[STAT_CALLS(k)];
+    if (calls == 0)
+      continue;
+    const uint64_t *hist = &sum[STAT_LAT(k, 0)];
+    uint64_t timed = 0;
+    int top = 0;
+    for (int b = 0; b < STAT_BUCKETS; b++)
+    {
+      timed += hist[b];
+      if (hist[b])
+        top = b;
     }
+    len += (size_t)snprintf(buf + len, cap - len, "Cmd=%s, Calls=%llu, Errors=%llu",
+                            cmd_names[k], (unsigned long long)calls,
+                            (unsigned long long)sum[STAT_ERRORS(k)]);
+    if (len >= cap)
+      break;
+    // Замеряется только каждая -L-я команда: без замеров перцентили не нули, а "-"
+    if (timed == 0)
+      len += (size_t)snprintf(buf + len, cap - len, ", P50Us=-, P99Us=-, P999Us=-, MaxUs=-\n");
+    else
+      len += (size_t)snprintf(buf + len, cap - len, ", P50Us=%.1f, P99Us=%.1f, P999Us=%.1f, MaxUs=%.1f\n",
+                              stat_percentile_us(hist, timed, 0.50),
+                              stat_percentile_us(hist, timed, 0.99),
+                              stat_percentile_us(hist, timed, 0.999),
+                              stat_bucket_limit(top) / 1000.0);
+  }
+  pthread_mutex_unlock(&stats_format_lock);
+  return len < cap ? len : cap - 1;
+}
 
-    if (strcmp(cmd, "INFO\n") == 0) {
-        pthread_mutex_lock(&dev.lock);
-        snprintf(resp, sizeof(resp), "Size=%zu, Flags=%d, Permissions=%d\n",
-                 dev.size, dev.flags, dev.permissions);
-        pthread_mutex_unlock(&dev.lock);
-        write(fd, resp, strlen(resp));
-        return;
+// -P N: раз в N секунд печатает то же, что STATS
+static void *stats_thread(void *arg)
+{
+  (void)arg;
+  char buf[2048];
+  for (;;)
+  {
+    sleep((unsigned)opt_stats_period);
+    size_t len = stats_format(buf, sizeof(buf));
+    printf("%s: stats\n%.*s", progname, (int)len, buf);
+  }
+  return NULL;
+}
+
+static conn_t *conn_open(int fd)
+{
+  conn_t *c = calloc(1, sizeof(*c));
+  if (!c)
+  {
+    perror("calloc");
+    close(fd);
+    return NULL;
+  }
+  c->fd = fd;
+  stat_add(STAT_CONN_OPENED, 1);
+
+  if (optv)
+    printf("%s: io_open — новое подключение (fd=%d)\n", progname, fd);
+  return c;
+}
+
+static void conn_close(conn_t *c)
+{
+  if (c->waiting)
+    park_remove(c);
+  for (int i = 0; i < c->n_devs; i++)
+  {
+    device_t *d = c->devs[i].dev;
+    lock_wr(&d->lock);
+    if (--d->clients == 0)
+      d->flags &= ~DEV_BUSY;
+    pthread_rwlock_unlock(&d->lock);
+  }
+
+  // close() сам убирает дескриптор из epoll
+  close(c->fd);
+  stat_add(STAT_CONN_CLOSED, 1);
+  if (optv)
+    printf("%s: клиент отключился (fd=%d)\n", progname, c->fd);
+  free(c->out);
+  store_put(c->out_st);
+  free(c->devs);
+  free(c);
+}
+
+static int conn_pending(const conn_t *c)
+{
+  return c->out || c->out_st;
+}
+
+/*
+ * Отправляет ответ. Что не влезло в неблокирующий сокет, копируется в
+ * c->out и досылается по EPOLLOUT. В режиме -T сокет блокирующий и send
+ * отдаёт всё сразу.
+ */
+static void conn_send_now(conn_t *c, const char *data, size_t len)
+{
+  while (!conn_pending(c) && len > 0)
+  {
+    ssize_t n = send(c->fd, data, len, MSG_NOSIGNAL);
+    if (n < 0)
+    {
+      if (errno == EINTR)
+        continue;
+      if (errno == EAGAIN || errno == EWOULDBLOCK)
+        break;
+      c->dead = 1;      // клиент ушёл, не дочитав ответ
+      return;
     }
+    stat_add(STAT_BYTES_OUT, (uint64_t)n);
+    data += n;
+    len -= (size_t)n;
+  }
+  if (len == 0 || c->dead)
+    return;
 
-    if (strcmp(cmd, "CLEAR\n") == 0) {
-        pthread_mutex_lock(&dev.lock);
-        if (dev.permissions == PERM_RO) {  // нельзя очищать если только чтение
-            pthread_mutex_unlock(&dev.lock);
-            write(fd, "Permission denied\n", 18);
-            return;
-        }
-        dev.size = 0;
-        pthread_mutex_unlock(&dev.lock);
-        write(fd, "Buffer cleared\n", 15);
-        return;
+  char *out = realloc(c->out, c->out_len + len);
+  if (!out)
+  {
+    c->dead = 1;
+    return;
+  }
+  memcpy(out + c->out_len, data, len);
+  c->out = out;
+  c->out_len += len;
+}
+
+/*
+ * Пакет ответов. Пока conn_process разбирает входной буфер, ответы не
+ * уходят по одному: мелкие копируются в арену, данные устройства
+ * добавляются ссылкой прямо на отображение хранилища, а в конце прохода всё
+ * отправляется одним writev. Пакет свой у каждого потока и в каждый момент
+ * собирается для одного соединения (owner). Сегменты хранят смещения в
+ * арене, а не указатели: арена растёт через realloc.
+ */
+typedef struct batch_seg
+{
+  const char *ext;      // данные вне арены или NULL
+  size_t off;           // смещение в арене, если ext == NULL
+  size_t len;
+} batch_seg_t;
+
+typedef struct batch
+{
+  conn_t *owner;        // NULL — пакет не собирается, conn_send шлёт сразу
+  char *arena;
+  size_t arena_len;
+  size_t arena_cap;
+  batch_seg_t *seg;
+  int n_seg;
+  int seg_cap;
+  size_t bytes;
+  store_t **refs;       // хранилища, на которые ссылаются сегменты ext
+  int n_refs;
+  int refs_cap;
+
+  // Текущий двоичный ответ: заголовок уже в арене, длина известна в конце
+  int in_resp;
+  rm_hdr_t resp_hdr;
+  size_t hdr_off;
+  size_t resp_len;
+} batch_t;
+
+static __thread batch_t batch;
+
+static int batch_grow(void **p, int *cap, int need, size_t elem)
+{
+  if (need <= *cap)
+    return 0;
+  int ncap = *cap ? *cap * 2 : 64;
+  while (ncap < need)
+    ncap *= 2;
+  void *np = realloc(*p, (size_t)ncap * elem);
+  if (!np)
+    return -1;
+  *p = np;
+  *cap = ncap;
+  return 0;
+}
+
+static int batch_seg_add(const char *ext, size_t off, size_t len)
+{
+  batch_seg_t *last = batch.n_seg ? &batch.seg[batch.n_seg - 1] : NULL;
+  if (!ext && last && !last->ext && last->off + last->len == off)
+  {
+    last->len += len;   // продолжение предыдущего куска арены
+  }
+  else
+  {
+    if (batch_grow((void **)&batch.seg, &batch.seg_cap, batch.n_seg + 1, sizeof(batch_seg_t)) == -1)
+      return -1;
+    batch.seg[batch.n_seg++] = (batch_seg_t){.ext = ext, .off = off, .len = len};
+  }
+  batch.bytes += len;
+  if (batch.in_resp)
+    batch.resp_len += len;
+  return 0;
+}
+
+static void batch_add(conn_t *c, const char *data, size_t len)
+{
+  if (batch.arena_len + len > batch.arena_cap)
+  {
+    size_t cap = batch.arena_cap ? batch.arena_cap : 4096;
+    while (cap < batch.arena_len + len)
+      cap *= 2;
+    char *arena = realloc(batch.arena, cap);
+    if (!arena)
+    {
+      c->dead = 1;
+      return;
     }
+    batch.arena = arena;
+    batch.arena_cap = cap;
+  }
+  memcpy(batch.arena + batch.arena_len, data, len);
+  if (batch_seg_add(NULL, batch.arena_len, len) == -1)
+  {
+    c->dead = 1;
+    return;
+  }
+  batch.arena_len += len;
+}
 
-    if (strncmp(cmd, "SETPERM ", 8) == 0) {
-        pthread_mutex_lock(&dev.lock);
-        if (strncmp(cmd + 8, "rw", 2) == 0) dev.permissions = PERM_RW;
-        else if (strncmp(cmd + 8, "ro", 2) == 0) dev.permissions = PERM_RO;
-        else if (strncmp(cmd + 8, "wo", 2) == 0) dev.permissions = PERM_WO;
-        else {
-            pthread_mutex_unlock(&dev.lock);
-            write(fd, "Unknown permission\n", 19);
-            return;
-        }
-        pthread_mutex_unlock(&dev.lock);
-        write(fd, "Permission set\n", 15);
-        return;
+// Данные хранилища уходят из отображения без копии; ссылка держится до writev
+static void batch_add_store(conn_t *c, store_t *st, size_t len)
+{
+  if (batch_grow((void **)&batch.refs, &batch.refs_cap, batch.n_refs + 1, sizeof(store_t *)) == -1 ||
+      batch_seg_add(st->map, 0, len) == -1)
+  {
+    c->dead = 1;
+    return;
+  }
+  atomic_fetch_add_explicit(&st->refs, 1, memory_order_relaxed);
+  batch.refs[batch.n_refs++] = st;
+}
+
+static void batch_flush(conn_t *c)
+{
+  struct iovec iov[BATCH_IOV];
+  int i = 0;
+
+  while (i < batch.n_seg && !c->dead)
+  {
+    int n = 0;
+    for (; n < BATCH_IOV && i + n < batch.n_seg; n++)
+    {
+      const batch_seg_t *sg = &batch.seg[i + n];
+      iov[n].iov_base = (void *)(sg->ext ? sg->ext : batch.arena + sg->off);
+      iov[n].iov_len = sg->len;
+    }
+    ssize_t w = 0;
+    if (!conn_pending(c))
+    {
+      do
+        w = writev(c->fd, iov, n);
+      while (w < 0 && errno == EINTR);
+      if (w < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
+      {
+        c->dead = 1;
+        break;
+      }
+      if (w < 0)
+        w = 0;
+      stat_add(STAT_BYTES_OUT, (uint64_t)w);
     }
+    // Что не влезло в сокет, уходит в хвост ответа
+    for (int k = 0; k < n && !c->dead; k++)
+    {
+      size_t len = iov[k].iov_len;
+      size_t skip = (size_t)w < len ? (size_t)w : len;
+      w -= (ssize_t)skip;
+      if (skip < len)
+        conn_send_now(c, (const char *)iov[k].iov_base + skip, len - skip);
+    }
+    i += n;
+  }
 
-    write(fd, "Unknown command\n", 16);
+  for (int k = 0; k < batch.n_refs; k++)
+    store_put(batch.refs[k]);
+  batch.n_refs = 0;
+  batch.n_seg = 0;
+  batch.arena_len = 0;
+  batch.bytes = 0;
 }
 
-static void options(int argc, char *argv[])
+static void batch_begin(conn_t *c)
 {
-  int opt;
-  optv = 0;
-  while ((opt = getopt(argc, argv, "v")) != -1)
+  batch.owner = c;
+}
+
+static void batch_end(conn_t *c)
+{
+  batch_flush(c);
+  batch.owner = NULL;
+}
+
+// Поток -T завершается вместе с соединением — отдаём память пакета
+static void batch_release(void)
+{
+  free(batch.arena);
+  free(batch.seg);
+  free(batch.refs);
+  memset(&batch, 0, sizeof(batch));
+}
+
+// Начинает двоичный ответ на запрос req: место под заголовок — в арене
+static void resp_begin(conn_t *c, const rm_hdr_t *req)
+{
+  rm_hdr_t h = *req;
+  h.status = RM_OK;
+  h.len = 0;
+  batch.in_resp = 0;
+  batch.hdr_off = batch.arena_len;
+  batch_add(c, (const char *)&h, sizeof(h));
+  batch.resp_hdr = h;
+  batch.resp_len = 0;
+  batch.in_resp = 1;
+}
+
+static void resp_end(void)
+{
+  batch.resp_hdr.len = (uint32_t)batch.resp_len;
+  memcpy(batch.arena + batch.hdr_off, &batch.resp_hdr, sizeof(rm_hdr_t));
+  batch.in_resp = 0;
+}
+
+// Убирает заголовок начатого и ещё пустого ответа (запрос припаркован)
+static void resp_cancel(void)
+{
+  batch_seg_t *last = &batch.seg[batch.n_seg - 1];
+  last->len -= sizeof(rm_hdr_t);
+  if (last->len == 0)
+    batch.n_seg--;
+  batch.arena_len -= sizeof(rm_hdr_t);
+  batch.bytes -= sizeof(rm_hdr_t);
+  batch.in_resp = 0;
+}
+
+// Отправляет накопленное раньше начатого двоичного ответа (он ещё пуст)
+static void batch_flush_before(conn_t *c)
+{
+  if (batch.owner != c)
+    return;
+  int in_resp = batch.in_resp;
+  rm_hdr_t h = batch.resp_hdr;
+  if (in_resp)
+    resp_cancel();
+  batch_flush(c);
+  if (in_resp)
+    resp_begin(c, &h);
+}
+
+static void conn_send(conn_t *c, const char *data, size_t len)
+{
+  if (batch.owner == c)
+    batch_add(c, data, len);
+  else
+    conn_send_now(c, data, len);
+}
+
+// Ответ-ошибка: в двоичном протоколе помечается статусом RM_ERR
+static void conn_error(conn_t *c, const char *msg)
+{
+  cmd_failed = 1;
+  if (batch.owner == c && batch.in_resp)
+    batch.resp_hdr.status = RM_ERR;
+  conn_send(c, msg, strlen(msg));
+}
+
+// 0 — хранилище отправлено целиком или сокет пока полон, -1 — ошибка
+static int conn_flush_store(conn_t *c)
+{
+  while (c->out_st_off < c->out_st_end)
   {
-    switch (opt)
+    ssize_t n = sendfile(c->fd, c->out_st->fd, &c->out_st_off, (size_t)(c->out_st_end - c->out_st_off));
+    if (n < 0)
     {
-    case 'v':
-      optv++;
-      break;
+      if (errno == EINTR)
+        continue;
+      if (errno == EAGAIN || errno == EWOULDBLOCK)
+        return 0;
+      return -1;
     }
+    if (n == 0)
+      return -1;
+    stat_add(STAT_BYTES_OUT, (uint64_t)n);
+  }
+  store_put(c->out_st);
+  c->out_st = NULL;
+  return 0;
+}
+
+/*
+ * Отправляет [0, size) хранилища через sendfile: страницы memfd уходят в
+ * сокет внутри ядра, без копии через пространство пользователя. Пока
+ * sendfile не дошёл до конца, соединение держит ссылку на хранилище.
+ * Небольшие ответы, ответы после уже отложенного хвоста и режим -C идут
+ * обычным send() из отображения: на 4 КиБ копия обходится дешевле, чем
+ * sendfile (см. resmgr_bench -z).
+ */
+static void conn_send_store(conn_t *c, store_t *st, size_t size)
+{
+  // В пакете: кадру нужна длина заранее, а мелкое дешевле отдать writev'ом
+  if (batch.owner == c && (batch.in_resp || opt_copy_read || size < SENDFILE_MIN))
+  {
+    batch_add_store(c, st, size);
+    return;
+  }
+  if (batch.owner == c)
+    batch_flush(c);
+  if (opt_copy_read || size < SENDFILE_MIN || conn_pending(c))
+  {
+    conn_send(c, st->map, size);
+    return;
+  }
+  atomic_fetch_add_explicit(&st->refs, 1, memory_order_relaxed);
+  c->out_st = st;
+  c->out_st_off = 0;
+  c->out_st_end = (off_t)size;
+  if (conn_flush_store(c) == -1)
+    c->dead = 1;
+}
+
+/*
+ * READFD: ответ "FD <size>\n", к которому через SCM_RIGHTS приложен
+ * дескриптор хранилища, заново открытый только на чтение. Клиент на той же
+ * машине читает [0, size) сам (pread, mmap) — сервер данные не трогает
+ * вовсе. Дескриптор нельзя отложить в хвост ответа, поэтому при полном
+ * сокете отвечаем "Try again".
+ */
+static void conn_send_fd(conn_t *c, store_t *st, size_t size)
+{
+  char hdr[32], path[64];
+  int len = snprintf(hdr, sizeof(hdr), "FD %zu\n", size);
+  if (batch.owner == c && batch.in_resp)
+  {
+    conn_error(c, "Not supported in binary protocol\n");
+    return;
+  }
+  if (!st || size == 0)
+  {
+    conn_send(c, hdr, (size_t)len);
+    return;
+  }
+  if (batch.owner == c)
+    batch_flush(c);
+  if (conn_pending(c))
+  {
+    conn_error(c, "Try again\n");
+    return;
+  }
+
+  snprintf(path, sizeof(path), "/proc/self/fd/%d", st->fd);
+  int rfd = open(path, O_RDONLY | O_CLOEXEC);
+  if (rfd == -1)
+  {
+    conn_error(c, "Cannot open storage\n");
+    return;
+  }
+  union
+  {
+    struct cmsghdr h;
+    char buf[CMSG_SPACE(sizeof(int))];
+  } ctl;
+  struct iovec iov = {.iov_base = hdr, .iov_len = (size_t)len};
+  struct msghdr msg = {.msg_iov = &iov, .msg_iovlen = 1, .msg_control = ctl.buf, .msg_controllen = sizeof(ctl.buf)};
+  struct cmsghdr *cm = CMSG_FIRSTHDR(&msg);
+  cm->cmsg_level = SOL_SOCKET;
+  cm->cmsg_type = SCM_RIGHTS;
+  cm->cmsg_len = CMSG_LEN(sizeof(int));
+  memcpy(CMSG_DATA(cm), &rfd, sizeof(int));
+
+  ssize_t n;
+  do
+    n = sendmsg(c->fd, &msg, MSG_NOSIGNAL);
+  while (n < 0 && errno == EINTR);
+  close(rfd);
+  if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+    conn_error(c, "Try again\n");
+  else if (n < 0)
+    c->dead = 1;
+  else
+    stat_add(STAT_BYTES_OUT, (uint64_t)n);
+  if (n > 0 && n < len)
+    conn_send(c, hdr + n, (size_t)(len - n));   // дескриптор ушёл с первым байтом
+}
+
+// 0 — хвост отправлен целиком или сокет пока полон, -1 — ошибка
+static int conn_flush(conn_t *c)
+{
+  if (c->out_st)
+  {
+    if (conn_flush_store(c) == -1)
+      return -1;
+    if (c->out_st)
+      return 0;         // сокет полон
+  }
+  while (c->out_off < c->out_len)
+  {
+    ssize_t n = send(c->fd, c->out + c->out_off, c->out_len - c->out_off, MSG_NOSIGNAL);
+    if (n < 0)
+    {
+      if (errno == EINTR)
+        continue;
+      if (errno == EAGAIN || errno == EWOULDBLOCK)
+        return 0;
+      return -1;
+    }
+    stat_add(STAT_BYTES_OUT, (uint64_t)n);
+    c->out_off += (size_t)n;
+  }
+  free(c->out);
+  c->out = NULL;
+  c->out_len = c->out_off = 0;
+  return 0;
+}
+
+/*
+ * Двоичный кадр: операции над устройством выполняются теми же
+ * обработчиками, что и текст, а их вывод становится нагрузкой ответа.
+ */
+static void handle_frame(conn_t *c, const rm_hdr_t *h, const char *payload)
+{
+  char cmd[RM_MAX_PAYLOAD + 2];
+  int kind = h->op == RM_OP_READ ? CMD_READ
+             : h->op == RM_OP_WRITE ? CMD_WRITE
+             : h->op == RM_OP_INFO ? CMD_INFO
+             : h->op == RM_OP_CLEAR ? CMD_CLEAR
+             : CMD_OTHER;
+
+  stats_begin();
+  resp_begin(c, h);
+  if (h->op == RM_OP_CMD)
+  {
+    memcpy(cmd, payload, h->len);
+    cmd[h->len] = '\n';
+    cmd[h->len + 1] = '\0';
+    kind = cmd_kind(cmd);
+    dispatch_command(c, cmd);
+  }
+  else if (h->dev >= (uint32_t)opt_devices)
+  {
+    conn_error(c, "Unknown device\n");
+  }
+  else
+  {
+    conn_dev_t *cd = conn_attach(c, &devices[h->dev]);
+    if (!cd)
+      conn_error(c, "Out of memory\n");
+    else if (h->op == RM_OP_READ)
+      handle_command(c, cd, "READ\n");
+    else if (h->op == RM_OP_WRITE)
+      dev_write(c, cd->dev, payload, h->len);
+    else if (h->op == RM_OP_INFO)
+      handle_command(c, cd, "INFO\n");
+    else if (h->op == RM_OP_CLEAR)
+      handle_command(c, cd, "CLEAR\n");
+    else
+      conn_error(c, "Unknown command\n");
+  }
+
+  if (c->waiting)
+  {
+    // READ WAIT: ответит serve_parked, заголовок пока не нужен
+    resp_cancel();
+    c->wait_bin = 1;
+    c->wait_hdr = *h;
+  }
+  else
+  {
+    resp_end();
+  }
+  stats_end(c, kind);
+}
+
+/*
+ * Выполняет все полные строки и кадры из входного буфера. Строка передаётся
+ * в handle_command вместе с '\n' — как раньше, когда recv приносил её
+ * целиком. Ответы копятся в пакете и уходят в конце прохода.
+ */
+static void conn_process(conn_t *c)
+{
+  char cmd[CONN_INBUF + 1];
+  size_t start = 0;
+
+  batch_begin(c);
+  while (!conn_pending(c) && !c->dead && !c->waiting)
+  {
+    if (batch.bytes >= BATCH_MAX_BYTES)
+      batch_flush(c);
+
+    size_t avail = c->in_len - start;
+    if (avail > 0 && (unsigned char)c->in[start] == RM_MAGIC && !c->skip_line)
+    {
+      rm_hdr_t h;
+      if (avail < sizeof(h))
+        break;
+      memcpy(&h, c->in + start, sizeof(h));
+      if (h.len > RM_MAX_PAYLOAD)
+      {
+        c->dead = 1;    // границу следующего кадра уже не найти
+        break;
+      }
+      if (avail < sizeof(h) + h.len)
+        break;
+      handle_frame(c, &h, c->in + start + sizeof(h));
+      start += sizeof(h) + h.len;
+      continue;
+    }
+
+    char *nl = memchr(c->in + start, '\n', avail);
+    if (!nl)
+      break;
+    size_t len = (size_t)(nl - (c->in + start)) + 1;
+    if (c->skip_line)
+    {
+      c->skip_line = 0;
+    }
+    else
+    {
+      memcpy(cmd, c->in + start, len);
+      cmd[len] = '\0';
+      stats_begin();
+      dispatch_command(c, cmd);
+      stats_end(c, cmd_kind(cmd));
+    }
+    start += len;
+  }
+
+  c->in_len -= start;
+  memmove(c->in, c->in + start, c->in_len);
+
+  // Кадр не длиннее буфера, поэтому полный буфер без '\n' может быть только
+  // у слишком длинной строки
+  if (c->in_len == CONN_INBUF && (unsigned char)c->in[0] != RM_MAGIC && !memchr(c->in, '\n', CONN_INBUF))
+  {
+    c->in_len = 0;
+    if (!c->skip_line)
+      conn_error(c, "Command too long\n");
+    c->skip_line = 1;
+  }
+  batch_end(c);
+}
+
+// 0 — продолжаем, -1 — закрыть соединение
+static int conn_read(conn_t *c)
+{
+  // Один recv на событие: epoll level-triggered, остаток придёт следующим
+  // событием, и один активный клиент не занимает поток целиком
+  ssize_t n = recv(c->fd, c->in + c->in_len, CONN_INBUF - c->in_len, 0);
+  if (n == 0)
+    return -1;
+  if (n < 0)
+    return (errno == EAGAIN || errno == EINTR) ? 0 : -1;
+  c->in_len += (size_t)n;
+  stat_add(STAT_BYTES_IN, (uint64_t)n);
+  conn_process(c);
+  return c->dead ? -1 : 0;
+}
+
+static void accept_clients(worker_t *w)
+{
+  // Ограничиваем пачку: остальные подключения разберут другие потоки
+  for (int i = 0; i < MAX_EVENTS; i++)
+  {
+    int fd = accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd == -1)
+    {
+      if (errno != EAGAIN && errno != EINTR && errno != ECONNABORTED)
+        perror("accept4");
+      return;
+    }
+    conn_t *c = conn_open(fd);
+    if (!c)
+      continue;
+    c->w = w;
+    c->events = EPOLLIN;
+    struct epoll_event ev = {.events = EPOLLIN, .data.ptr = c};
+    if (epoll_ctl(w->epfd, EPOLL_CTL_ADD, fd, &ev) == -1)
+    {
+      perror("epoll_ctl (client)");
+      conn_close(c);
+    }
+  }
+}
+
+/*
+ * Пока есть хвост — ждём только EPOLLOUT: клиент, который не читает ответы,
+ * не может завалить сервер новыми командами. Соединение в READ WAIT следим
+ * только на обрыв: его следующие команды подождут в сокете до ответа.
+ */
+static uint32_t conn_interest(const conn_t *c)
+{
+  if (conn_pending(c))
+    return EPOLLOUT;
+  if (c->waiting)
+    return EPOLLRDHUP;
+  return EPOLLIN;
+}
+
+// Закрывает мёртвое соединение или приводит подписку к его состоянию
+static void conn_rearm(worker_t *w, conn_t *c)
+{
+  if (c->dead)
+  {
+    conn_close(c);
+    return;
+  }
+  uint32_t want = conn_interest(c);
+  if (want == c->events)
+    return;
+  struct epoll_event mod = {.events = want, .data.ptr = c};
+  if (epoll_ctl(w->epfd, EPOLL_CTL_MOD, c->fd, &mod) == -1)
+  {
+    perror("epoll_ctl (mod)");
+    conn_close(c);
+    return;
+  }
+  c->events = want;
+}
+
+static void *worker_thread(void *arg)
+{
+  worker_t *w = arg;
+  struct epoll_event events[MAX_EVENTS];
+  stats_t st;
+
+  stats_attach(&st);
+  for (;;)
+  {
+    int n = epoll_wait(w->epfd, events, MAX_EVENTS, park_timeout_ms(w));
+    if (n == -1)
+    {
+      if (errno == EINTR)
+        continue;
+      perror("epoll_wait");
+      break;
+    }
+
+    int woke = 0;
+    for (int i = 0; i < n; i++)
+    {
+      conn_t *c = events[i].data.ptr;
+      if (!c)
+      {
+        accept_clients(w);
+        continue;
+      }
+      if (events[i].data.ptr == &wake_tag)
+      {
+        eventfd_t v;
+        eventfd_read(w->efd, &v);
+        woke = 1;
+        continue;
+      }
+
+      uint32_t ev = events[i].events;
+      int rc = 0;
+      if (ev & EPOLLOUT)
+      {
+        rc = conn_flush(c);
+        if (rc == 0 && !conn_pending(c))
+          conn_process(c);      // команды, отложенные до отправки хвоста
+      }
+      if (rc == 0 && (ev & EPOLLIN))
+        rc = conn_read(c);
+      else if (rc == 0 && (ev & (EPOLLHUP | EPOLLERR | EPOLLRDHUP)))
+        rc = -1;
+      if (rc == -1)
+        c->dead = 1;
+      conn_rearm(w, c);
+    }
+
+    // Парковка обслуживается после пачки событий: здесь соединения могут
+    // закрыться, а в events ещё могли оставаться указатели на них
+    if (w->parked)
+      serve_parked(w, woke);
+  }
+  return NULL;
+}
+
+static void *client_thread(void *arg)
+{
+  conn_t *c = arg;
+  stats_t st;
+
+  stats_attach(&st);
+  for (;;)
+  {
+    ssize_t n = recv(c->fd, c->in + c->in_len, CONN_INBUF - c->in_len, 0);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      break;
+    c->in_len += (size_t)n;
+    stat_add(STAT_BYTES_IN, (uint64_t)n);
+    conn_process(c);
+    if (c->dead)
+      break;
+  }
+
+  conn_close(c);
+  batch_release();
+  stats_detach(&st);
+  return NULL;
+}
+
+static store_t *store_alloc(void)
+{
+  store_t *st = malloc(sizeof(*st));
+  if (!st)
+    return NULL;
+  st->fd = memfd_create("resmgr-dev", MFD_CLOEXEC);
+  if (st->fd == -1)
+  {
+    free(st);
+    return NULL;
+  }
+  // Файл разреженный: память под страницу выделяется, только когда в неё пишут
+  st->map = MAP_FAILED;
+  if (ftruncate(st->fd, (off_t)opt_dev_size) == 0)
+    st->map = mmap(NULL, opt_dev_size, PROT_READ | PROT_WRITE, MAP_SHARED, st->fd, 0);
+  if (st->map == MAP_FAILED)
+  {
+    close(st->fd);
+    free(st);
+    return NULL;
+  }
+  atomic_init(&st->refs, 1);
+  return st;
+}
+
+static void store_put(store_t *st)
+{
+  if (st && atomic_fetch_sub_explicit(&st->refs, 1, memory_order_acq_rel) == 1)
+  {
+    munmap(st->map, opt_dev_size);
+    close(st->fd);
+    free(st);
+  }
+}
+
+/*
+ * Берёт ссылку на текущее хранилище и его размер, если права не равны
+ * denied_perm. *denied = 1 — доступа нет; NULL при *denied == 0 — устройство
+ * пустое.
+ */
+static store_t *store_get(device_t *d, int denied_perm, int *denied, size_t *size)
+{
+  lock_rd(&d->lock);
+  *denied = d->permissions == denied_perm;
+  store_t *st = *denied ? NULL : d->st;
+  *size = st ? d->size : 0;
+  if (st)
+    atomic_fetch_add_explicit(&st->refs, 1, memory_order_relaxed);
+  pthread_rwlock_unlock(&d->lock);
+  return st;
+}
+
+// Публикует новый размер, а если хранилище сменилось — и его; под write_lock
+static void store_publish(device_t *d, store_t *st, size_t size)
+{
+  store_t *old = NULL;
+  lock_wr(&d->lock);
+  if (d->st != st)
+  {
+    old = d->st;
+    if (st)
+      atomic_fetch_add_explicit(&st->refs, 1, memory_order_relaxed);
+    d->st = st;
+  }
+  d->size = size;
+  pthread_rwlock_unlock(&d->lock);
+  store_put(old);
+}
+
+static int64_t now_ns(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// FNV-1a
+static unsigned dev_hash_name(const char *name, size_t len)
+{
+  uint32_t h = 2166136261u;
+  for (size_t i = 0; i < len; i++)
+    h = (h ^ (unsigned char)name[i]) * 16777619u;
+  return h & (DEV_HASH_SIZE - 1);
+}
+
+static device_t *device_lookup(const char *name, size_t len)
+{
+  for (device_t *d = dev_hash[dev_hash_name(name, len)]; d; d = d->hnext)
+    if (strlen(d->name) == len && memcmp(d->name, name, len) == 0)
+      return d;
+  return NULL;
+}
+
+static int devices_init(void)
+{
+  devices = calloc((size_t)opt_devices, sizeof(device_t));
+  if (!devices)
+  {
+    perror("calloc (devices)");
+    return -1;
+  }
+
+  // Дедлайны READ WAIT считаются по CLOCK_MONOTONIC — так же ждём и в -T
+  pthread_condattr_t ca;
+  pthread_condattr_init(&ca);
+  pthread_condattr_setclock(&ca, CLOCK_MONOTONIC);
+
+  for (int i = 0; i < opt_devices; i++)
+  {
+    device_t *d = &devices[i];
+    snprintf(d->name, sizeof(d->name), "/dev%d", i);
+    d->permissions = PERM_RW;
+    pthread_rwlock_init(&d->lock, NULL);
+    pthread_mutex_init(&d->write_lock, NULL);
+    pthread_mutex_init(&d->wait_lock, NULL);
+    pthread_cond_init(&d->wait_cond, &ca);
+    if (opt_ring)
+    {
+      d->ring = malloc(opt_ring);
+      if (!d->ring)
+      {
+        perror("malloc (ring)");
+        return -1;
+      }
+      d->ring_cap = opt_ring;
+    }
+    unsigned h = dev_hash_name(d->name, strlen(d->name));
+    d->hnext = dev_hash[h];
+    dev_hash[h] = d;
+  }
+  pthread_condattr_destroy(&ca);
+  return 0;
+}
+
+// Смещение самого старого байта, который ещё лежит в кольце; под d->lock
+static uint64_t ring_tail(const device_t *d)
+{
+  uint64_t lost = d->ring_head > d->ring_cap ? d->ring_head - d->ring_cap : 0;
+  return lost > d->ring_clear ? lost : d->ring_clear;
+}
+
+/*
+ * Находит устройство среди уже открытых соединением, при первом обращении
+ * открывает: отмечает устройство занятым, а курсор кольца ставит на самые
+ * старые сохранившиеся данные.
+ */
+static conn_dev_t *conn_attach(conn_t *c, device_t *d)
+{
+  for (int i = 0; i < c->n_devs; i++)
+    if (c->devs[i].dev == d)
+      return &c->devs[i];
+
+  conn_dev_t *devs = realloc(c->devs, (size_t)(c->n_devs + 1) * sizeof(*devs));
+  if (!devs)
+    return NULL;
+  c->devs = devs;
+  conn_dev_t *cd = &devs[c->n_devs++];
+  cd->dev = d;
+
+  lock_wr(&d->lock);
+  d->clients++;
+  d->flags |= DEV_OPEN | DEV_BUSY;
+  cd->cursor = ring_tail(d);
+  pthread_rwlock_unlock(&d->lock);
+  return cd;
+}
+
+// Дописывает в кольцо, затирая самое старое; под d->lock (wr)
+static void ring_append(device_t *d, const char *data, size_t len)
+{
+  if (len > d->ring_cap)
+  {
+    d->ring_head += len - d->ring_cap;
+    data += len - d->ring_cap;
+    len = d->ring_cap;
+  }
+  size_t pos = (size_t)(d->ring_head % d->ring_cap);
+  size_t first = len < d->ring_cap - pos ? len : d->ring_cap - pos;
+  memcpy(d->ring + pos, data, first);
+  memcpy(d->ring, data + first, len - first);
+  d->ring_head += len;
+}
+
+static void park_add(conn_t *c)
+{
+  worker_t *w = c->w;
+  c->waiting = 1;
+  c->wait_prev = NULL;
+  c->wait_next = w->parked;
+  if (w->parked)
+    w->parked->wait_prev = c;
+  w->parked = c;
+  if (c->wait_deadline)
+    w->n_timed++;
+  atomic_fetch_add(&w->n_parked, 1);
+}
+
+static void park_remove(conn_t *c)
+{
+  worker_t *w = c->w;
+  if (c->wait_prev)
+    c->wait_prev->wait_next = c->wait_next;
+  else
+    w->parked = c->wait_next;
+  if (c->wait_next)
+    c->wait_next->wait_prev = c->wait_prev;
+  if (c->wait_deadline)
+    w->n_timed--;
+  atomic_fetch_sub(&w->n_parked, 1);
+  c->waiting = 0;
+}
+
+/*
+ * Будит всех, кто ждёт новых данных. Вызывается после отпускания d->lock:
+ * ожидающий паркуется (n_parked++) под rdlock, поэтому писатель, не
+ * увидевший его здесь, не мог и дописать данные до проверки в ring_read.
+ */
+static void ring_notify(device_t *d)
+{
+  if (opt_thread_per_client)
+  {
+    lock_mutex(&d->wait_lock);
+    pthread_cond_broadcast(&d->wait_cond);
+    pthread_mutex_unlock(&d->wait_lock);
+    return;
+  }
+  for (int i = 0; i < opt_workers; i++)
+    if (atomic_load(&workers[i].n_parked) > 0)
+      eventfd_write(workers[i].efd, 1);
+}
+
+/*
+ * Отправляет клиенту всё, что записано после его курсора, и сдвигает курсор.
+ * framed — ответ READ WAIT: "DATA <n>[ LOST <m>]\n" перед данными; в
+ * обычном READ о потере говорит строка "<lost m bytes>\n". Если новых данных
+ * нет, ничего не отправляет и возвращает 1, а при park ещё и паркует
+ * соединение — под той же блокировкой, чтобы не пропустить ring_notify().
+ */
+static int ring_read(conn_t *c, conn_dev_t *cd, int framed, int park)
+{
+  device_t *d = cd->dev;
+  char hdr[64];
+
+  lock_rd(&d->lock);
+  if (d->permissions == PERM_WO)
+  {
+    pthread_rwlock_unlock(&d->lock);
+    conn_error(c, "Permission denied\n");
+    return 0;
+  }
+  uint64_t tail = ring_tail(d);
+  uint64_t lost = 0;
+  if (cd->cursor < tail)
+  {
+    // Всё, что стёрто CLEAR, клиент просто пропускает; потерей считаем
+    // только затёртое новыми записями
+    uint64_t from = cd->cursor > d->ring_clear ? cd->cursor : d->ring_clear;
+    lost = tail - from;
+    cd->cursor = tail;
+  }
+  size_t n = (size_t)(d->ring_head - cd->cursor);
+  if (n == 0 && lost == 0)
+  {
+    if (park)
+    {
+      c->wait_on = cd;
+      park_add(c);
+    }
+    pthread_rwlock_unlock(&d->lock);
+    return 1;
+  }
+  char *buf = n ? malloc(n) : NULL;
+  if (n && !buf)
+  {
+    pthread_rwlock_unlock(&d->lock);
+    conn_error(c, "Out of memory\n");
+    return 0;
+  }
+  size_t pos = (size_t)(cd->cursor % d->ring_cap);
+  size_t first = n < d->ring_cap - pos ? n : d->ring_cap - pos;
+  memcpy(buf, d->ring + pos, first);
+  memcpy(buf + first, d->ring, n - first);
+  cd->cursor = d->ring_head;
+  pthread_rwlock_unlock(&d->lock);
+
+  if (framed && lost)
+    snprintf(hdr, sizeof(hdr), "DATA %zu LOST %llu\n", n, (unsigned long long)lost);
+  else if (framed)
+    snprintf(hdr, sizeof(hdr), "DATA %zu\n", n);
+  else if (lost)
+    snprintf(hdr, sizeof(hdr), "<lost %llu bytes>\n", (unsigned long long)lost);
+  else
+    hdr[0] = '\0';
+  conn_send(c, hdr, strlen(hdr));
+  conn_send(c, buf, n);
+  free(buf);
+  return 0;
+}
+
+// -T: ждёт на условной переменной, пока после курсора не появятся данные
+static void ring_wait(conn_dev_t *cd, int64_t deadline)
+{
+  device_t *d = cd->dev;
+  struct timespec ts = {.tv_sec = deadline / 1000000000LL, .tv_nsec = deadline % 1000000000LL};
+
+  lock_mutex(&d->wait_lock);
+  for (;;)
+  {
+    lock_rd(&d->lock);
+    uint64_t tail = ring_tail(d);
+    int ready = d->ring_head > (cd->cursor > tail ? cd->cursor : tail);
+    pthread_rwlock_unlock(&d->lock);
+    if (ready)
+      break;
+    if (!deadline)
+      pthread_cond_wait(&d->wait_cond, &d->wait_lock);
+    else if (pthread_cond_timedwait(&d->wait_cond, &d->wait_lock, &ts) == ETIMEDOUT)
+      break;
+  }
+  pthread_mutex_unlock(&d->wait_lock);
+}
+
+// Ближайший дедлайн среди припаркованных, в мс для epoll_wait; -1 — нет
+static int park_timeout_ms(const worker_t *w)
+{
+  if (w->n_timed == 0)
+    return -1;
+  int64_t nearest = INT64_MAX;
+  for (const conn_t *c = w->parked; c; c = c->wait_next)
+    if (c->wait_deadline && c->wait_deadline < nearest)
+      nearest = c->wait_deadline;
+  int64_t ms = (nearest - now_ns() + 999999) / 1000000;
+  return ms < 0 ? 0 : (int)ms;
+}
+
+/*
+ * Отвечает припаркованным соединениям: после пробуждения — всем, у кого
+ * появились данные, иначе — тем, у кого вышел таймаут ("DATA 0\n").
+ * Обслуженное соединение продолжает разбирать отложенные команды.
+ */
+static void serve_parked(worker_t *w, int woke)
+{
+  int64_t now = now_ns();
+  conn_t *next;
+
+  for (conn_t *c = w->parked; c; c = next)
+  {
+    next = c->wait_next;
+    int expired = c->wait_deadline && now >= c->wait_deadline;
+    if (!woke && !expired)
+      continue;
+    park_remove(c);
+    batch_begin(c);
+    if (c->wait_bin)
+      resp_begin(c, &c->wait_hdr);
+    // Данных нет (например, их успели стереть CLEAR) — паркуемся снова;
+    // снова добавленное соединение встаёт в голову списка и в этот проход
+    // не попадает
+    if (ring_read(c, c->wait_on, 1, !expired) == 1 && !c->waiting)
+      conn_send(c, "DATA 0\n", 7);
+    if (c->wait_bin && c->waiting)
+    {
+      resp_cancel();
+    }
+    else if (c->wait_bin)
+    {
+      resp_end();
+      c->wait_bin = 0;
+    }
+    batch_end(c);
+    if (c->waiting)
+      continue;
+    cmd_failed = 0;
+    stats_record(CMD_READ_WAIT, c->wait_start);
+    conn_process(c);
+    conn_rearm(w, c);
+  }
+}
+
+/*
+ * Команда может начинаться с имени устройства: "/dev3 WRITE abc". Без
+ * префикса — /dev0, как когда устройство было одно.
+ */
+static void dispatch_command(conn_t *c, const char *cmd)
+{
+  device_t *d = &devices[0];
+  if (strcmp(cmd, "STATS\n") == 0)
+  {
+    char buf[2048];
+    conn_send(c, buf, stats_format(buf, sizeof(buf)));
+    return;
+  }
+  if (cmd[0] == '/')
+  {
+    size_t len = strcspn(cmd, " \n");
+    d = device_lookup(cmd, len);
+    if (!d)
+    {
+      conn_error(c, "Unknown device\n");
+      return;
+    }
+    cmd += len;
+    if (*cmd == ' ')
+      cmd++;
+  }
+  conn_dev_t *cd = conn_attach(c, d);
+  if (!cd)
+  {
+    conn_error(c, "Out of memory\n");
+    return;
+  }
+  handle_command(c, cd, cmd);
+}
+
+/*
+ * WRITE: данные не разбираются, поэтому двоичный кадр может нести любые
+ * байты, включая '\n' и '\0'.
+ */
+static void dev_write(conn_t *c, device_t *d, const char *data, size_t len)
+{
+    char resp[64];
+    size_t size;
+    int denied;
+
+    if (d->ring) {
+        lock_wr(&d->lock);
+        denied = d->permissions == PERM_RO;
+        if (!denied)
+            ring_append(d, data, len);
+        pthread_rwlock_unlock(&d->lock);
+        if (denied) {
+            conn_error(c, "Permission denied\n");
+            return;
+        }
+        ring_notify(d);
+        snprintf(resp, sizeof(resp), "OK, %zu bytes written\n", len);
+        conn_send(c, resp, strlen(resp));
+        return;
+    }
+
+    lock_mutex(&d->write_lock);
+    store_t *st = store_get(d, PERM_RO, &denied, &size);  // проверка на право записи
+    if (denied) {
+        pthread_mutex_unlock(&d->write_lock);
+        conn_error(c, "Permission denied\n");
+        return;
+    }
+    if (len + size > opt_dev_size) len = opt_dev_size - size;
+    if (len > 0) {
+        if (!st && !(st = store_alloc())) {
+            pthread_mutex_unlock(&d->write_lock);
+            conn_error(c, "Out of memory\n");
+            return;
+        }
+        // Пишем за концом: байты [0, size), которые сейчас отправляют
+        // читатели, не меняются
+        memcpy(st->map + size, data, len);
+        store_publish(d, st, size + len);
+    }
+    pthread_mutex_unlock(&d->write_lock);
+    store_put(st);
+    snprintf(resp, sizeof(resp), "OK, %zu bytes written\n", len);
+    conn_send(c, resp, strlen(resp));
+}
+
+static void handle_command(conn_t *c, conn_dev_t *cd, const char *cmd)
+{
+    device_t *d = cd->dev;
+    char resp[1024];
+    int denied;
+    size_t size;
+
+    // READ WAIT [мс] — длинный опрос кольца
+    if (strncmp(cmd, "READ WAIT", 9) == 0) {
+        if (!d->ring) {
+            conn_error(c, "Not a ring device\n");
+            return;
+        }
+        long ms = atol(cmd + 9);
+        c->wait_deadline = ms > 0 ? now_ns() + ms * 1000000LL : 0;
+        if (!c->w) {
+            batch_flush_before(c);  // ответы на предыдущие команды не ждут данных
+            ring_wait(cd, c->wait_deadline);
+            if (ring_read(c, cd, 1, 0) == 1)
+                conn_send(c, "DATA 0\n", 7);
+            return;
+        }
+        ring_read(c, cd, 1, 1);  // нет данных — ответит serve_parked
+        return;
+    }
+
+    if (strcmp(cmd, "READFD\n") == 0) {
+        if (d->ring) {
+            conn_error(c, "Not supported on ring device\n");
+            return;
+        }
+        store_t *st = store_get(d, PERM_WO, &denied, &size);
+        if (denied) {
+            conn_error(c, "Permission denied\n");
+            return;
+        }
+        conn_send_fd(c, st, size);
+        store_put(st);
+        return;
+    }
+
+    // Игнорируем аргументы для READ, всегда читаем весь буфер
+    if (strncmp(cmd, "READ", 4) == 0) {
+        if (d->ring) {
+            if (ring_read(c, cd, 0, 0) == 1)
+                conn_send(c, "<buffer empty>\n", 15);
+            return;
+        }
+        store_t *st = store_get(d, PERM_WO, &denied, &size);  // проверка на право чтения
+        if (denied) {
+            conn_error(c, "Permission denied\n");
+            return;
+        }
+        // Блокировка уже отпущена: [0, size) не изменится, пока мы держим ссылку
+        if (size > 0) {
+            conn_send_store(c, st, size);
+        } else {
+            conn_send(c, "<buffer empty>\n", 15);
+        }
+        store_put(st);
+        return;
+    }
+
+    if (strncmp(cmd, "WRITE ", 6) == 0) {
+        dev_write(c, d, cmd + 6, strlen(cmd + 6));
+        return;
+    }
+
+    if (strcmp(cmd, "INFO\n") == 0) {
+        lock_rd(&d->lock);
+        if (d->ring)
+            snprintf(resp, sizeof(resp), "Size=%zu, Flags=%d, Permissions=%d, Capacity=%zu, Written=%llu\n",
+                     (size_t)(d->ring_head - ring_tail(d)), d->flags, d->permissions,
+                     d->ring_cap, (unsigned long long)d->ring_head);
+        else
+            snprintf(resp, sizeof(resp), "Size=%zu, Flags=%d, Permissions=%d\n",
+                     d->size, d->flags, d->permissions);
+        pthread_rwlock_unlock(&d->lock);
+        conn_send(c, resp, strlen(resp));
+        return;
+    }
+
+    if (strcmp(cmd, "CLEAR\n") == 0) {
+        lock_mutex(&d->write_lock);
+        lock_rd(&d->lock);
+        denied = d->permissions == PERM_RO;  // нельзя очищать если только чтение
+        pthread_rwlock_unlock(&d->lock);
+        if (!denied && d->ring) {
+            lock_wr(&d->lock);
+            d->ring_clear = d->ring_head;
+            pthread_rwlock_unlock(&d->lock);
+        } else if (!denied) {
+            store_publish(d, NULL, 0);
+        }
+        pthread_mutex_unlock(&d->write_lock);
+        if (denied) {
+            conn_error(c, "Permission denied\n");
+            return;
+        }
+        conn_send(c, "Buffer cleared\n", 15);
+        return;
+    }
+
+    if (strncmp(cmd, "SETPERM ", 8) == 0) {
+        int perm;
+        if (strncmp(cmd + 8, "rw", 2) == 0) perm = PERM_RW;
+        else if (strncmp(cmd + 8, "ro", 2) == 0) perm = PERM_RO;
+        else if (strncmp(cmd + 8, "wo", 2) == 0) perm = PERM_WO;
+        else {
+            conn_error(c, "Unknown permission\n");
+            return;
+        }
+        lock_wr(&d->lock);
+        d->permissions = perm;
+        pthread_rwlock_unlock(&d->lock);
+        conn_send(c, "Permission set\n", 15);
+        return;
+    }
+
+    conn_error(c, "Unknown command\n");
+}
+
+// "64K", "16M" или просто число байт; 0 — ошибка
+static size_t parse_size(const char *arg)
+{
+  char *end;
+  unsigned long long v = strtoull(arg, &end, 10);
+  if (*end == 'K' || *end == 'k')
+    v <<= 10, end++;
+  else if (*end == 'M' || *end == 'm')
+    v <<= 20, end++;
+  return *end == '\0' ? (size_t)v : 0;
+}
+
+static void options(int argc, char *argv[])
+{
+  int opt;
+  optv = 0;
+  while ((opt = getopt(argc, argv, "vt:TR:D:S:CP:L:")) != -1)
+  {
+    switch (opt)
+    {
+    case 'v':
+      optv++;
+      break;
+    case 't':
+      opt_workers = atoi(optarg);
+      if (opt_workers < 1 || opt_workers > MAX_WORKERS)
+      {
+        fprintf(stderr, "%s: -t 1..%d\n", progname, MAX_WORKERS);
+        exit(EXIT_FAILURE);
+      }
+      break;
+    case 'T':
+      opt_thread_per_client = 1;
+      break;
+    case 'D':
+      opt_devices = atoi(optarg);
+      if (opt_devices < 1 || opt_devices > MAX_DEVICES)
+      {
+        fprintf(stderr, "%s: -D 1..%d\n", progname, MAX_DEVICES);
+        exit(EXIT_FAILURE);
+      }
+      break;
+    case 'S':
+      opt_dev_size = parse_size(optarg);
+      if (opt_dev_size == 0)
+      {
+        fprintf(stderr, "%s: -S capacity in bytes (K, M suffixes)\n", progname);
+        exit(EXIT_FAILURE);
+      }
+      break;
+    case 'C':
+      opt_copy_read = 1;
+      break;
+    case 'P':
+      opt_stats_period = atoi(optarg);
+      break;
+    case 'L':
+      opt_lat_sample = atoi(optarg);
+      if (opt_lat_sample < 1)
+      {
+        fprintf(stderr, "%s: -L 1 (every command) or more\n", progname);
+        exit(EXIT_FAILURE);
+      }
+      break;
+    case 'R':
+      opt_ring = parse_size(optarg);
+      if (opt_ring == 0)
+      {
+        fprintf(stderr, "%s: -R capacity in bytes\n", progname);
+        exit(EXIT_FAILURE);
+      }
+      break;
+    }
+  }
+}
+
+// Десять тысяч клиентов не влезают в стандартный лимит 1024 дескриптора
+static void raise_nofile_limit(void)
+{
+  struct rlimit rl;
+  if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max)
+  {
+    rl.rlim_cur = rl.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &rl);
   }
 }
 
@@ -252,6 +2090,8 @@ static void install_signals(void)
   sigemptyset(&sa.sa_mask);
   sigaction(SIGINT, &sa, NULL);
   sigaction(SIGTERM, &sa, NULL);
+  // sendfile, в отличие от send, не принимает MSG_NOSIGNAL
+  signal(SIGPIPE, SIG_IGN);
 }
 
 static void on_signal(int signo)
@@ -0,0 +1,44 @@
+#ifndef RESMGR_PROTO_H
+#define RESMGR_PROTO_H
+
+#include <stdint.h>
+
+/*
+ * Двоичный протокол resmgr
+ *
+ * Кадр — заголовок rm_hdr_t и len байт нагрузки. Первый байт RM_MAGIC не
+ * встречается в начале текстовых команд (ASCII), поэтому на одном
+ * соединении можно смешивать кадры и строки: текст остаётся для отладки
+ * через nc. Байты в порядке хоста — сокет локальный.
+ *
+ * Запросов в полёте может быть сколько угодно: ответы приходят в порядке
+ * запросов с тем же req_id, op и dev. Нагрузка ответа — тот же текст или
+ * данные, что и в текстовом протоколе; status говорит, ошибка ли это.
+ */
+
+#define RM_MAGIC 0xB7
+#define RM_MAX_PAYLOAD 1008     // кадр целиком помещается во входной буфер сервера (1 КиБ)
+
+// Коды операций
+#define RM_OP_CMD 1             // нагрузка — текстовая команда без '\n' (любая)
+#define RM_OP_READ 2
+#define RM_OP_WRITE 3           // нагрузка — записываемые байты, без разбора
+#define RM_OP_INFO 4
+#define RM_OP_CLEAR 5
+
+// Статус ответа
+#define RM_OK 0
+#define RM_ERR 1
+
+typedef struct rm_hdr
+{
+  uint8_t magic;
+  uint8_t op;
+  uint8_t status;       // в запросе 0
+  uint8_t reserved;
+  uint32_t dev;         // номер устройства: /dev<dev> (для RM_OP_CMD не используется)
+  uint32_t req_id;
+  uint32_t len;
+} rm_hdr_t;
+
+#endif // RESMGR_PROTO_H
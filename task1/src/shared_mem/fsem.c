@@ -0,0 +1,108 @@
+#define _GNU_SOURCE
+#include "fsem.h"
+#include <errno.h>
+#include <limits.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+static void futex_wait(void *addr, unsigned val)
+{
+  syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, val, NULL, NULL, 0);
+}
+
+static void futex_wake(void *addr, int n)
+{
+  syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, n, NULL, NULL, 0);
+}
+
+int fsem_init(fsem *s, unsigned value, int fifo)
+{
+  if (value > INT_MAX) {
+    errno = EINVAL;
+    return -1;
+  }
+  s->fifo = fifo;
+  atomic_init(&s->count, (int)value);
+  atomic_init(&s->waiters, 0);
+  atomic_init(&s->head, value);
+  atomic_init(&s->tail, 0);
+  for (int i = 0; i < FSEM_SLOTS; i++)
+    atomic_init(&s->slot[i], 0);
+  return 0;
+}
+
+int fsem_trywait(fsem *s)
+{
+  if (s->fifo) {
+    unsigned t = atomic_load_explicit(&s->tail, memory_order_relaxed);
+    do {
+      if ((int)(atomic_load_explicit(&s->head, memory_order_acquire) - t) <= 0)
+        return -1;
+    } while (!atomic_compare_exchange_weak_explicit(&s->tail, &t, t + 1,
+                                                    memory_order_acquire, memory_order_relaxed));
+    return 0;
+  }
+  int c = atomic_load_explicit(&s->count, memory_order_relaxed);
+  while (c > 0)
+    if (atomic_compare_exchange_weak_explicit(&s->count, &c, c - 1,
+                                              memory_order_acquire, memory_order_relaxed))
+      return 0;
+  return -1;
+}
+
+static void fifo_wait(fsem *s)
+{
+  unsigned t = atomic_fetch_add_explicit(&s->tail, 1, memory_order_relaxed);
+  atomic_uint *slot = &s->slot[t % FSEM_SLOTS];
+  for (;;) {
+    // Слово слота читается до проверки head: post сначала двигает head,
+    // потом меняет слово, так что пропустить пробуждение нельзя
+    unsigned seq = atomic_load(slot);
+    if ((int)(atomic_load(&s->head) - t) > 0)
+      return;
+    atomic_fetch_add(&s->waiters, 1);
+    if ((int)(atomic_load(&s->head) - t) <= 0)
+      futex_wait(slot, seq);
+    atomic_fetch_sub(&s->waiters, 1);
+  }
+}
+
+void fsem_wait(fsem *s)
+{
+  if (s->fifo) {
+    fifo_wait(s);
+    return;
+  }
+  for (;;) {
+    if (fsem_trywait(s) == 0)
+      return;
+    atomic_fetch_add(&s->waiters, 1);
+    // Уснуть, только если единиц всё ещё нет: post меняет count до того,
+    // как смотрит на waiters, и futex_wait сверит значение сам
+    futex_wait(&s->count, 0);
+    atomic_fetch_sub(&s->waiters, 1);
+  }
+}
+
+void fsem_post(fsem *s, unsigned n)
+{
+  if (n == 0)
+    return;
+  if (s->fifo) {
+    unsigned h = atomic_fetch_add(&s->head, n);
+    if (atomic_load(&s->waiters) == 0)
+      return;
+    // Будим слоты выданных билетов h .. h+n-1; больше FSEM_SLOTS — все слоты
+    unsigned k = n < FSEM_SLOTS ? n : FSEM_SLOTS;
+    for (unsigned i = 0; i < k; i++) {
+      atomic_uint *slot = &s->slot[(h + i) % FSEM_SLOTS];
+      atomic_fetch_add(slot, 1);
+      futex_wake(slot, INT_MAX);
+    }
+    return;
+  }
+  atomic_fetch_add(&s->count, (int)n);
+  if (atomic_load(&s->waiters))
+    futex_wake(&s->count, n > INT_MAX ? INT_MAX : (int)n);
+}
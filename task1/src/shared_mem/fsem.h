@@ -0,0 +1,38 @@
+#ifndef FSEM_H
+#define FSEM_H
+
+#include <stdatomic.h>
+
+/*
+ * Счётный семафор на futex.
+ *
+ * Быстрый путь целиком в пространстве пользователя: wait — CAS счётчика,
+ * post — atomic add, и системный вызов нужен, только если кто-то уже спит.
+ * post(n) выдаёт n единиц одной операцией и будит не больше n потоков.
+ *
+ * В режиме fifo единицы выдаются строго в порядке прихода: wait берёт
+ * билет (tail), post сдвигает границу выданных билетов (head), и поток
+ * проходит, когда его билет оказывается за ней. Спящие распределены по
+ * FSEM_SLOTS словам futex по номеру билета, поэтому post будит только
+ * владельцев выданных билетов, а не всех ждущих.
+ */
+
+#define FSEM_SLOTS 64
+
+typedef struct fsem {
+  int fifo;
+  // Обычный режим: свободные единицы
+  _Alignas(64) atomic_int count;
+  atomic_uint waiters;
+  // Режим fifo: выданные (head) и взятые (tail) билеты
+  _Alignas(64) atomic_uint head;
+  _Alignas(64) atomic_uint tail;
+  atomic_uint slot[FSEM_SLOTS];     // слово futex для билетов t % FSEM_SLOTS
+} fsem;
+
+int fsem_init(fsem *s, unsigned value, int fifo);
+void fsem_wait(fsem *s);
+int fsem_trywait(fsem *s);          // 0 — единица получена, -1 — нет свободных
+void fsem_post(fsem *s, unsigned n);
+
+#endif // FSEM_H
@@ -0,0 +1,240 @@
+#define _GNU_SOURCE
+#include "fsm.h"
+#include <errno.h>
+#include <linux/futex.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+const char *const fsm_wait_names[FSM_NWAIT] = { "broadcast", "cond", "futex", "eventfd" };
+
+// Данные потока состояния; счётчики пишет только он сам
+typedef struct fsm_slot {
+  fsm *m;
+  int self;
+  pthread_t tid;
+  pthread_cond_t cond;          // FSM_COND
+  atomic_uint seq;              // FSM_FUTEX: меняется при каждом переходе в это состояние
+  int efd;                      // FSM_EVENTFD
+  unsigned long transitions;
+  unsigned long wakeups;
+  unsigned long wasted;
+} __attribute__((aligned(64))) fsm_slot;
+
+struct fsm {
+  const fsm_state *table;
+  int n;
+  enum fsm_wait wait;
+  atomic_int state;
+  atomic_int stop;
+  int started;
+  pthread_mutex_t mutex;        // FSM_BROADCAST и FSM_COND
+  pthread_cond_t cond;          // FSM_BROADCAST
+  fsm_slot *slots;
+};
+
+static void futex_wait(atomic_uint *addr, unsigned val)
+{
+  syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, val, NULL, NULL, 0);
+}
+
+static void futex_wake(atomic_uint *addr, int n)
+{
+  syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, n, NULL, NULL, 0);
+}
+
+static int running(fsm *m)
+{
+  return !atomic_load_explicit(&m->stop, memory_order_relaxed);
+}
+
+// Ждать, пока машина не придёт в состояние slot->self. 0 — пришла, -1 — остановка.
+// Для condvar-режимов возвращается с захваченным mutex.
+static int wait_turn(fsm_slot *s)
+{
+  fsm *m = s->m;
+  switch (m->wait) {
+  case FSM_BROADCAST:
+  case FSM_COND:
+    pthread_mutex_lock(&m->mutex);
+    while (atomic_load_explicit(&m->state, memory_order_relaxed) != s->self && running(m)) {
+      pthread_cond_wait(m->wait == FSM_COND ? &s->cond : &m->cond, &m->mutex);
+      s->wakeups++;
+      if (atomic_load_explicit(&m->state, memory_order_relaxed) != s->self)
+        s->wasted++;
+    }
+    break;
+  case FSM_FUTEX:
+    for (;;) {
+      // seq читается до проверки состояния: переход меняет state, потом seq,
+      // поэтому futex_wait со старым seq не уснёт после нашего перехода
+      unsigned seq = atomic_load(&s->seq);
+      if (atomic_load(&m->state) == s->self || !running(m))
+        break;
+      futex_wait(&s->seq, seq);
+      s->wakeups++;
+      if (atomic_load(&m->state) != s->self)
+        s->wasted++;
+    }
+    break;
+  case FSM_EVENTFD:
+    while (atomic_load(&m->state) != s->self && running(m)) {
+      eventfd_t v;
+      eventfd_read(s->efd, &v);
+      s->wakeups++;
+      if (atomic_load(&m->state) != s->self)
+        s->wasted++;
+    }
+    break;
+  default:
+    break;
+  }
+  if (!running(m)) {
+    if (m->wait == FSM_BROADCAST || m->wait == FSM_COND)
+      pthread_mutex_unlock(&m->mutex);
+    return -1;
+  }
+  return 0;
+}
+
+// Будит поток состояния to
+static void wake(fsm *m, int to)
+{
+  fsm_slot *t = &m->slots[to];
+  switch (m->wait) {
+  case FSM_BROADCAST:
+    pthread_cond_broadcast(&m->cond);
+    break;
+  case FSM_COND:
+    pthread_cond_signal(&t->cond);
+    break;
+  case FSM_FUTEX:
+    atomic_fetch_add(&t->seq, 1);
+    futex_wake(&t->seq, 1);
+    break;
+  case FSM_EVENTFD:
+    eventfd_write(t->efd, 1);
+    break;
+  default:
+    break;
+  }
+}
+
+// Переход: сменить состояние и разбудить его поток
+static void transit(fsm_slot *s, int next)
+{
+  fsm *m = s->m;
+  atomic_store(&m->state, next);
+  wake(m, next);
+  if (m->wait == FSM_BROADCAST || m->wait == FSM_COND)
+    pthread_mutex_unlock(&m->mutex);
+}
+
+static void *state_thread(void *arg)
+{
+  fsm_slot *s = arg;
+  fsm *m = s->m;
+  while (wait_turn(s) == 0) {
+    const fsm_state *st = &m->table[s->self];
+    int next = st->action(s->self, st->arg);
+    s->transitions++;
+    transit(s, next);
+  }
+  return NULL;
+}
+
+fsm *fsm_create(const fsm_state *table, int n, enum fsm_wait wait)
+{
+  if (n < 2 || wait < 0 || wait >= FSM_NWAIT) {
+    errno = EINVAL;
+    return NULL;
+  }
+  fsm *m = calloc(1, sizeof(*m));
+  if (!m)
+    return NULL;
+  m->slots = aligned_alloc(64, (size_t)n * sizeof(fsm_slot));
+  if (!m->slots) {
+    free(m);
+    return NULL;
+  }
+  m->table = table;
+  m->n = n;
+  m->wait = wait;
+  pthread_mutex_init(&m->mutex, NULL);
+  pthread_cond_init(&m->cond, NULL);
+  for (int i = 0; i < n; i++) {
+    fsm_slot *s = &m->slots[i];
+    s->m = m;
+    s->self = i;
+    pthread_cond_init(&s->cond, NULL);
+    atomic_init(&s->seq, 0);
+    s->efd = -1;
+    s->transitions = s->wakeups = s->wasted = 0;
+    if (wait == FSM_EVENTFD && (s->efd = eventfd(0, EFD_CLOEXEC)) < 0) {
+      int e = errno;
+      m->n = i;
+      fsm_destroy(m);
+      errno = e;
+      return NULL;
+    }
+  }
+  return m;
+}
+
+int fsm_start(fsm *m, int initial)
+{
+  atomic_store(&m->state, initial);
+  atomic_store(&m->stop, 0);
+  for (m->started = 0; m->started < m->n; m->started++) {
+    int rc = pthread_create(&m->slots[m->started].tid, NULL, state_thread, &m->slots[m->started]);
+    if (rc != 0) {
+      fsm_stop(m, NULL);
+      errno = rc;
+      return -1;
+    }
+  }
+  return 0;
+}
+
+void fsm_stop(fsm *m, fsm_stats *st)
+{
+  // Разбудить всех: каждый увидит stop и выйдет. stop ставится под mutex,
+  // иначе condvar-поток может проверить его и уснуть уже после broadcast
+  pthread_mutex_lock(&m->mutex);
+  atomic_store(&m->stop, 1);
+  pthread_cond_broadcast(&m->cond);
+  for (int i = 0; i < m->n; i++)
+    pthread_cond_signal(&m->slots[i].cond);
+  pthread_mutex_unlock(&m->mutex);
+  if (m->wait == FSM_FUTEX || m->wait == FSM_EVENTFD)
+    for (int i = 0; i < m->n; i++)
+      wake(m, i);
+
+  fsm_stats sum = { 0, 0, 0 };
+  for (int i = 0; i < m->started; i++) {
+    fsm_slot *s = &m->slots[i];
+    pthread_join(s->tid, NULL);
+    sum.transitions += s->transitions;
+    sum.wakeups += s->wakeups;
+    sum.wasted += s->wasted;
+  }
+  m->started = 0;
+  if (st)
+    *st = sum;
+}
+
+void fsm_destroy(fsm *m)
+{
+  for (int i = 0; i < m->n; i++) {
+    pthread_cond_destroy(&m->slots[i].cond);
+    if (m->slots[i].efd >= 0)
+      close(m->slots[i].efd);
+  }
+  pthread_cond_destroy(&m->cond);
+  pthread_mutex_destroy(&m->mutex);
+  free(m->slots);
+  free(m);
+}
@@ -0,0 +1,50 @@
+#ifndef FSM_H
+#define FSM_H
+
+/*
+ * Машина состояний "поток на состояние", как в condvar.c, но на N состояний
+ * из таблицы. Поток состояния ждёт, пока машина придёт в его состояние,
+ * выполняет action и передаёт управление состоянию, которое она вернула.
+ *
+ * condvar.c будит всех через pthread_cond_broadcast на общей условной
+ * переменной: при N состояниях на каждый переход N - 1 потоков просыпаются
+ * зря. Здесь у каждого состояния свой объект ожидания, и переход будит
+ * ровно один поток — поток целевого состояния. FSM_BROADCAST оставлен для
+ * сравнения.
+ */
+
+enum fsm_wait {
+  FSM_BROADCAST,    // общая condvar + broadcast (как condvar.c)
+  FSM_COND,         // своя condvar у состояния, общий mutex
+  FSM_FUTEX,        // своё слово futex у состояния, без mutex
+  FSM_EVENTFD,      // свой eventfd у состояния
+  FSM_NWAIT
+};
+
+extern const char *const fsm_wait_names[FSM_NWAIT];
+
+typedef struct fsm_state {
+  const char *name;
+  // Работа состояния; возвращает следующее состояние (не своё).
+  // Выполняется только потоком этого состояния, по одному переходу за раз.
+  int (*action)(int self, void *arg);
+  void *arg;
+} fsm_state;
+
+typedef struct fsm fsm;
+
+typedef struct fsm_stats {
+  unsigned long transitions;
+  unsigned long wakeups;        // возвраты из ожидания
+  unsigned long wasted;         // из них — когда машина не в состоянии потока
+} fsm_stats;
+
+// Таблица не копируется и должна жить до fsm_destroy. NULL и errno при ошибке
+fsm *fsm_create(const fsm_state *table, int n, enum fsm_wait wait);
+// Запустить потоки; машина стартует из состояния initial
+int fsm_start(fsm *m, int initial);
+// Остановить и дождаться потоков, счётчики — в st
+void fsm_stop(fsm *m, fsm_stats *st);
+void fsm_destroy(fsm *m);
+
+#endif // FSM_H
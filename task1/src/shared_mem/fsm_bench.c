@@ -0,0 +1,168 @@
+/*
+ *  Переходы/с и пустые пробуждения машины состояний fsm.c.
+ *
+ *  Для 4 состояний таблица - та же, что в condvar.c: 0 -> 1, 1 -> 2 или 3
+ *  по чётности счётчика, 2 -> 0, 3 -> 0. Для N состояний у каждого два
+ *  преемника: i + 1 на чётном проходе и (5i + 3) mod N на нечётном.
+ *  Действия пустые, так что меряется только передача управления.
+ *
+ *  wake/tr - пробуждений на переход, wasted/tr - из них пустых (поток
+ *  проснулся, а машина не в его состоянии).
+ *
+ *  Запуск: ./bin/fsm_bench [-m broadcast|cond|futex|eventfd] [-n 4,16,64] [-d секунд]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "fsm.h"
+
+#define MAX_STATES  1024
+
+char    *progname = "fsm_bench";
+
+typedef struct {
+    int             next[2];    // преемник на чётном и нечётном проходе
+    unsigned long   cnt;        // проходы; меняет только поток состояния
+} bench_state;
+
+static bench_state  states[MAX_STATES];
+static fsm_state    table[MAX_STATES];
+
+static int step (int self, void *arg)
+{
+    bench_state *b = arg;
+    (void)self;
+    return b->next[b->cnt++ & 1];
+}
+
+static void build_table (int n)
+{
+    static const int condvar_next[4][2] = { { 1, 1 }, { 2, 3 }, { 0, 0 }, { 0, 0 } };
+    for (int i = 0; i < n; i++) {
+        if (n == 4) {
+            states[i].next[0] = condvar_next[i][0];
+            states[i].next[1] = condvar_next[i][1];
+        } else {
+            states[i].next[0] = (i + 1) % n;
+            states[i].next[1] = (5 * i + 3) % n;
+            if (states[i].next[1] == i)
+                states[i].next[1] = (i + 1) % n;
+        }
+        states[i].cnt = 0;
+        table[i].name = NULL;
+        table[i].action = step;
+        table[i].arg = &states[i];
+    }
+}
+
+static int run (int n, enum fsm_wait wait, double seconds)
+{
+    build_table (n);
+    fsm *m = fsm_create (table, n, wait);
+    if (!m) {
+        perror ("fsm_create");
+        return -1;
+    }
+    if (fsm_start (m, 0) != 0) {
+        perror ("fsm_start");
+        fsm_destroy (m);
+        return -1;
+    }
+    struct timespec ts = { (time_t)seconds, (long)((seconds - (time_t)seconds) * 1e9) };
+    nanosleep (&ts, NULL);
+    fsm_stats st;
+    fsm_stop (m, &st);
+    fsm_destroy (m);
+
+    double tr = st.transitions ? (double)st.transitions : 1.0;
+    printf ("%-9s %6d %12.0f %10.2f %10.2f\n", fsm_wait_names[wait], n,
+            st.transitions / seconds, st.wakeups / tr, st.wasted / tr);
+    return 0;
+}
+
+int main (int argc, char *argv[])
+{
+    int     only = -1, opt;
+    double  seconds = 1.0;
+    char    ndefault[] = "4,16,64";     // strtok пишет в строку
+    char    *nlist = ndefault;
+    int     counts[64], ncounts = 0;
+
+    setvbuf (stdout, NULL, _IOLBF, 0);
+    while ((opt = getopt (argc, argv, "m:n:d:")) != -1) {
+        switch (opt) {
+        case 'm':
+            for (int i = 0; i < FSM_NWAIT; i++)
+                if (strcmp (optarg, fsm_wait_names[i]) == 0)
+                    only = i;
+            if (only < 0) {
+                fprintf (stderr, "%s: -m broadcast|cond|futex|eventfd\n", progname);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'n':
+            nlist = optarg;
+            break;
+        case 'd':
+            seconds = atof (optarg);
+            break;
+        default:
+            fprintf (stderr, "usage: %s [-m broadcast|cond|futex|eventfd] [-n 4,16,64] [-d sec]\n",
+                     progname);
+            return EXIT_FAILURE;
+        }
+    }
+    for (char *s = strtok (nlist, ","); s && ncounts < 64; s = strtok (NULL, ",")) {
+        int n = atoi (s);
+        if (n < 2 || n > MAX_STATES) {
+            fprintf (stderr, "%s: states 2..%d\n", progname, MAX_STATES);
+            return EXIT_FAILURE;
+        }
+        counts[ncounts++] = n;
+    }
+    if (seconds <= 0 || ncounts == 0) {
+        fprintf (stderr, "%s: bad -d or -n\n", progname);
+        return EXIT_FAILURE;
+    }
+
+    printf ("%-9s %6s %12s %10s %10s\n", "wait", "states", "trans/s", "wake/tr", "wasted/tr");
+    for (int k = 0; k < ncounts; k++)
+        for (int w = 0; w < FSM_NWAIT; w++)
+            if ((only < 0 || w == only) && run (counts[k], w, seconds) != 0)
+                return EXIT_FAILURE;
+    return EXIT_SUCCESS;
+}
+
+/*
+ *  Результаты (1 CPU, ./bin/fsm_bench):
+ *
+ *  wait      states      trans/s    wake/tr  wasted/tr
+ *  broadcast      4       124566       1.93       0.95
+ *  cond           4       219513       0.99       0.00
+ *  futex          4       523076       0.98       0.00
+ *  eventfd        4       461525       1.00       0.02
+ *  broadcast     16        29168       8.11       7.11
+ *  cond          16       208198       1.00       0.00
+ *  futex         16       390988       1.00       0.00
+ *  eventfd       16       458629       1.00       0.00
+ *  broadcast     64         9029      31.81      30.81
+ *  cond          64       280373       1.00       0.00
+ *  futex         64       494406       1.00       0.00
+ *  eventfd       64       488013       1.00       0.00
+ *
+ *  - broadcast (схема condvar.c) деградирует линейно: при 64 состояниях на
+ *    каждый переход ~31 пустое пробуждение, и машина в 30 раз медленнее,
+ *    чем при своём объекте ожидания у состояния. Пробуждений меньше N - 1,
+ *    потому что на одном CPU часть потоков не успевает уснуть до
+ *    следующего broadcast.
+ *  - Свой объект ожидания даёт ровно одно пробуждение на переход, и
+ *    скорость от числа состояний не зависит.
+ *  - futex и eventfd вдвое быстрее condvar: переходу не нужен общий mutex,
+ *    и разбуженный поток не борется за него с будящим.
+ *  - Редкие пустые пробуждения eventfd - остаток счётчика: поток увидел
+ *    своё состояние раньше, чем прочитал eventfd, и следующее ожидание
+ *    вернулось сразу.
+ */
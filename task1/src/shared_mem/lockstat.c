@@ -0,0 +1,429 @@
+/*
+ *  Анализ конкуренции за критическую секцию var1/var2 из mutex.c.
+ *
+ *  Каждый поток в цикле выполняет то же обновление, что update_thread в
+ *  mutex.c (проверить var1 == var2, увеличить обе), под одной из блокировок:
+ *      mutex  - pthread_mutex_t;
+ *      ticket - билетная спин-блокировка (строгий FIFO);
+ *      mcs    - очередь MCS: каждый ждущий крутится на своём узле;
+ *      atomic - без блокировки: var1 и var2 упакованы в одно 64-битное
+ *               слово и обновляются compare-and-swap.
+ *
+ *  Обёртка вокруг захвата меряет для каждого потока время ожидания
+ *  (до захвата), время удержания (от захвата до освобождения) и число
+ *  передач блокировки другому потоку (handoff: предыдущий владелец - не
+ *  этот поток). По итогам печатается пропускная способность и
+ *  справедливость: индекс Джейна по числу операций потоков (1 - поровну,
+ *  1/N - всё досталось одному) и доля самого обделённого потока
+ *  относительно самого удачливого.
+ *
+ *  Спин-блокировки после 128 холостых оборотов уступают процессор
+ *  (sched_yield): на машине, где потоков больше, чем ядер, иначе ждущий
+ *  докручивает квант, пока вытесненный владелец стоит.
+ *
+ *  Запуск: ./bin/lockstat [-l mutex|ticket|mcs|atomic] [-t 4,16,64]
+ *                         [-d секунд] [-w работа внутри] [-o работа снаружи] [-v]
+*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+
+#define SPIN_YIELD      128     // холостых оборотов до sched_yield
+#define MAX_THREADS     1024
+
+typedef struct mcs_node {
+    _Atomic(struct mcs_node *) next;
+    atomic_int  locked;
+} mcs_node;
+
+// Счётчики потока; выравнивание - чтобы потоки не делили строку кэша
+typedef struct {
+    int         id;
+    pthread_t   tid;
+    uint64_t    ops;
+    uint64_t    handoffs;
+    uint64_t    mismatch;       // var1 != var2 внутри секции - блокировка не работает
+    uint64_t    wait_ns;
+    uint64_t    wait_max_ns;
+    uint64_t    hold_ns;
+    mcs_node    node;
+} __attribute__((aligned(64))) thread_ctx;
+
+typedef struct {
+    const char  *name;
+    void        (*lock)(thread_ctx *);
+    void        (*unlock)(thread_ctx *);
+} lock_ops;
+
+char    *progname = "lockstat";
+
+// Защищаемое состояние (для mutex/ticket/mcs)
+static uint64_t var1, var2;
+static int  last_owner = -1;
+// То же для atomic: var1 - младшие 32 бита, var2 - старшие
+static _Atomic uint64_t pair;
+static atomic_int       pair_owner = -1;
+
+static int  work_inside, work_outside;
+static atomic_int   go, stop;
+
+static pthread_mutex_t  mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static struct {
+    atomic_uint next;
+    atomic_uint owner;
+} ticket __attribute__((aligned(64)));
+
+static _Atomic(mcs_node *) mcs_tail;
+
+static long long now_ns (void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void spin_work (int n)
+{
+    for (volatile int i = 0; i < n; i++)
+        ;
+}
+
+static inline void cpu_relax (unsigned *spins)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+    if (++*spins % SPIN_YIELD == 0)
+        sched_yield();
+}
+
+static void mutex_lock (thread_ctx *c)   { (void)c; pthread_mutex_lock(&mutex); }
+static void mutex_unlock (thread_ctx *c) { (void)c; pthread_mutex_unlock(&mutex); }
+
+static void ticket_lock (thread_ctx *c)
+{
+    (void)c;
+    unsigned my = atomic_fetch_add_explicit(&ticket.next, 1, memory_order_relaxed);
+    unsigned spins = 0;
+    while (atomic_load_explicit(&ticket.owner, memory_order_acquire) != my)
+        cpu_relax(&spins);
+}
+
+static void ticket_unlock (thread_ctx *c)
+{
+    (void)c;
+    // owner меняет только владелец, поэтому хватает load + store
+    unsigned o = atomic_load_explicit(&ticket.owner, memory_order_relaxed);
+    atomic_store_explicit(&ticket.owner, o + 1, memory_order_release);
+}
+
+static void mcs_lock (thread_ctx *c)
+{
+    mcs_node *me = &c->node;
+    atomic_store_explicit(&me->next, NULL, memory_order_relaxed);
+    atomic_store_explicit(&me->locked, 1, memory_order_relaxed);
+    mcs_node *prev = atomic_exchange_explicit(&mcs_tail, me, memory_order_acq_rel);
+    if (prev) {
+        atomic_store_explicit(&prev->next, me, memory_order_release);
+        unsigned spins = 0;
+        while (atomic_load_explicit(&me->locked, memory_order_acquire))
+            cpu_relax(&spins);
+    }
+}
+
+static void mcs_unlock (thread_ctx *c)
+{
+    mcs_node *me = &c->node;
+    mcs_node *next = atomic_load_explicit(&me->next, memory_order_acquire);
+    if (!next) {
+        mcs_node *expected = me;
+        if (atomic_compare_exchange_strong_explicit(&mcs_tail, &expected, NULL,
+                                                    memory_order_release, memory_order_relaxed))
+            return;
+        // Преемник уже встал в хвост, но ещё не записал себя в next
+        unsigned spins = 0;
+        while (!(next = atomic_load_explicit(&me->next, memory_order_acquire)))
+            cpu_relax(&spins);
+    }
+    atomic_store_explicit(&next->locked, 0, memory_order_release);
+}
+
+static const lock_ops locks[] = {
+    { "mutex",  mutex_lock,  mutex_unlock },
+    { "ticket", ticket_lock, ticket_unlock },
+    { "mcs",    mcs_lock,    mcs_unlock },
+    { "atomic", NULL,        NULL },
+};
+#define NLOCKS  (int)(sizeof(locks) / sizeof(locks[0]))
+
+static const lock_ops *cur;
+
+// Тело update_thread из mutex.c без printf
+static void critical_section (thread_ctx *c)
+{
+    if (var1 != var2) {
+        c->mismatch++;
+        var1 = var2;
+    }
+    spin_work(work_inside);
+    var1++;
+    var2++;
+    if (last_owner != c->id) {
+        c->handoffs++;
+        last_owner = c->id;
+    }
+}
+
+// Без блокировки: ожидание - всё время до успешного CAS, удержания нет
+static void atomic_update (thread_ctx *c)
+{
+    uint64_t old = atomic_load_explicit(&pair, memory_order_relaxed);
+    uint64_t upd;
+    do {
+        uint32_t v1 = (uint32_t)old, v2 = (uint32_t)(old >> 32);
+        if (v1 != v2) {
+            c->mismatch++;
+            v1 = v2;
+        }
+        spin_work(work_inside);
+        upd = (uint64_t)(v1 + 1) | ((uint64_t)(v2 + 1) << 32);
+    } while (!atomic_compare_exchange_weak_explicit(&pair, &old, upd,
+                                                    memory_order_acq_rel, memory_order_relaxed));
+    if (atomic_exchange_explicit(&pair_owner, c->id, memory_order_relaxed) != c->id)
+        c->handoffs++;
+}
+
+static void *update_thread (void *arg)
+{
+    thread_ctx *c = arg;
+
+    while (!atomic_load_explicit(&go, memory_order_acquire))
+        sched_yield();
+
+    while (!atomic_load_explicit(&stop, memory_order_relaxed)) {
+        long long t0 = now_ns();
+        long long t1, t2;
+        if (cur->lock) {
+            cur->lock(c);
+            t1 = now_ns();
+            critical_section(c);
+            t2 = now_ns();
+            cur->unlock(c);
+        } else {
+            atomic_update(c);
+            t1 = t2 = now_ns();
+        }
+        uint64_t w = (uint64_t)(t1 - t0);
+        c->wait_ns += w;
+        if (w > c->wait_max_ns)
+            c->wait_max_ns = w;
+        c->hold_ns += (uint64_t)(t2 - t1);
+        c->ops++;
+        spin_work(work_outside);
+    }
+    return NULL;
+}
+
+static int run (const lock_ops *lk, int nthreads, double seconds, int verbose)
+{
+    thread_ctx *ctx = aligned_alloc(64, (size_t)nthreads * sizeof(thread_ctx));
+    if (!ctx) {
+        perror("aligned_alloc");
+        return -1;
+    }
+    memset(ctx, 0, (size_t)nthreads * sizeof(thread_ctx));
+
+    cur = lk;
+    var1 = var2 = 0;
+    last_owner = -1;
+    atomic_store(&pair, 0);
+    atomic_store(&pair_owner, -1);
+    atomic_store(&go, 0);
+    atomic_store(&stop, 0);
+
+    int i;
+    for (i = 0; i < nthreads; i++) {
+        ctx[i].id = i;
+        if (pthread_create(&ctx[i].tid, NULL, update_thread, &ctx[i]) != 0) {
+            perror("pthread_create");
+            break;
+        }
+    }
+    int started = i;
+
+    long long t0 = now_ns();
+    atomic_store_explicit(&go, 1, memory_order_release);
+    struct timespec ts = { (time_t)seconds, (long)((seconds - (time_t)seconds) * 1e9) };
+    nanosleep(&ts, NULL);
+    atomic_store_explicit(&stop, 1, memory_order_relaxed);
+    for (i = 0; i < started; i++)
+        pthread_join(ctx[i].tid, NULL);
+    double elapsed = (now_ns() - t0) / 1e9;
+
+    uint64_t ops = 0, handoffs = 0, mismatch = 0, wait = 0, wait_max = 0, hold = 0;
+    uint64_t min_ops = UINT64_MAX, max_ops = 0;
+    double sq = 0.0;
+    for (i = 0; i < started; i++) {
+        thread_ctx *c = &ctx[i];
+        ops += c->ops;
+        handoffs += c->handoffs;
+        mismatch += c->mismatch;
+        wait += c->wait_ns;
+        hold += c->hold_ns;
+        if (c->wait_max_ns > wait_max)
+            wait_max = c->wait_max_ns;
+        if (c->ops < min_ops)
+            min_ops = c->ops;
+        if (c->ops > max_ops)
+            max_ops = c->ops;
+        sq += (double)c->ops * (double)c->ops;
+    }
+    double jain = sq > 0 ? (double)ops * (double)ops / (started * sq) : 0.0;
+    uint32_t v1 = (uint32_t)atomic_load(&pair);
+    int final_ok = lk->lock ? var1 == ops && var1 == var2
+                             : v1 == (uint32_t)(atomic_load(&pair) >> 32) && v1 == (uint32_t)ops;
+
+    printf("%-7s %5d %9.3f %10.0f %10.1f %9.0f %8.1f %6.3f %8.3f %s\n",
+           lk->name, started, ops / elapsed / 1e6,
+           ops ? (double)wait / ops : 0.0, wait_max / 1e3,
+           ops ? (double)hold / ops : 0.0,
+           ops ? 100.0 * handoffs / ops : 0.0,
+           jain, max_ops ? (double)min_ops / max_ops : 0.0,
+           mismatch == 0 && final_ok ? "ok" : "BROKEN");
+
+    if (verbose) {
+        for (i = 0; i < started; i++) {
+            thread_ctx *c = &ctx[i];
+            printf("    thread %3d: ops %10llu  wait avg %8.0f ns max %8.1f us  hold avg %6.0f ns  handoffs %llu\n",
+                   i, (unsigned long long)c->ops,
+                   c->ops ? (double)c->wait_ns / c->ops : 0.0, c->wait_max_ns / 1e3,
+                   c->ops ? (double)c->hold_ns / c->ops : 0.0,
+                   (unsigned long long)c->handoffs);
+        }
+    }
+    free(ctx);
+    return started == nthreads ? 0 : -1;
+}
+
+int main (int argc, char *argv[])
+{
+    int         only = -1, verbose = 0, opt;
+    double      seconds = 1.0;
+    char        tdefault[] = "4,16,64";     // strtok пишет в строку
+    char        *tlist = tdefault;
+    int         counts[64], ncounts = 0;
+
+    setvbuf (stdout, NULL, _IOLBF, 0);
+    while ((opt = getopt(argc, argv, "l:t:d:w:o:v")) != -1) {
+        switch (opt) {
+        case 'l':
+            for (int i = 0; i < NLOCKS; i++)
+                if (strcmp(optarg, locks[i].name) == 0)
+                    only = i;
+            if (only < 0) {
+                fprintf(stderr, "%s: -l mutex|ticket|mcs|atomic\n", progname);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 't':
+            tlist = optarg;
+            break;
+        case 'd':
+            seconds = atof(optarg);
+            break;
+        case 'w':
+            work_inside = atoi(optarg);
+            break;
+        case 'o':
+            work_outside = atoi(optarg);
+            break;
+        case 'v':
+            verbose = 1;
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-l mutex|ticket|mcs|atomic] [-t 4,16,64] [-d sec] "
+                    "[-w inside] [-o outside] [-v]\n", progname);
+            return EXIT_FAILURE;
+        }
+    }
+    for (char *s = strtok(tlist, ","); s && ncounts < 64; s = strtok(NULL, ",")) {
+        int n = atoi(s);
+        if (n < 1 || n > MAX_THREADS) {
+            fprintf(stderr, "%s: threads 1..%d\n", progname, MAX_THREADS);
+            return EXIT_FAILURE;
+        }
+        counts[ncounts++] = n;
+    }
+    if (seconds <= 0 || ncounts == 0) {
+        fprintf(stderr, "%s: bad -d or -t\n", progname);
+        return EXIT_FAILURE;
+    }
+
+    printf("%s: %ld CPU, %.1f s per run, work inside %d, outside %d\n",
+           progname, sysconf(_SC_NPROCESSORS_ONLN), seconds, work_inside, work_outside);
+    printf("%-7s %5s %9s %10s %10s %9s %8s %6s %8s\n", "lock", "thr", "Mops/s",
+           "wait_ns", "wmax_us", "hold_ns", "handoff%", "jain", "min/max");
+    for (int l = 0; l < NLOCKS; l++) {
+        if (only >= 0 && l != only)
+            continue;
+        for (int k = 0; k < ncounts; k++)
+            if (run(&locks[l], counts[k], seconds, verbose) != 0)
+                return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+/*
+ *  Результаты (1 CPU, SCHED_OTHER, ./bin/lockstat):
+ *
+ *  lock      thr    Mops/s    wait_ns    wmax_us   hold_ns handoff%   jain  min/max
+ *  mutex       4     7.631        214    16041.0        38      0.0  0.998    0.894
+ *  mutex      16     7.687       1740   164008.3        37      0.0  0.995    0.745
+ *  mutex      64     8.618       7102   620003.4        33      0.0  0.910    0.142
+ *  ticket      4     0.272      14598     3601.3        43     89.0  0.965    0.670
+ *  ticket     16     0.174      90908     4247.7        34     38.9  0.369    0.094
+ *  ticket     64     0.159     400363     3710.6        62     83.1  0.358    0.072
+ *  mcs         4     0.314      12620     3047.7        38     93.9  0.989    0.793
+ *  mcs        16     0.289      55098     2985.8        41     94.8  0.961    0.531
+ *  mcs        64     0.156     410718     3034.4        39     98.8  0.991    0.557
+ *  atomic      4    11.804        193    20032.3         0      0.0  1.000    0.981
+ *  atomic     16    12.183        744    72056.4         0      0.0  1.000    0.928
+ *  atomic     64    12.462       2632   344041.4         0      0.0  0.995    0.740
+ *
+ *  -t 4,16 -w 200 -o 200 (секция ~350 нс, столько же работы снаружи):
+ *  mutex       4     1.276        724    12058.7       346      0.0  0.999    0.930
+ *  mutex      16     1.241       9956   184058.0       356      0.0  0.967    0.511
+ *  ticket     16     0.150     104925     1392.4       392     94.4  0.978    0.643
+ *  mcs        16     0.167      94699     2078.8       436     99.7  1.000    0.957
+ *  atomic     16     1.055       7323    72031.2         0      0.0  0.999    0.914
+ *
+ *  - На одном CPU mutex почти никогда не передаётся (handoff ~0 %): поток
+ *    отпускает и тут же снова берёт его весь свой квант, а ждущие спят в
+ *    futex. Пропускная способность от числа потоков не зависит, но
+ *    худшее ожидание - десятки квантов планировщика (0.6 с при 64).
+ *  - Честные спин-блокировки (ticket, MCS) на 1 CPU в 25-50 раз медленнее:
+ *    блокировка почти всегда передаётся, а следующий по очереди поток
+ *    сначала надо дождаться из очереди планировщика - почти каждая
+ *    операция стоит переключения контекста. Зато худшее ожидание
+ *    ограничено (единицы мс против сотен у mutex).
+ *  - Справедливость ticket и MCS при 16-64 потоках от запуска к запуску
+ *    не воспроизводится: шесть прогонов -t 16,64 -d 0.3 дали jain
+ *    0.23-1.00 у ticket и 0.07-1.00 у MCS (чаще 0.2-0.7 у обеих; строки
+ *    таблицы - отдельные удачные и неудачные прогоны). Обе очереди FIFO,
+ *    но вытесненный следующий по очереди держит всех остальных, и
+ *    порядок на деле задаёт планировщик. Своё место ожидания у MCS
+ *    экономит трафик кэша, а на 1 CPU справедливости не добавляет.
+ *  - Атомарное обновление быстрее всех и справедливо, но пригодно только
+ *    когда состояние помещается в одно слово.
+ *  - Секундомер: три clock_gettime на операцию (~100 нс) входят в цифры
+ *    mutex и atomic; сравнивать стоит между блокировками, а не с mutex.c.
+ */
@@ -0,0 +1,161 @@
+#define _GNU_SOURCE
+#include "mpmc.h"
+#include <errno.h>
+#include <stdint.h>
+#include <limits.h>
+#include <linux/futex.h>
+#include <stdlib.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#define MPMC_SPIN 64     // попыток до сна: на одном CPU дольше крутиться бессмысленно
+
+static void futex_wait(atomic_uint *addr, unsigned val)
+{
+  syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, val, NULL, NULL, 0);
+}
+
+static void futex_wake(atomic_uint *addr, int n)
+{
+  syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, n, NULL, NULL, 0);
+}
+
+static inline void cpu_relax(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_ia32_pause();
+#endif
+}
+
+int mpmc_init(mpmc_queue *q, size_t capacity)
+{
+  size_t cap = 2;
+  while (cap < capacity)
+    cap <<= 1;
+  q->cells = aligned_alloc(MPMC_LINE, ((cap * sizeof(mpmc_cell) + MPMC_LINE - 1) / MPMC_LINE) * MPMC_LINE);
+  if (!q->cells) {
+    errno = ENOMEM;
+    return -1;
+  }
+  for (size_t i = 0; i < cap; i++)
+    atomic_init(&q->cells[i].seq, i);
+  q->mask = cap - 1;
+  atomic_init(&q->head, 0);
+  atomic_init(&q->tail, 0);
+  atomic_init(&q->items_ev, 0);
+  atomic_init(&q->pop_waiters, 0);
+  atomic_init(&q->space_ev, 0);
+  atomic_init(&q->push_waiters, 0);
+  atomic_init(&q->push_sleeps, 0);
+  atomic_init(&q->pop_sleeps, 0);
+  return 0;
+}
+
+void mpmc_destroy(mpmc_queue *q)
+{
+  free(q->cells);
+  q->cells = NULL;
+}
+
+int mpmc_try_push(mpmc_queue *q, long val)
+{
+  size_t pos = atomic_load_explicit(&q->head, memory_order_relaxed);
+  for (;;) {
+    mpmc_cell *c = &q->cells[pos & q->mask];
+    size_t seq = atomic_load_explicit(&c->seq, memory_order_acquire);
+    intptr_t dif = (intptr_t)seq - (intptr_t)pos;
+    if (dif == 0) {
+      // Ячейка свободна на этом круге — занимаем позицию
+      if (atomic_compare_exchange_weak_explicit(&q->head, &pos, pos + 1,
+                                                memory_order_relaxed, memory_order_relaxed)) {
+        c->val = val;
+        atomic_store_explicit(&c->seq, pos + 1, memory_order_release);
+        return 1;
+      }
+    } else if (dif < 0) {
+      return 0;   // потребитель ещё не освободил ячейку с прошлого круга — полна
+    } else {
+      pos = atomic_load_explicit(&q->head, memory_order_relaxed);
+    }
+  }
+}
+
+int mpmc_try_pop(mpmc_queue *q, long *val)
+{
+  size_t pos = atomic_load_explicit(&q->tail, memory_order_relaxed);
+  for (;;) {
+    mpmc_cell *c = &q->cells[pos & q->mask];
+    size_t seq = atomic_load_explicit(&c->seq, memory_order_acquire);
+    intptr_t dif = (intptr_t)seq - (intptr_t)(pos + 1);
+    if (dif == 0) {
+      if (atomic_compare_exchange_weak_explicit(&q->tail, &pos, pos + 1,
+                                                memory_order_relaxed, memory_order_relaxed)) {
+        *val = c->val;
+        atomic_store_explicit(&c->seq, pos + q->mask + 1, memory_order_release);
+        return 1;
+      }
+    } else if (dif < 0) {
+      return 0;   // производитель ещё не опубликовал — пусто
+    } else {
+      pos = atomic_load_explicit(&q->tail, memory_order_relaxed);
+    }
+  }
+}
+
+// Разбудить ждущих на другом конце. Барьер парный барьеру в mpmc_push/
+// mpmc_pop: либо мы увидим ждущего, либо он после регистрации увидит наш
+// элемент. Счётчик ждущих обнуляет будящий и будит всех: разбуженный поток
+// может не успеть запуститься до следующей операции, и если бы он сам
+// вычитал себя, каждая такая операция делала бы лишний FUTEX_WAKE: на одном
+// CPU такой вариант давал 2.5 млн элементов/с против 13.5 млн/с у этого
+// (prodcons_bench -m mpmc -r 1:1), медленнее буфера под мьютексом.
+// Кому снова не хватило, зарегистрируется заново.
+static void notify(atomic_uint *ev, atomic_uint *waiters)
+{
+  atomic_thread_fence(memory_order_seq_cst);
+  if (atomic_load_explicit(waiters, memory_order_relaxed) &&
+      atomic_exchange_explicit(waiters, 0, memory_order_relaxed)) {
+    atomic_fetch_add_explicit(ev, 1, memory_order_release);
+    futex_wake(ev, INT_MAX);
+  }
+}
+
+void mpmc_push(mpmc_queue *q, long val)
+{
+  for (int i = 0; !mpmc_try_push(q, val); i++) {
+    if (i < MPMC_SPIN) {
+      cpu_relax();
+      continue;
+    }
+    unsigned ev = atomic_load_explicit(&q->space_ev, memory_order_acquire);
+    atomic_fetch_add_explicit(&q->push_waiters, 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    if (mpmc_try_push(q, val))
+      break;      // регистрация останется до ближайшего notify: один лишний FUTEX_WAKE
+    atomic_fetch_add_explicit(&q->push_sleeps, 1, memory_order_relaxed);
+    futex_wait(&q->space_ev, ev);
+    i = 0;
+  }
+  notify(&q->items_ev, &q->pop_waiters);
+}
+
+long mpmc_pop(mpmc_queue *q)
+{
+  long val;
+  for (int i = 0; !mpmc_try_pop(q, &val); i++) {
+    if (i < MPMC_SPIN) {
+      cpu_relax();
+      continue;
+    }
+    unsigned ev = atomic_load_explicit(&q->items_ev, memory_order_acquire);
+    atomic_fetch_add_explicit(&q->pop_waiters, 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    if (mpmc_try_pop(q, &val))
+      break;      // регистрация останется до ближайшего notify: один лишний FUTEX_WAKE
+    atomic_fetch_add_explicit(&q->pop_sleeps, 1, memory_order_relaxed);
+    futex_wait(&q->items_ev, ev);
+    i = 0;
+  }
+  notify(&q->space_ev, &q->push_waiters);
+  return val;
+}
@@ -0,0 +1,54 @@
+#ifndef MPMC_H
+#define MPMC_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+
+/*
+ * Ограниченная очередь MPMC (Вьюков): кольцо ячеек с номерами
+ * последовательности. Производитель занимает позицию CAS по head и
+ * публикует значение, записав seq = pos + 1; потребитель ждёт этого seq
+ * у своей ячейки, забирает значение и освобождает ячейку для следующего
+ * круга (seq = pos + capacity). Мьютексов нет: потоки сталкиваются только
+ * на CAS своего конца очереди.
+ *
+ * mpmc_push/mpmc_pop блокируются, только когда очередь полна/пуста: после
+ * короткого опроса поток засыпает на futex-счётчике событий своего конца,
+ * а противоположная сторона будит его, только если видит ждущих.
+ */
+
+#define MPMC_LINE 64
+
+typedef struct mpmc_cell {
+  atomic_size_t seq;
+  long val;
+} mpmc_cell;
+
+typedef struct mpmc_queue {
+  mpmc_cell *cells;
+  size_t mask;                                  // ёмкость - 1
+  _Alignas(MPMC_LINE) atomic_size_t head;       // следующая позиция записи
+  _Alignas(MPMC_LINE) atomic_size_t tail;       // следующая позиция чтения
+  // Ожидание: счётчик событий (слово futex) и число ждущих на каждом конце
+  _Alignas(MPMC_LINE) atomic_uint items_ev;     // появились элементы
+  atomic_uint pop_waiters;
+  _Alignas(MPMC_LINE) atomic_uint space_ev;     // освободилось место
+  atomic_uint push_waiters;
+  // Сколько раз очередь не обошлась без сна (для отчёта)
+  _Alignas(MPMC_LINE) atomic_ulong push_sleeps;
+  atomic_ulong pop_sleeps;
+} mpmc_queue;
+
+// capacity округляется вверх до степени двойки; -1 и errno при ошибке
+int mpmc_init(mpmc_queue *q, size_t capacity);
+void mpmc_destroy(mpmc_queue *q);
+
+// Без ожидания: 1 — успешно, 0 — очередь полна/пуста
+int mpmc_try_push(mpmc_queue *q, long val);
+int mpmc_try_pop(mpmc_queue *q, long *val);
+
+// С ожиданием места/элемента
+void mpmc_push(mpmc_queue *q, long val);
+long mpmc_pop(mpmc_queue *q);
+
+#endif // MPMC_H
@@ -4,12 +4,18 @@
  *  в любой момент работы одного из них мы можем просто использовать вызов
  *  pthread_cond_signal для пробуждения второго потока.
  *
+ *  С ключом -q те же потоки передают продукт через очередь mpmc.c: в ней
+ *  может лежать сразу несколько элементов, и производитель не ждёт, пока
+ *  потребитель заберёт предыдущий.
+ *
 */
 
 #include <stdio.h>
 #include <pthread.h>
 #include <sched.h>
+#include <string.h>
 #include <unistd.h>
+#include "mpmc.h"
 
 // mutex и условная переменная
 
@@ -21,14 +27,22 @@ void    *producer (void *);
 void    *consumer (void *);
 void    do_producer_work (void);
 void    do_consumer_work (void);
+void    *queue_producer (void *);
+void    *queue_consumer (void *);
 char    *progname = "prodcons";
+mpmc_queue          queue;
 
-int main ()
+int main (int argc, char *argv[])
 {
-  pthread_t consumer, producer;
+  pthread_t consumer_tid, producer_tid;
+  int use_queue = argc > 1 && strcmp (argv[1], "-q") == 0;
   setvbuf (stdout, NULL, _IOLBF, 0);
-  pthread_create (&consumer, NULL, consumer, NULL);
-  pthread_create (&producer, NULL, producer, NULL);
+  if (use_queue && mpmc_init (&queue, 16) != 0) {
+    perror ("mpmc_init");
+    return 1;
+  }
+  pthread_create (&consumer_tid, NULL, use_queue ? queue_consumer : consumer, NULL);
+  pthread_create (&producer_tid, NULL, use_queue ? queue_producer : producer, NULL);
   sleep (20);     // Позволим потокам выполнить "работу"
   printf ("%s:  main, exiting\n", progname);
   return 0;
@@ -37,6 +51,7 @@ int main ()
 // Производитель
 void *producer (void *arg)
 {
+  (void)arg;
   while (1) {
     pthread_mutex_lock (&mutex);
     while (state == 1) {
@@ -55,6 +70,7 @@ void *producer (void *arg)
 
 void *consumer (void *arg)
 {
+  (void)arg;
   while (1) {
     pthread_mutex_lock (&mutex);
     while (state == 0) {
@@ -69,6 +85,29 @@ void *consumer (void *arg)
   return (NULL);
 }
 
+// Те же роли через очередь: ни мьютекса, ни переменной состояния
+void *queue_producer (void *arg)
+{
+  (void)arg;
+  while (1) {
+    mpmc_push (&queue, ++product);
+    printf ("%s:  produced %d\n", progname, product);
+    do_producer_work ();
+  }
+  return (NULL);
+}
+
+void *queue_consumer (void *arg)
+{
+  (void)arg;
+  while (1) {
+    long v = mpmc_pop (&queue);
+    printf ("%s:  consumed %ld\n", progname, v);
+    do_consumer_work ();
+  }
+  return (NULL);
+}
+
 void do_producer_work (void)
 {
   usleep (100 * 1000);
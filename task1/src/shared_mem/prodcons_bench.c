@@ -0,0 +1,275 @@
+/*
+ *  Пропускная способность "производитель - потребитель" для разных передач:
+ *      slot - протокол prodcons.c: одна ячейка, mutex и условные
+ *             переменные (по одной на каждую сторону, иначе при нескольких
+ *             производителях signal будит не того);
+ *      ring - кольцевой буфер той же ёмкости, что у mpmc, под mutex с
+ *             двумя условными переменными;
+ *      mpmc - очередь mpmc.c без блокировок, сон на futex только когда
+ *             очередь пуста/полна.
+ *
+ *  Производители отправляют -n элементов на всех, потребители суммируют
+ *  полученное; сумма сверяется с ожидаемой. Для каждого соотношения
+ *  P:C печатаются элементы/с и сколько раз потокам пришлось заснуть.
+ *
+ *  Запуск: ./bin/prodcons_bench [-m slot|ring|mpmc] [-r 1:1,4:4,8:8]
+ *                               [-n элементов] [-q ёмкость] [-w работа на элемент]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include "mpmc.h"
+
+#define MAX_SIDE    64
+#define STOP        (-1L)   // сигнал потребителю завершиться
+
+char    *progname = "prodcons_bench";
+
+static long     items_per_producer;
+static int      work;
+static size_t   capacity = 1024;
+
+// slot и ring: буфер под мьютексом. slot - это ring ёмкостью 1
+static pthread_mutex_t  mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t   can_put = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t   can_get = PTHREAD_COND_INITIALIZER;
+static long     *ring;
+static size_t   ring_cap, ring_head, ring_count;
+static unsigned long    put_sleeps, get_sleeps;     // под mutex
+
+static mpmc_queue   queue;
+
+typedef struct {
+    const char  *name;
+    void        (*put)(long);
+    long        (*get)(void);
+} transport;
+
+static void ring_put (long v)
+{
+    pthread_mutex_lock (&mutex);
+    while (ring_count == ring_cap) {
+        put_sleeps++;
+        pthread_cond_wait (&can_put, &mutex);
+    }
+    ring[(ring_head + ring_count) % ring_cap] = v;
+    ring_count++;
+    pthread_cond_signal (&can_get);
+    pthread_mutex_unlock (&mutex);
+}
+
+static long ring_get (void)
+{
+    pthread_mutex_lock (&mutex);
+    while (ring_count == 0) {
+        get_sleeps++;
+        pthread_cond_wait (&can_get, &mutex);
+    }
+    long v = ring[ring_head];
+    ring_head = (ring_head + 1) % ring_cap;
+    ring_count--;
+    pthread_cond_signal (&can_put);
+    pthread_mutex_unlock (&mutex);
+    return v;
+}
+
+static void queue_put (long v) { mpmc_push (&queue, v); }
+static long queue_get (void)   { return mpmc_pop (&queue); }
+
+static const transport transports[] = {
+    { "slot", ring_put,  ring_get },
+    { "ring", ring_put,  ring_get },
+    { "mpmc", queue_put, queue_get },
+};
+#define NTRANSPORTS (int)(sizeof(transports) / sizeof(transports[0]))
+
+static const transport *cur;
+
+static void do_work (int n)
+{
+    for (volatile int i = 0; i < n; i++)
+        ;
+}
+
+static void *producer (void *arg)
+{
+    long base = (long)arg * items_per_producer;
+    for (long i = 1; i <= items_per_producer; i++) {
+        do_work (work);
+        cur->put (base + i);
+    }
+    return NULL;
+}
+
+static void *consumer (void *arg)
+{
+    long *sum = arg;
+    long v;
+    while ((v = cur->get ()) != STOP) {
+        *sum += v;
+        do_work (work);
+    }
+    return NULL;
+}
+
+static double now_s (void)
+{
+    struct timespec ts;
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int run (int t, int np, int nc, long total)
+{
+    pthread_t   prod[MAX_SIDE], cons[MAX_SIDE];
+    long        sums[MAX_SIDE] = { 0 };
+
+    cur = &transports[t];
+    items_per_producer = total / np;
+    ring_cap = t == 0 ? 1 : capacity;
+    ring_head = ring_count = 0;
+    put_sleeps = get_sleeps = 0;
+    if (t == 2 && mpmc_init (&queue, capacity) != 0) {
+        perror ("mpmc_init");
+        return -1;
+    }
+
+    // Если поток не создался, уже запущенные доводим до конца и не печатаем строку
+    int started_c = 0, started_p = 0, rc = 0;
+    double t0 = now_s ();
+    for (; started_c < nc; started_c++)
+        if ((rc = pthread_create (&cons[started_c], NULL, consumer, &sums[started_c])) != 0)
+            break;
+    for (; rc == 0 && started_p < np; started_p++)
+        if ((rc = pthread_create (&prod[started_p], NULL, producer, (void *)(long)started_p)) != 0)
+            break;
+    for (int i = 0; i < started_p; i++)
+        pthread_join (prod[i], NULL);
+    for (int i = 0; i < started_c; i++)
+        cur->put (STOP);
+    for (int i = 0; i < started_c; i++)
+        pthread_join (cons[i], NULL);
+    double elapsed = now_s () - t0;
+    if (rc != 0) {
+        fprintf (stderr, "%s: pthread_create: %s\n", progname, strerror (rc));
+        if (t == 2)
+            mpmc_destroy (&queue);
+        return -1;
+    }
+
+    long n = items_per_producer * np, sum = 0;
+    for (int i = 0; i < nc; i++)
+        sum += sums[i];
+    unsigned long ps = put_sleeps, gs = get_sleeps;
+    if (t == 2) {
+        ps = atomic_load (&queue.push_sleeps);
+        gs = atomic_load (&queue.pop_sleeps);
+        mpmc_destroy (&queue);
+    }
+    printf ("%-5s %2d:%-2d %12.0f %12lu %12lu %s\n", cur->name, np, nc, n / elapsed,
+            ps, gs, sum == n * (n + 1) / 2 ? "ok" : "BAD SUM");
+    return 0;
+}
+
+int main (int argc, char *argv[])
+{
+    int     only = -1, opt;
+    long    total = 2000000;
+    char    rdefault[] = "1:1,4:4,8:8";     // strtok пишет в строку
+    char    *ratios = rdefault;
+
+    setvbuf (stdout, NULL, _IOLBF, 0);
+    while ((opt = getopt (argc, argv, "m:r:n:q:w:")) != -1) {
+        switch (opt) {
+        case 'm':
+            for (int i = 0; i < NTRANSPORTS; i++)
+                if (strcmp (optarg, transports[i].name) == 0)
+                    only = i;
+            if (only < 0) {
+                fprintf (stderr, "%s: -m slot|ring|mpmc\n", progname);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'r':
+            ratios = optarg;
+            break;
+        case 'n':
+            total = atol (optarg);
+            break;
+        case 'q':
+            capacity = (size_t)atol (optarg);
+            break;
+        case 'w':
+            work = atoi (optarg);
+            break;
+        default:
+            fprintf (stderr, "usage: %s [-m slot|ring|mpmc] [-r 1:1,4:4,8:8] [-n items] "
+                     "[-q capacity] [-w work]\n", progname);
+            return EXIT_FAILURE;
+        }
+    }
+    if (total <= 0 || capacity < 2) {
+        fprintf (stderr, "%s: bad -n or -q\n", progname);
+        return EXIT_FAILURE;
+    }
+    ring = malloc (capacity * sizeof(long));
+    if (!ring) {
+        perror ("malloc");
+        return EXIT_FAILURE;
+    }
+
+    printf ("%s: %ld items, capacity %zu, work %d\n", progname, total, capacity, work);
+    printf ("%-5s %5s %12s %12s %12s\n", "mode", "P:C", "items/s", "put_sleeps", "get_sleeps");
+    for (char *r = strtok (ratios, ","); r; r = strtok (NULL, ",")) {
+        int np, nc;
+        if (sscanf (r, "%d:%d", &np, &nc) != 2 || np < 1 || nc < 1 || np > MAX_SIDE || nc > MAX_SIDE) {
+            fprintf (stderr, "%s: ratio P:C, 1..%d each\n", progname, MAX_SIDE);
+            return EXIT_FAILURE;
+        }
+        // Каждый производитель кладёт total / P элементов: при -n < P — ни одного
+        if (total < np) {
+            fprintf (stderr, "%s: -n %ld is less than %d producers\n", progname, total, np);
+            return EXIT_FAILURE;
+        }
+        for (int t = 0; t < NTRANSPORTS; t++)
+            if ((only < 0 || t == only) && run (t, np, nc, total) != 0)
+                return EXIT_FAILURE;
+    }
+    free (ring);
+    return EXIT_SUCCESS;
+}
+
+/*
+ *  Результаты (1 CPU, ./bin/prodcons_bench, 2 000 000 элементов, ёмкость 1024):
+ *
+ *  mode    P:C      items/s   put_sleeps   get_sleeps
+ *  slot   1:1        184075      1329788      1331132
+ *  ring   1:1       8543017         1968         2088
+ *  mpmc   1:1      13537367         2952         1981
+ *  slot   4:4        105418      1999930      1999929
+ *  ring   4:4       7915562         2833         3162
+ *  mpmc   4:4      13109087         3131         2628
+ *  slot   8:8        109862      1999987      2000008
+ *  ring   8:8       7308222         3289         3420
+ *  mpmc   8:8      11939370         3717         4210
+ *
+ *  -w 200 (~400 нс работы на элемент у каждой стороны):
+ *  slot   8:8        100137      2000004      2000008
+ *  ring   8:8       1217820         2720         6382
+ *  mpmc   8:8       1044186         3986        72068
+ *
+ *  - Одна ячейка (протокол prodcons.c) - это переключение контекста на
+ *    каждый элемент: обе стороны засыпают почти на каждой операции, и
+ *    пропускная способность в 50-100 раз ниже, чем у буфера.
+ *  - Буфер под мьютексом уже снимает основную цену: пока одна сторона
+ *    занимает CPU, она успевает заполнить или опустошить кольцо, засыпания
+ *    редки. mpmc быстрее него в 1.5 раза без работы и не деградирует с
+ *    ростом числа потоков так, как мьютекс (7.3 -> 11.9 млн/с при 8:8).
+ *  - Когда работа на элемент заметна, передача перестаёт быть узким
+ *    местом, и ring и mpmc сравниваются. Очередь окупается на коротких
+ *    элементах и при многих ядрах, где потоки не делят один мьютекс.
+ */
@@ -7,6 +7,14 @@
  *      the semaphore.  
  *      A producer thread is created, which periodically posts
  *      the semaphore, unblocking one of the consumer threads.
+ *
+ *  С ключом -b - замер вместо демонстрации: те же пять потребителей, но
+ *  производитель выдаёт единицы без пауз. Сравниваются именованный и
+ *  неименованный sem_t, eventfd в режиме EFD_SEMAPHORE и fsem.c (обычный и
+ *  с FIFO-порядком). Для каждого печатается пропускная способность и
+ *  задержка пробуждения: от post до выхода спящего потребителя из wait.
+ *
+ *      ./bin/semex -b [-n единиц] [-B пачка] [-c потребителей] [-l замеров]
 */
 
 #include <stdio.h>
@@ -15,7 +23,13 @@
 #include <fcntl.h>
 #include <sys/stat.h>
 #include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <time.h>
 #include <unistd.h>
+#include <sys/eventfd.h>
+#include "fsem.h"
 
 sem_t   *mySemaphore;
 void    *producer (void *);
@@ -26,10 +40,14 @@ char    *progname = "semex";
 // Для совместимости с Linux/macOS используем именованные семафоры по умолчанию
 #define Named 1
 
-int main ()
+static int bench (int argc, char *argv[]);
+
+int main (int argc, char *argv[])
 {
     int     i;
     setvbuf (stdout, NULL, _IOLBF, 0);
+    if (argc > 1 && strcmp (argv[1], "-b") == 0)
+        return bench (argc - 1, argv + 1);
 #ifdef  Named
     mySemaphore = sem_open (SEM_NAME, O_CREAT, S_IRWXU, 0);
     /* not sharing with other process, so immediately unlink */
@@ -67,4 +85,232 @@ void *consumer (void *i)
         printf ("%s:  (consumer %ld) got semaphore\n", progname, (long)i);
     }
     return (NULL);
-}
\ No newline at end of file
+}
+
+/*
+ *  Замер (-b)
+ */
+
+#define MAX_CONSUMERS   64
+
+static sem_t        *bench_sem;         // named/unnamed
+static sem_t        bench_sem_mem;
+static int          bench_efd = -1;
+static fsem         bench_fsem;
+
+typedef struct {
+    const char  *name;
+    int         (*init)(void);
+    void        (*wait)(void);
+    void        (*post)(unsigned n);
+    void        (*fini)(void);
+} sem_impl;
+
+static int named_init (void)
+{
+    bench_sem = sem_open ("/SemexBench", O_CREAT | O_EXCL, S_IRWXU, 0);
+    if (bench_sem == SEM_FAILED)
+        return -1;
+    sem_unlink ("/SemexBench");
+    return 0;
+}
+static void named_fini (void) { sem_close (bench_sem); }
+
+static int unnamed_init (void)
+{
+    bench_sem = &bench_sem_mem;
+    return sem_init (bench_sem, 0, 0);
+}
+static void unnamed_fini (void) { sem_destroy (bench_sem); }
+
+static void posix_wait (void) { while (sem_wait (bench_sem) != 0) ; }
+static void posix_post (unsigned n)
+{
+    // у sem_t нет post(n): n вызовов
+    while (n--)
+        sem_post (bench_sem);
+}
+
+static int efd_init (void)
+{
+    bench_efd = eventfd (0, EFD_SEMAPHORE | EFD_CLOEXEC);
+    return bench_efd < 0 ? -1 : 0;
+}
+static void efd_wait (void) { eventfd_t v; eventfd_read (bench_efd, &v); }
+static void efd_post (unsigned n) { eventfd_write (bench_efd, n); }
+static void efd_fini (void) { close (bench_efd); }
+
+static int fsem_plain_init (void) { return fsem_init (&bench_fsem, 0, 0); }
+static int fsem_fifo_init (void)  { return fsem_init (&bench_fsem, 0, 1); }
+static void fsem_bench_wait (void) { fsem_wait (&bench_fsem); }
+static void fsem_bench_post (unsigned n) { fsem_post (&bench_fsem, n); }
+static void fsem_fini (void) { }
+
+static const sem_impl impls[] = {
+    { "named",   named_init,      posix_wait,      posix_post,      named_fini },
+    { "unnamed", unnamed_init,    posix_wait,      posix_post,      unnamed_fini },
+    { "eventfd", efd_init,        efd_wait,        efd_post,        efd_fini },
+    { "fsem",    fsem_plain_init, fsem_bench_wait, fsem_bench_post, fsem_fini },
+    { "fsem-fifo", fsem_fifo_init, fsem_bench_wait, fsem_bench_post, fsem_fini },
+};
+
+static const sem_impl   *impl;
+static long             limit;          // столько единиц потребить, остальные - на выход
+static atomic_long      consumed;
+static atomic_llong     posted_ns;      // момент последнего post в фазе задержки
+
+static long long now_ns (void)
+{
+    struct timespec ts;
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static long long    *lat;               // задержки фазы 2, пишет получивший единицу
+
+static void *bench_consumer (void *arg)
+{
+    (void)arg;
+    for (;;) {
+        impl->wait ();
+        long long t = now_ns ();
+        long c = atomic_fetch_add (&consumed, 1);
+        if (c >= limit)
+            break;
+        if (lat)
+            lat[c] = t - atomic_load (&posted_ns);
+    }
+    return NULL;
+}
+
+static int compare_ll (const void *a, const void *b)
+{
+    long long va = *(const long long *)a, vb = *(const long long *)b;
+    return (va > vb) - (va < vb);
+}
+
+static int bench_one (const sem_impl *im, int nc, long n, unsigned batch, long samples)
+{
+    pthread_t   cons[MAX_CONSUMERS];
+
+    impl = im;
+    if (im->init () != 0) {
+        perror (im->name);
+        return -1;
+    }
+
+    // Фаза 1: пропускная способность - post без пауз, пачками по batch
+    lat = NULL;
+    limit = n;
+    atomic_store (&consumed, 0);
+    for (int i = 0; i < nc; i++)
+        pthread_create (&cons[i], NULL, bench_consumer, NULL);
+    long long t0 = now_ns ();
+    for (long left = n; left > 0; left -= batch)
+        im->post (left < batch ? (unsigned)left : batch);
+    while (atomic_load (&consumed) < n)
+        sched_yield ();
+    double elapsed = (now_ns () - t0) / 1e9;
+    im->post (nc);      // по единице на выход
+    for (int i = 0; i < nc; i++)
+        pthread_join (cons[i], NULL);
+
+    // Фаза 2: задержка пробуждения - по одной единице, когда все потребители спят
+    lat = calloc ((size_t)samples, sizeof(long long));
+    if (!lat) {
+        perror ("calloc");
+        im->fini ();
+        return -1;
+    }
+    limit = samples;
+    atomic_store (&consumed, 0);
+    for (int i = 0; i < nc; i++)
+        pthread_create (&cons[i], NULL, bench_consumer, NULL);
+    for (long k = 0; k < samples; k++) {
+        usleep (200);   // потребители успевают уснуть
+        atomic_store (&posted_ns, now_ns ());
+        im->post (1);
+        while (atomic_load (&consumed) <= k)
+            sched_yield ();
+    }
+    im->post (nc);
+    for (int i = 0; i < nc; i++)
+        pthread_join (cons[i], NULL);
+    im->fini ();
+
+    qsort (lat, (size_t)samples, sizeof(long long), compare_ll);
+    printf ("%-9s %12.0f %9.1f %9.1f %9.1f\n", im->name, n / elapsed,
+            lat[samples / 2] / 1e3, lat[samples * 99 / 100] / 1e3, lat[samples - 1] / 1e3);
+    free (lat);
+    lat = NULL;
+    return 0;
+}
+
+static int bench (int argc, char *argv[])
+{
+    long        n = 1000000, samples = 2000;
+    unsigned    batch = 1;
+    int         nc = 5, opt;
+
+    while ((opt = getopt (argc, argv, "n:B:c:l:")) != -1) {
+        switch (opt) {
+        case 'n': n = atol (optarg); break;
+        case 'B': batch = (unsigned)atoi (optarg); break;
+        case 'c': nc = atoi (optarg); break;
+        case 'l': samples = atol (optarg); break;
+        default:
+            fprintf (stderr, "usage: %s -b [-n units] [-B batch] [-c consumers] [-l samples]\n", progname);
+            return EXIT_FAILURE;
+        }
+    }
+    if (n < 1 || batch < 1 || samples < 1 || nc < 1 || nc > MAX_CONSUMERS) {
+        fprintf (stderr, "%s: bad arguments\n", progname);
+        return EXIT_FAILURE;
+    }
+    printf ("%s: %d consumers, %ld units in batches of %u, %ld latency samples\n",
+            progname, nc, n, batch, samples);
+    printf ("%-9s %12s %9s %9s %9s\n", "sem", "units/s", "p50_us", "p99_us", "max_us");
+    for (size_t i = 0; i < sizeof(impls) / sizeof(impls[0]); i++)
+        if (bench_one (&impls[i], nc, n, batch, samples) != 0)
+            return EXIT_FAILURE;
+    return EXIT_SUCCESS;
+}
+
+/*
+ *  Результаты (1 CPU, ./bin/semex -b; второй блок - -B 64 -l 500):
+ *
+ *  sem            units/s    p50_us    p99_us    max_us
+ *  named           726289       4.4      15.8    1348.5
+ *  unnamed        1236161       3.5      10.6    1304.6
+ *  eventfd         343951       6.8      22.9     390.0
+ *  fsem           1052311       3.9      15.2    3073.2
+ *  fsem-fifo      1028160       3.9      13.7     174.4
+ *
+ *  named           744842       3.4      15.2     394.6
+ *  unnamed        1160084       3.4      11.7     378.2
+ *  eventfd        3323014       5.3      18.8      20.2
+ *  fsem          16839865       3.7      11.8      24.9
+ *  fsem-fifo     18262079       3.8      10.9    1013.6
+ *
+ *  - По одной единице fsem идёт вровень с неименованным sem_t: в glibc это
+ *    тот же futex с быстрым путём в пространстве пользователя. Именованный
+ *    sem_t лежит в разделяемой памяти, и его futex не private - медленнее
+ *    в полтора раза. eventfd платит системный вызов на каждый wait и post.
+ *  - Задержка пробуждения (~4 мкс) у всех одна - это переключение
+ *    контекста; быстрый путь её не меняет, он убирает системные вызовы,
+ *    когда спать не нужно.
+ *  - Выигрыш даёт post(n): у простого fsem пачка из 64 единиц - одна
+ *    атомарная операция и не больше одного FUTEX_WAKE, в 15 раз быстрее
+ *    n вызовов sem_post.
+ *  - В FIFO-режиме post(n) при спящих ожидающих будит каждый слот билета
+ *    отдельно: до min(n, 64) атомарных операций и столько же FUTEX_WAKE
+ *    (одним вызовом разные адреса futex не разбудить). В замере выше
+ *    fsem-fifo с -B 64 не медленнее простого fsem, но только потому, что
+ *    спящие потребители при post редки; когда они есть, пачка в
+ *    FIFO-режиме стоит до 64 системных вызовов вместо одного.
+ *  - FIFO-порядок по одной единице почти ничего не стоит: билеты - тот же
+ *    один atomic, а спящих будят по слотам выданных билетов, без
+ *    пробуждения всех.
+ *  - Максимумы (сотни мкс - мс) - вытеснения на одном CPU, от реализации
+ *    не зависят.
+ */
@@ -6,25 +6,33 @@
  *  - Реализовать периодическую выборку с шагом 2 мс через
  *    абсолютный clock_nanosleep(TIMER_ABSTIME)
  *  - Измерить фактические дельты между сэмплами и вывести статистику
+ *
+ *  Способ ожидания (-w):
+ *  - sleep  — только clock_nanosleep; задержка пробуждения ядра (десятки
+ *             мкс) целиком попадает в джиттер
+ *  - spin   — опрос CLOCK_MONOTONIC (vDSO, без системного вызова) до
+ *             дедлайна: точно, но занимает CPU на 100%
+ *  - hybrid — сон до (дедлайн - запас), затем опрос до дедлайна. Запас
+ *             подстраивается под наблюдаемую задержку пробуждения (-A — не
+ *             подстраивать)
+ *  - all    — прогнать все три подряд и вывести сравнение с загрузкой CPU
  */
 
 #define _POSIX_C_SOURCE 200809L
 #include <errno.h>
 #include <stdint.h>
 #include <inttypes.h>
-#include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
+#include <unistd.h>
+#include "latstat.h"
 
 #define BILLION 1000000000LL
 #define MILLION 1000000LL
 #define NUM_SAMPLES 5000 /* 5000 * 2 ms ≈ 10 секунд эксперимента */
-
-static inline int64_t timespec_to_ns(const struct timespec *ts) {
-    return (int64_t)ts->tv_sec * BILLION + (int64_t)ts->tv_nsec;
-}
+#define NUM_SHOWN 10
 
 static inline void ns_to_timespec(int64_t ns, struct timespec *ts) {
     ts->tv_sec = (time_t)(ns / BILLION);
@@ -32,12 +40,159 @@ static inline void ns_to_timespec(int64_t ns, struct timespec *ts) {
 }
 
 #ifdef __linux__
-int main(void) {
+enum wait_mode { WAIT_SLEEP, WAIT_SPIN, WAIT_HYBRID, WAIT_NMODES };
+static const char *const wait_names[WAIT_NMODES] = { "sleep", "spin", "hybrid" };
+
+/* Состояние гибридного ожидания */
+typedef struct hybrid {
+    int64_t margin_ns;      /* текущий запас до дедлайна, когда сон сменяется опросом */
+    int64_t max_margin_ns;  /* больше половины периода запас не растёт */
+    int adaptive;
+    long late;              /* сон вернулся уже после дедлайна: опрос не помог */
+} hybrid;
+
+/* Результат прогона одного способа ожидания */
+typedef struct run_stats {
+    latstat period;         /* дельта между соседними пробуждениями */
+    latstat error;          /* пробуждение - дедлайн */
+    double cpu_pct;         /* процессорное время / астрономическое */
+    int64_t shown_ns[NUM_SHOWN];
+} run_stats;
+
+static inline int64_t mono_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return latstat_ts_ns(&ts);
+}
+
+static int sleep_until(int64_t t_ns) {
+    struct timespec t;
+    int rc;
+    ns_to_timespec(t_ns, &t);
+    /* Абсолютный сон до t: устойчив к дрейфу */
+    do {
+        rc = clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &t, NULL); // TIMER_ABSTIME делает цикл привязанным к определенному, фиксированному времени
+    } while (rc == EINTR);
+    return rc;
+}
+
+/* clock_gettime(CLOCK_MONOTONIC) идёт через vDSO: чтение TSC и пары полей
+ * без входа в ядро, около 20-30 нс на вызов */
+static void spin_until(int64_t t_ns) {
+    while (mono_ns() < t_ns)
+        ;
+}
+
+static int wait_until(int mode, int64_t deadline_ns, hybrid *h) {
+    if (mode == WAIT_SPIN) {
+        spin_until(deadline_ns);
+        return 0;
+    }
+    if (mode == WAIT_SLEEP)
+        return sleep_until(deadline_ns);
+
+    int64_t target = deadline_ns - h->margin_ns;
+    int rc = sleep_until(target);
+    if (rc != 0)
+        return rc;
+    int64_t over = mono_ns() - target; /* задержка пробуждения этого сна */
+    if (over > h->margin_ns)
+        h->late++;
+    if (h->adaptive) {
+        /* Запас следит за недавним максимумом задержки пробуждения плюс
+         * четверть сверху: вырастает сразу, а убывает на 1/64 разницы за
+         * период, чтобы редкий выброс не оставил запас заниженным. */
+        int64_t want = over + over / 4;
+        if (want > h->margin_ns)
+            h->margin_ns = want;
+        else
+            h->margin_ns -= (h->margin_ns - want) / 64;
+        if (h->margin_ns > h->max_margin_ns)
+            h->margin_ns = h->max_margin_ns;
+    }
+    spin_until(deadline_ns);
+    return 0;
+}
+
+static int run(int mode, long num_samples, int64_t period_ns, hybrid *h, run_stats *rs) {
+    struct timespec cpu0, cpu1;
+
+    latstat_init(&rs->period);
+    latstat_init(&rs->error);
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &cpu0);
+    int64_t start_ns = mono_ns();
+    int64_t prev_ns = start_ns;
+    int64_t next_ns = start_ns + period_ns; /* стартуем через один период */
+
+    for (long i = 0; i < num_samples; ++i) {
+        int rc = wait_until(mode, next_ns, h);
+        if (rc != 0) {
+            fprintf(stderr, "clock_nanosleep failed: %s\n", strerror(rc));
+            return -1;
+        }
+        int64_t now_ns = mono_ns();
+        int64_t delta_ns = now_ns - prev_ns; /* фактическая дельта */
+        latstat_add(&rs->period, delta_ns);
+        latstat_add(&rs->error, now_ns - next_ns);
+        if (i < NUM_SHOWN)
+            rs->shown_ns[i] = delta_ns;
+        prev_ns = now_ns;
+        next_ns += period_ns;
+    }
+
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &cpu1);
+    rs->cpu_pct = 100.0 * (double)latstat_diff_ns(&cpu0, &cpu1) / (double)(mono_ns() - start_ns);
+    return 0;
+}
+
+static int usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [-n samples] [-f text|csv|json] [-w sleep|spin|hybrid|all]"
+                    " [-m margin_us] [-A]\n", prog);
+    return EXIT_FAILURE;
+}
+
+int main(int argc, char *argv[]) {
     struct timespec res_rt = {0}, res_mono = {0};
-    struct timespec t_next = {0}, now = {0};
     const int64_t period_ns = 2 * MILLION; /* 2 ms */
-    int64_t deltas_ns[NUM_SAMPLES];
-    int samples = 0;
+    long num_samples = NUM_SAMPLES;
+    long margin_us = 100;
+    int fmt = LATSTAT_TEXT;
+    int mode = WAIT_SLEEP, all = 0, adaptive = 1;
+    /* Сэмплы не хранятся: статистика потоковая, массив — только для показа первых */
+    static run_stats rs[WAIT_NMODES];
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:f:w:m:A")) != -1) {
+        switch (opt) {
+        case 'n':
+            num_samples = atol(optarg);
+            break;
+        case 'f':
+            if ((fmt = latstat_format(optarg)) < 0)
+                return usage(argv[0]);
+            break;
+        case 'w':
+            all = strcmp(optarg, "all") == 0;
+            for (mode = 0; !all && mode < WAIT_NMODES; ++mode)
+                if (strcmp(optarg, wait_names[mode]) == 0)
+                    break;
+            if (all)
+                mode = 0;
+            else if (mode == WAIT_NMODES)
+                return usage(argv[0]);
+            break;
+        case 'm':
+            margin_us = atol(optarg);
+            break;
+        case 'A':
+            adaptive = 0;
+            break;
+        default:
+            return usage(argv[0]);
+        }
+    }
+    if (num_samples <= 0 || margin_us < 0 || margin_us * 1000 > period_ns / 2)
+        return usage(argv[0]);
 
     setvbuf(stdout, NULL, _IOLBF, 0);
 
@@ -50,65 +205,64 @@ int main(void) {
         return EXIT_FAILURE;
     }
 
-    printf("Resolution: REALTIME=%ld ns, MONOTONIC=%ld ns\n",
-           (long)res_rt.tv_nsec, (long)res_mono.tv_nsec);
-
-    if (clock_gettime(CLOCK_MONOTONIC, &t_next) != 0) {
-        fprintf(stderr, "clock_gettime failed: %s\n", strerror(errno));
-        return EXIT_FAILURE;
-    }
-
-    int64_t next_ns = timespec_to_ns(&t_next) + period_ns; /* стартуем через один период */
-    for (samples = 0; samples < NUM_SAMPLES; ++samples) {
-        ns_to_timespec(next_ns, &t_next);
+    if (fmt == LATSTAT_TEXT)
+        printf("Resolution: REALTIME=%ld ns, MONOTONIC=%ld ns\n",
+               (long)res_rt.tv_nsec, (long)res_mono.tv_nsec);
 
-        /* Абсолютный сон до t_next: устойчив к дрейфу */
-        int rc;
-        do {
-            rc = clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &t_next, NULL); // TIMER_ABSTIME делает цикл привязанным к определенному, фиксированному времени
-        } while (rc == EINTR);
-        if (rc != 0) {
-            fprintf(stderr, "clock_nanosleep failed: %s\n", strerror(rc));
+    hybrid h = { margin_us * 1000, period_ns / 2, adaptive, 0 };
+    int first = mode, last = all ? WAIT_NMODES - 1 : mode;
+    for (int m = first; m <= last; ++m)
+        if (run(m, num_samples, period_ns, &h, &rs[m]) != 0)
             return EXIT_FAILURE;
-        }
 
-        if (clock_gettime(CLOCK_MONOTONIC, &now) != 0) {
-            fprintf(stderr, "clock_gettime failed: %s\n", strerror(errno));
-            return EXIT_FAILURE;
+    /* Статистика: min/avg/max, стандартное отклонение (по Уэлфорду) и перцентили.
+     * Маленькое std_dev => стабильный период. */
+    if (fmt != LATSTAT_TEXT) {
+        latstat_emit_header(stdout, fmt);
+        for (int m = first; m <= last; ++m) {
+            char name[32];
+            snprintf(name, sizeof(name), "%s_period", wait_names[m]);
+            latstat_emit(stdout, fmt, name, &rs[m].period);
+            snprintf(name, sizeof(name), "%s_error", wait_names[m]);
+            latstat_emit(stdout, fmt, name, &rs[m].error);
+            fprintf(stderr, "%s: cpu %.1f%%\n", wait_names[m], rs[m].cpu_pct);
         }
-
-        int64_t now_ns = timespec_to_ns(&now);
-        deltas_ns[samples] = now_ns - (next_ns - period_ns); /* фактическая дельта */
-
-        next_ns += period_ns;
+        return EXIT_SUCCESS;
     }
 
-    /* Статистика */
-    int64_t min_ns = INT64_MAX, max_ns = INT64_MIN, sum_ns = 0;
-    for (int i = 0; i < NUM_SAMPLES; ++i) {
-        if (deltas_ns[i] < min_ns) min_ns = deltas_ns[i];
-        if (deltas_ns[i] > max_ns) max_ns = deltas_ns[i];
-        sum_ns += deltas_ns[i];
-    }
-    double avg_ns = (double)sum_ns / (double)NUM_SAMPLES;
-
-    // --- (Новое) Расчет стандартного отклонения ---
-    // Это показывает, насколько значения разбросаны вокруг среднего.
-    // Маленькое значение => стабильный период.
-    double sum_sq_diff = 0;
-    for (int i = 0; i < NUM_SAMPLES; ++i) {
-        sum_sq_diff += pow((double)deltas_ns[i] - avg_ns, 2);
+    if (all) {
+        printf("\nWait strategies over %ld samples each (target period: %" PRId64 " ns):\n",
+               num_samples, period_ns);
+        printf("  %-7s %10s %10s %10s %12s %7s\n",
+               "wait", "err p50", "err p99", "err max", "period std", "CPU %");
+        for (int m = first; m <= last; ++m)
+            printf("  %-7s %10" PRId64 " %10" PRId64 " %10" PRId64 " %12.1f %7.1f\n",
+                   wait_names[m], latstat_percentile(&rs[m].error, 50),
+                   latstat_percentile(&rs[m].error, 99), rs[m].error.max,
+                   latstat_stddev(&rs[m].period), rs[m].cpu_pct);
+        printf("  hybrid: final margin %" PRId64 " ns, %ld wakeup(s) past the deadline\n",
+               h.margin_ns, h.late);
+        return EXIT_SUCCESS;
     }
-    double std_dev_ns = sqrt(sum_sq_diff / NUM_SAMPLES);
 
-    printf("Period stats over %d samples (target: %" PRId64 " ns):\n", NUM_SAMPLES, period_ns);
+    latstat *st = &rs[mode].period;
+    printf("Period stats over %ld samples (target: %" PRId64 " ns, wait: %s):\n",
+           num_samples, period_ns, wait_names[mode]);
     printf("  min=%" PRId64 " ns, avg=%.1f ns, max=%" PRId64 " ns, std_dev=%.1f ns\n",
-           min_ns, avg_ns, max_ns, std_dev_ns);
+           st->min, st->mean, st->max, latstat_stddev(st));
+    printf("  p50=%" PRId64 " ns, p99=%" PRId64 " ns, p99.9=%" PRId64 " ns\n",
+           latstat_percentile(st, 50), latstat_percentile(st, 99), latstat_percentile(st, 99.9));
+    printf("  wakeup error: p50=%" PRId64 " ns, p99=%" PRId64 " ns, max=%" PRId64 " ns; CPU %.1f%%\n",
+           latstat_percentile(&rs[mode].error, 50), latstat_percentile(&rs[mode].error, 99),
+           rs[mode].error.max, rs[mode].cpu_pct);
+    if (mode == WAIT_HYBRID)
+        printf("  hybrid: final margin %" PRId64 " ns, %ld wakeup(s) past the deadline\n",
+               h.margin_ns, h.late);
 
     /* Вывести первые несколько измерений для наглядности */
-    printf("\nFirst 10 samples (delta from previous actual wakeup, ns):\n");
-    for (int i = 0; i < 100 && i < NUM_SAMPLES; ++i) {
-        printf("  sample %d: %" PRId64 "\n", i, deltas_ns[i]);
+    printf("\nFirst %d samples (delta from previous actual wakeup, ns):\n", NUM_SHOWN);
+    for (long i = 0; i < NUM_SHOWN && i < num_samples; ++i) {
+        printf("  sample %ld: %" PRId64 "\n", i, rs[mode].shown_ns[i]);
     }
 
     return EXIT_SUCCESS;
@@ -143,4 +297,27 @@ int main(void) {
            num_samples, min_ns, avg, max_ns);
     return EXIT_SUCCESS;
 }
-#endif
\ No newline at end of file
+#endif
+/*
+Результаты -w all -n 2500 (ВМ, 1 CPU), err — пробуждение минус дедлайн, нс:
+
+SCHED_OTHER:
+  wait       err p50    err p99    err max   period std   CPU %
+  sleep        84735    3907583   12768098     653965.0     0.9
+  spin            76        833    1880071      85979.0    99.0
+  hybrid          93      10527    2741023      97462.8    11.9
+
+chrt -f 50:
+  wait       err p50    err p99    err max   period std   CPU %
+  sleep        31295     383999   11483398     339745.1     0.8
+  spin            83   33226751   45254723    1934715.5    95.0
+  hybrid          88      20671    2091584      64790.5     6.6
+
+Гибрид даёт медиану ошибки как у чистого опроса (~100 нс против 30-85 мкс
+у сна) при 7-12% CPU вместо 100%. Медиана сна в SCHED_OTHER включает ещё и
+timer slack (50 мкс по умолчанию), поэтому выученный запас там больше.
+Чистый опрос под SCHED_FIFO упирается в RT throttling (95% CPU): раз в
+секунду поток снимают на 50 мс, отсюда p99 в 33 мс. Хвосты в единицы мс у
+всех способов — паузы самой ВМ; после такой паузы запас вырастает до
+половины периода и за несколько сотен периодов сходит обратно.
+*/
@@ -0,0 +1,393 @@
+/*
+ * Многопоточный тест периодической задержки в духе cyclictest.
+ *
+ * На каждый выбранный CPU запускается свой измерительный поток с политикой
+ * реального времени. Поток просыпается по абсолютному clock_nanosleep с
+ * периодом interval + k * distance (k — номер потока, чтобы пробуждения
+ * разных CPU не совпадали по фазе) и записывает задержку пробуждения
+ * (фактическое время - плановое) в свою статистику latstat.
+ *
+ * Главный поток раз в секунду печатает по каждому CPU текущие
+ * min/act/avg/max, по окончании — сводку, слитую из потоков, и по
+ * желанию гистограммы. Тест идёт -D секунд или до Ctrl-C. В csv/json
+ * у гистограмм своя схема, поэтому они пишутся в отдельный файл (-o).
+ *
+ * -b порог: как breaktrace у cyclictest — первая задержка выше порога
+ * останавливает тест и выключает ftrace (tracing_on = 0), чтобы в буфере
+ * трассировки остались события, предшествовавшие всплеску.
+ *
+ * Пример:
+ *   sudo ./bin/cyclic -a 0-3 -i 1000 -d 500 -p 80 -D 60 -H
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+#include "latstat.h"
+
+#ifndef __linux__
+int main(void) {
+    printf("cyclic: Linux-only example\n");
+    return 0;
+}
+#else
+
+#define NSEC_PER_SEC 1000000000LL
+
+// Данные измерительного потока. Поля live читает главный поток для
+// вывода раз в секунду; гистограмма в st принадлежит только потоку
+// и читается после pthread_join.
+typedef struct cyc_thread {
+    int idx;
+    int cpu;
+    int64_t interval_ns;
+    pthread_t tid;
+    atomic_llong cycles;
+    atomic_llong act;
+    atomic_llong min;
+    atomic_llong max;
+    atomic_llong sum;
+    latstat st;
+} __attribute__((aligned(64))) cyc_thread;
+
+static atomic_int stop;
+static atomic_int break_thread = -1;
+static int64_t break_ns;
+static int break_traced;
+static int64_t break_threshold_ns;
+
+static void on_signal(int sig) {
+    (void)sig;
+    atomic_store(&stop, 1);
+}
+
+static inline void ns_to_ts(int64_t ns, struct timespec *ts) {
+    ts->tv_sec = (time_t)(ns / NSEC_PER_SEC);
+    ts->tv_nsec = (long)(ns % NSEC_PER_SEC);
+}
+
+// Остановить ftrace, как это делает cyclictest -b. Ошибка не фатальна:
+// tracefs может быть не смонтирован или недоступен без root
+static int trace_off(void) {
+    static const char *paths[] = {
+        "/sys/kernel/tracing/tracing_on",
+        "/sys/kernel/debug/tracing/tracing_on",
+    };
+    for (size_t i = 0; i < sizeof(paths) / sizeof(paths[0]); ++i) {
+        int fd = open(paths[i], O_WRONLY);
+        if (fd < 0)
+            continue;
+        int ok = write(fd, "0", 1) == 1;
+        close(fd);
+        if (ok)
+            return 1;
+    }
+    return 0;
+}
+
+static void *measure(void *arg) {
+    cyc_thread *t = arg;
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    int64_t next = latstat_ts_ns(&ts) + t->interval_ns;
+
+    while (!atomic_load_explicit(&stop, memory_order_relaxed)) {
+        ns_to_ts(next, &ts);
+        int rc = clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+        if (rc == EINTR)
+            continue;
+        if (rc != 0) {
+            fprintf(stderr, "cpu %d: clock_nanosleep: %s\n", t->cpu, strerror(rc));
+            break;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        int64_t lat = latstat_ts_ns(&ts) - next;
+
+        latstat_add(&t->st, lat);
+        atomic_store_explicit(&t->act, lat, memory_order_relaxed);
+        atomic_fetch_add_explicit(&t->sum, lat, memory_order_relaxed);
+        atomic_fetch_add_explicit(&t->cycles, 1, memory_order_relaxed);
+        if (lat < atomic_load_explicit(&t->min, memory_order_relaxed))
+            atomic_store_explicit(&t->min, lat, memory_order_relaxed);
+        if (lat > atomic_load_explicit(&t->max, memory_order_relaxed))
+            atomic_store_explicit(&t->max, lat, memory_order_relaxed);
+
+        if (break_threshold_ns > 0 && lat > break_threshold_ns) {
+            int none = -1;
+            // Только первый превысивший порог поток фиксирует событие
+            if (atomic_compare_exchange_strong(&break_thread, &none, t->idx)) {
+                break_traced = trace_off();
+                break_ns = lat;
+                atomic_store(&stop, 1);
+            }
+            break;
+        }
+        next += t->interval_ns;
+    }
+    return NULL;
+}
+
+// Список CPU вида "0,2-3" в маску; -1 при ошибке
+static int parse_cpus(const char *s, cpu_set_t *set) {
+    CPU_ZERO(set);
+    while (*s) {
+        char *end;
+        long lo = strtol(s, &end, 10), hi = lo;
+        if (end == s)
+            return -1;
+        if (*end == '-') {
+            s = end + 1;
+            hi = strtol(s, &end, 10);
+            if (end == s)
+                return -1;
+        }
+        if (lo < 0 || hi < lo || hi >= CPU_SETSIZE)
+            return -1;
+        for (long c = lo; c <= hi; ++c)
+            CPU_SET((int)c, set);
+        if (*end == ',')
+            ++end;
+        else if (*end != '\0')
+            return -1;
+        s = end;
+    }
+    return CPU_COUNT(set) > 0 ? 0 : -1;
+}
+
+static int parse_policy(const char *s) {
+    if (strcmp(s, "fifo") == 0) return SCHED_FIFO;
+    if (strcmp(s, "rr") == 0) return SCHED_RR;
+    if (strcmp(s, "other") == 0) return SCHED_OTHER;
+    return -1;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+            "Usage: %s [-a cpus] [-i interval_us] [-d distance_us] [-p prio] [-P fifo|rr|other]\n"
+            "          [-D seconds] [-b threshold_us] [-H] [-o file] [-q] [-f text|csv|json]\n"
+            "  -a  CPU list, e.g. 0,2-3 (default: all online)\n"
+            "  -i  base period, us (default 1000)\n"
+            "  -d  period increment per thread, us (default 500)\n"
+            "  -p  RT priority (default 80; ignored for other)\n"
+            "  -D  duration, s (default 0 = until Ctrl-C)\n"
+            "  -b  stop and freeze ftrace when latency exceeds threshold\n"
+            "  -H  print histograms at the end\n"
+            "  -o  write histograms to file (required for -H with csv/json)\n"
+            "  -q  no live output (implied by csv/json)\n",
+            prog);
+}
+
+static void print_live(cyc_thread *th, int n, int policy, int prio, int redraw) {
+    if (redraw)
+        printf("\033[%dA", n);
+    for (int i = 0; i < n; ++i) {
+        cyc_thread *t = &th[i];
+        long long c = atomic_load_explicit(&t->cycles, memory_order_relaxed);
+        long long sum = atomic_load_explicit(&t->sum, memory_order_relaxed);
+        long long min = c ? atomic_load_explicit(&t->min, memory_order_relaxed) : 0;
+        printf("T:%2d (cpu %2d) P:%2d I:%6lld C:%9lld Min:%7lld Act:%7lld Avg:%7lld Max:%8lld\n",
+               i, t->cpu, policy == SCHED_OTHER ? 0 : prio, (long long)(t->interval_ns / 1000), c,
+               min / 1000, atomic_load_explicit(&t->act, memory_order_relaxed) / 1000,
+               c ? sum / c / 1000 : 0,
+               atomic_load_explicit(&t->max, memory_order_relaxed) / 1000);
+    }
+}
+
+int main(int argc, char *argv[]) {
+    cpu_set_t cpus;
+    long interval_us = 1000, distance_us = 500, duration_s = 0, threshold_us = 0;
+    int prio = 80, policy = SCHED_FIFO, hist = 0, quiet = 0, fmt = LATSTAT_TEXT;
+    const char *hist_path = NULL;
+    int opt;
+
+    if (sched_getaffinity(0, sizeof(cpus), &cpus) != 0) {
+        perror("sched_getaffinity");
+        return EXIT_FAILURE;
+    }
+    while ((opt = getopt(argc, argv, "a:i:d:p:P:D:b:Ho:qf:")) != -1) {
+        switch (opt) {
+        case 'a':
+            if (parse_cpus(optarg, &cpus) != 0) {
+                fprintf(stderr, "bad CPU list: %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'i': interval_us = atol(optarg); break;
+        case 'd': distance_us = atol(optarg); break;
+        case 'p': prio = atoi(optarg); break;
+        case 'P': policy = parse_policy(optarg); break;
+        case 'D': duration_s = atol(optarg); break;
+        case 'b': threshold_us = atol(optarg); break;
+        case 'H': hist = 1; break;
+        case 'o': hist_path = optarg; break;
+        case 'q': quiet = 1; break;
+        case 'f': fmt = latstat_format(optarg); break;
+        default:
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (interval_us <= 0 || distance_us < 0 || duration_s < 0 || threshold_us < 0 ||
+        policy < 0 || fmt < 0) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    if (hist && fmt != LATSTAT_TEXT && !hist_path) {
+        fprintf(stderr, "-H with -f csv|json needs -o file: stdout holds only the summary rows\n");
+        return EXIT_FAILURE;
+    }
+    FILE *hist_out = stdout;
+    if (hist && hist_path && !(hist_out = fopen(hist_path, "w"))) {
+        perror(hist_path);
+        return EXIT_FAILURE;
+    }
+    if (policy == SCHED_OTHER)
+        prio = 0;
+    else if (prio < sched_get_priority_min(policy) || prio > sched_get_priority_max(policy)) {
+        fprintf(stderr, "priority %d out of range for policy\n", prio);
+        return EXIT_FAILURE;
+    }
+    break_threshold_ns = threshold_us * 1000LL;
+
+    // Страницы стеков и статистики потоков не должны добираться page fault'ами
+    if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0)
+        perror("WARNING: mlockall failed");
+
+    int n = CPU_COUNT(&cpus);
+    cyc_thread *th = aligned_alloc(64, (size_t)n * sizeof(cyc_thread));
+    if (!th) {
+        perror("aligned_alloc");
+        return EXIT_FAILURE;
+    }
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_signal;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    // Главный поток только рисует таблицу и должен вытесняться измерительными:
+    // он остаётся в SCHED_OTHER, а потоки получают политику через атрибуты
+    int started = 0;
+    for (int cpu = 0, i = 0; i < n; ++cpu) {
+        if (!CPU_ISSET(cpu, &cpus))
+            continue;
+        cyc_thread *t = &th[i];
+        t->idx = i;
+        t->cpu = cpu;
+        t->interval_ns = (interval_us + (int64_t)i * distance_us) * 1000LL;
+        atomic_init(&t->cycles, 0);
+        atomic_init(&t->act, 0);
+        atomic_init(&t->min, INT64_MAX);
+        atomic_init(&t->max, 0);
+        atomic_init(&t->sum, 0);
+        latstat_init(&t->st);
+
+        pthread_attr_t attr;
+        struct sched_param sp = {.sched_priority = prio};
+        cpu_set_t one;
+        CPU_ZERO(&one);
+        CPU_SET(cpu, &one);
+        pthread_attr_init(&attr);
+        pthread_attr_setaffinity_np(&attr, sizeof(one), &one);
+        pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+        pthread_attr_setschedpolicy(&attr, policy);
+        pthread_attr_setschedparam(&attr, &sp);
+        int rc = pthread_create(&t->tid, &attr, measure, t);
+        pthread_attr_destroy(&attr);
+        if (rc != 0) {
+            fprintf(stderr, "pthread_create (cpu %d): %s%s\n", cpu, strerror(rc),
+                    rc == EPERM ? " (RT policy needs root or CAP_SYS_NICE)" : "");
+            atomic_store(&stop, 1);
+            break;
+        }
+        started = ++i;
+    }
+
+    int live = !quiet && fmt == LATSTAT_TEXT && started == n;
+    int redraw = 0;
+    int tty = isatty(STDOUT_FILENO);
+    struct timespec t0, now;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    if (live)
+        printf("policy: %s, %d thread(s), interval %ld us, distance %ld us\n",
+               policy == SCHED_FIFO ? "fifo" : policy == SCHED_RR ? "rr" : "other",
+               n, interval_us, distance_us);
+    while (!atomic_load(&stop)) {
+        struct timespec one_sec = {1, 0};
+        nanosleep(&one_sec, NULL);
+        if (live) {
+            print_live(th, started, policy, prio, redraw && tty);
+            redraw = 1;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if (duration_s > 0 && now.tv_sec - t0.tv_sec >= duration_s)
+            atomic_store(&stop, 1);
+    }
+
+    latstat all;
+    latstat_init(&all);
+    for (int i = 0; i < started; ++i) {
+        pthread_join(th[i].tid, NULL);
+        latstat_merge(&all, &th[i].st);
+    }
+
+    int b = atomic_load(&break_thread);
+    // В csv/json stdout — только данные, сообщение о пороге уходит в stderr
+    if (b >= 0)
+        fprintf(fmt == LATSTAT_TEXT ? stdout : stderr,
+                "# Break thread %d (cpu %d): latency %" PRId64 " us > %ld us%s\n",
+                b, th[b].cpu, break_ns / 1000, threshold_us,
+                break_traced ? ", ftrace stopped" : "");
+
+    if (fmt == LATSTAT_TEXT)
+        printf("\n");
+    latstat_emit_header(stdout, fmt);
+    for (int i = 0; i < started; ++i) {
+        char name[32];
+        snprintf(name, sizeof(name), "cpu%d", th[i].cpu);
+        latstat_emit(stdout, fmt, name, &th[i].st);
+    }
+    if (started > 1)
+        latstat_emit(stdout, fmt, "all", &all);
+    if (hist) {
+        latstat_emit_hist_header(hist_out, fmt);
+        for (int i = 0; i < started; ++i) {
+            char name[32];
+            snprintf(name, sizeof(name), "cpu%d", th[i].cpu);
+            latstat_emit_hist(hist_out, fmt, name, &th[i].st);
+        }
+        if (hist_out != stdout && fclose(hist_out) != 0)
+            perror(hist_path);
+    }
+
+    free(th);
+    return started == n ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+#endif
+
+/*
+Результаты (ВМ, 1 CPU, -a 0 -i 1000 -D 10 -q):
+
+SCHED_FIFO 80:
+cpu0: n=10001 min=4666 avg=47039.0 max=7871051 std=257533.4 p50=23103 p99=310271 p99.9=4505599 ns
+
+SCHED_OTHER:
+cpu0: n=10001 min=10411 avg=94730.8 max=11169483 std=310775.7 p50=70399 p99=388095 p99.9=5718015 ns
+
+FIFO втрое снижает медиану, но хвост (p99.9, max — миллисекунды) даёт
+сама ВМ: такие паузы не убираются приоритетом. -b 300 ловит первую из
+них за доли секунды; tracefs в этой ВМ не смонтирован, поэтому ftrace
+не останавливается и сообщение об этом не выводится.
+*/
@@ -4,9 +4,20 @@
  * - SCHED_FIFO scheduler policy
  * - Pinning the thread to a specific CPU core (CPU affinity)
  * - Locking memory to prevent page faults (mlockall)
+ *
+ * -m deadline runs the same periodic job under SCHED_DEADLINE instead:
+ * the kernel releases the job every period with a runtime budget, and the
+ * job ends with sched_yield() rather than sleeping until an absolute time.
+ * Both modes record wakeup latency and deadline misses, so the two
+ * policies can be compared on the same machine:
+ *
+ *   sudo ./bin/sched_fifo_jitter -m fifo -w 300
+ *   sudo ./bin/sched_fifo_jitter -m deadline -r 500 -w 300
  */
 
+#ifndef _GNU_SOURCE
 #define _GNU_SOURCE
+#endif
 #define _POSIX_C_SOURCE 200809L
 #include <errno.h>
 #include <inttypes.h>
@@ -16,8 +27,10 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/mman.h>
+#include <sys/syscall.h>
 #include <time.h>
 #include <unistd.h>
+#include "latstat.h"
 
 #ifndef __linux__
 int main(void) {
@@ -26,34 +39,129 @@ int main(void) {
 }
 #else
 
-static int compare_i64(const void *a, const void *b) {
-    int64_t va = *(const int64_t *)a;
-    int64_t vb = *(const int64_t *)b;
-    if (va < vb) return -1;
-    if (va > vb) return 1;
-    return 0;
-}
-
-static inline int64_t ts_to_ns(const struct timespec *ts) {
-    return (int64_t)ts->tv_sec * 1000000000LL + (int64_t)ts->tv_nsec;
-}
 static inline void ns_to_ts(int64_t ns, struct timespec *ts) {
     ts->tv_sec = (time_t)(ns / 1000000000LL);
     ts->tv_nsec = (long)(ns % 1000000000LL);
 }
 
-int main(void) {
+// sched_setattr(2) has no wrapper in older glibc; this mirrors the kernel's
+// struct sched_attr (named differently so it cannot clash with newer headers).
+struct dl_attr {
+    uint32_t size;
+    uint32_t sched_policy;
+    uint64_t sched_flags;
+    int32_t sched_nice;
+    uint32_t sched_priority;
+    uint64_t sched_runtime;
+    uint64_t sched_deadline;
+    uint64_t sched_period;
+};
+
+static int set_deadline(int64_t runtime, int64_t deadline, int64_t period) {
+    struct dl_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.sched_policy = SCHED_DEADLINE;
+    attr.sched_runtime = (uint64_t)runtime;
+    attr.sched_deadline = (uint64_t)deadline;
+    attr.sched_period = (uint64_t)period;
+    return (int)syscall(SYS_sched_setattr, 0, &attr, 0);
+}
+
+static inline int64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return latstat_ts_ns(&ts);
+}
+
+// The job's "computation": spin for work_ns after the wakeup.
+static int64_t do_work(int64_t start, int64_t work_ns) {
+    int64_t t = start;
+    while (t - start < work_ns)
+        t = now_ns();
+    return t;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+            "Usage: %s [-m fifo|deadline] [-n samples] [-p period_us] [-w work_us]\n"
+            "          [-r runtime_us] [-d deadline_us] [-f text|csv|json]\n"
+            "  -w  busy work per job (default 0)\n"
+            "  -r  SCHED_DEADLINE runtime budget (default 500 us)\n"
+            "  -d  relative deadline, both modes (default = period)\n",
+            prog);
+}
+
+int main(int argc, char *argv[]) {
+    long samples = 5000;
+    long period_us = 2000, work_us = 0, runtime_us = 500, deadline_us = 0;
+    int deadline_mode = 0;
+    int fmt = LATSTAT_TEXT;
+    int opt;
+    while ((opt = getopt(argc, argv, "m:n:p:w:r:d:f:")) != -1) {
+        switch (opt) {
+        case 'm':
+            if (strcmp(optarg, "deadline") == 0) {
+                deadline_mode = 1;
+            } else if (strcmp(optarg, "fifo") != 0) {
+                usage(argv[0]);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'n':
+            samples = atol(optarg);
+            break;
+        case 'p':
+            period_us = atol(optarg);
+            break;
+        case 'w':
+            work_us = atol(optarg);
+            break;
+        case 'r':
+            runtime_us = atol(optarg);
+            break;
+        case 'd':
+            deadline_us = atol(optarg);
+            break;
+        case 'f':
+            if ((fmt = latstat_format(optarg)) < 0) {
+                usage(argv[0]);
+                return EXIT_FAILURE;
+            }
+            break;
+        default:
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (deadline_us == 0)
+        deadline_us = period_us;
+    if (samples <= 0 || period_us <= 0 || work_us < 0 || deadline_us < 0 ||
+        deadline_us > period_us || (deadline_mode && (runtime_us <= 0 || runtime_us > deadline_us))) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    const int64_t period = period_us * 1000LL;
+    const int64_t deadline = deadline_us * 1000LL;
+    const int64_t work = work_us * 1000LL;
+    const char *mode = deadline_mode ? "deadline" : "fifo";
+
     setvbuf(stdout, NULL, _IOLBF, 0);
+    // В csv/json stdout — только данные, сообщения о настройке уходят в stderr
+    FILE *info = fmt == LATSTAT_TEXT ? stdout : stderr;
 
     // --- 1. Set SCHED_FIFO policy ---
     // This is the most crucial step. It moves the thread to a real-time scheduler
     // that preempts all non-RT threads (SCHED_OTHER/NORMAL).
     // Requires root or CAP_SYS_NICE capability.
+    // In deadline mode the policy is set right before the loop instead.
     struct sched_param sp = {.sched_priority = 50};
-    if (sched_setscheduler(0, SCHED_FIFO, &sp) != 0) {
-        perror("WARNING: sched_setscheduler failed; continuing with default scheduler");
-    } else {
-        printf("Switched to SCHED_FIFO priority %d\n", sp.sched_priority);
+    if (!deadline_mode) {
+        if (sched_setscheduler(0, SCHED_FIFO, &sp) != 0) {
+            perror("WARNING: sched_setscheduler failed; continuing with default scheduler");
+        } else {
+            fprintf(info, "Switched to SCHED_FIFO priority %d\n", sp.sched_priority);
+        }
     }
 
     // --- 2. Lock memory pages ---
@@ -66,8 +174,11 @@ int main(void) {
     // --- 3. Set CPU affinity ---
     // Pinning the thread to a single CPU core prevents the scheduler from migrating
     // it, which would otherwise flush CPU caches and TLBs, causing latency spikes.
+    // SCHED_DEADLINE admission control works per root domain: the kernel
+    // refuses sched_setattr for a task whose affinity is narrower, so
+    // deadline mode is left unpinned.
     long n_cpus = sysconf(_SC_NPROCESSORS_ONLN);
-    if (n_cpus > 0) {
+    if (n_cpus > 0 && !deadline_mode) {
         cpu_set_t cpu_set;
         CPU_ZERO(&cpu_set);
         // Pin to the last core as it's often less busy with system tasks.
@@ -75,54 +186,124 @@ int main(void) {
         if (pthread_setaffinity_np(pthread_self(), sizeof(cpu_set), &cpu_set) != 0) {
             perror("WARNING: pthread_setaffinity_np failed");
         } else {
-            printf("Pinned thread to CPU %ld\n", n_cpus - 1);
+            fprintf(info, "Pinned thread to CPU %ld\n", n_cpus - 1);
         }
     }
 
-    const int64_t period = 2 * 1000000LL; /* 2ms */
-    const int samples = 5000;
-    int64_t deltas[samples]; // Store all deltas for percentile calculation
-
-    struct timespec next;
-    clock_gettime(CLOCK_MONOTONIC, &next);
-    int64_t next_ns = ts_to_ns(&next) + period;
-
-    for (int i = 0; i < samples; ++i) {
-        ns_to_ts(next_ns, &next);
-        int rc;
-        // Absolute wait is crucial to prevent period drift.
-        do {
-            rc = clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
-        } while (rc == EINTR);
-        if (rc != 0) {
-            fprintf(stderr, "clock_nanosleep: %s\n", strerror(rc));
+    // Streaming statistics: memory does not grow with the number of samples,
+    // percentiles come from a log-linear histogram.
+    // latency: wakeup - release; response: job end - release.
+    // anchored: deadline mode, latency after the first period restart (see below).
+    latstat st, resp, anchored;
+    latstat_init(&st);
+    latstat_init(&resp);
+    latstat_init(&anchored);
+    long misses = 0;
+    long restarts = 0;
+    int resync = 0;
+
+    int64_t release;
+    if (deadline_mode) {
+        // The first period starts when the policy is applied. Taking the time
+        // before the call makes the computed release times slightly early,
+        // so latencies on this grid are never understated.
+        release = now_ns();
+        if (set_deadline(runtime_us * 1000LL, deadline, period) != 0) {
+            perror("sched_setattr(SCHED_DEADLINE) failed; needs root and free DL bandwidth");
             return EXIT_FAILURE;
         }
+        fprintf(info, "Switched to SCHED_DEADLINE runtime %ld us, deadline %ld us, period %ld us\n",
+                runtime_us, deadline_us, period_us);
+    } else {
+        release = now_ns();
+    }
+
+    for (long i = 0; i < samples; ++i) {
+        release += period;
+        if (deadline_mode) {
+            // End of the job: give the rest of the budget back and sleep until
+            // the kernel releases the next instance at the period boundary.
+            sched_yield();
+        } else {
+            struct timespec next;
+            ns_to_ts(release, &next);
+            int rc;
+            // Absolute wait is crucial to prevent period drift.
+            do {
+                rc = clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+            } while (rc == EINTR);
+            if (rc != 0) {
+                fprintf(stderr, "clock_nanosleep: %s\n", strerror(rc));
+                return EXIT_FAILURE;
+            }
+        }
+
+        int64_t wake = now_ns();
+        if (deadline_mode && (resync || wake < release || wake - release >= period)) {
+            // After a missed deadline the kernel does not keep the old grid:
+            // it starts a new period at replenishment, and that moment is not
+            // visible to the task. The grid is re-anchored to this wakeup,
+            // which is itself late by one wakeup latency, so every later
+            // sample is understated by about that much. Such samples go to
+            // a separate statistic (a lower bound), the restart wakeup is not
+            // recorded at all, and periods skipped on the way are misses.
+            if (!resync && wake > release)
+                misses += (wake - release) / period;
+            release = wake;
+            resync = 0;
+            restarts++;
+        } else {
+            // The "error" or "jitter" for this cycle.
+            // It's the difference between when we woke up and when we *should* have.
+            latstat_add(restarts ? &anchored : &st, wake - release);
+        }
 
-        struct timespec now;
-        clock_gettime(CLOCK_MONOTONIC, &now);
-        // The "error" or "jitter" for this cycle.
-        // It's the difference between when we woke up and when we *should* have.
-        deltas[i] = ts_to_ns(&now) - next_ns;
-        next_ns += period;
+        int64_t done = do_work(wake, work);
+        latstat_add(&resp, done - release);
+        if (done - release > deadline) {
+            misses++;
+            resync = deadline_mode;
+        }
     }
 
     // --- Statistics ---
-    qsort(deltas, samples, sizeof(int64_t), compare_i64);
-    int64_t min = deltas[0];
-    int64_t max = deltas[samples - 1];
-    int64_t p99 = deltas[(samples * 99) / 100];
-    int64_t sum = 0;
-    for (int i = 0; i < samples; ++i) {
-        sum += deltas[i];
+    if (fmt != LATSTAT_TEXT) {
+        char name[32];
+        latstat_emit_header(stdout, fmt);
+        latstat_emit(stdout, fmt, mode, &st);
+        snprintf(name, sizeof(name), "%s_response", mode);
+        latstat_emit(stdout, fmt, name, &resp);
+        if (deadline_mode) {
+            snprintf(name, sizeof(name), "%s_anchored", mode);
+            latstat_emit(stdout, fmt, name, &anchored);
+        }
+        fprintf(stderr, "deadline misses: %ld of %ld, period restarts: %ld\n", misses, samples, restarts);
+        return 0;
     }
-    double avg = (double)sum / (double)samples;
 
-    printf("\nJitter statistics over %d samples (2ms period):\n", samples);
-    printf("  min latency: %" PRId64 " ns\n", min);
-    printf("  avg latency: %.1f ns\n", avg);
-    printf("  99th percentile: %" PRId64 " ns\n", p99);
-    printf("  max latency: %" PRId64 " ns\n", max);
+    printf("\nJitter statistics over %" PRIu64 " samples (%ld us period, %s):\n", st.n, period_us, mode);
+    if (st.n > 0) {
+        printf("  min latency: %" PRId64 " ns\n", st.min);
+        printf("  avg latency: %.1f ns\n", st.mean);
+        printf("  std deviation: %.1f ns\n", latstat_stddev(&st));
+        printf("  99th percentile: %" PRId64 " ns\n", latstat_percentile(&st, 99));
+        printf("  99.9th percentile: %" PRId64 " ns\n", latstat_percentile(&st, 99.9));
+        printf("  max latency: %" PRId64 " ns\n", st.max);
+    } else {
+        // Deadline mode: the very first job already restarted the period
+        printf("  no samples on the exact grid\n");
+    }
+    printf("  response (release -> job end): p99 %" PRId64 " ns, max %" PRId64 " ns\n",
+           latstat_percentile(&resp, 99), resp.max);
+    printf("  deadline misses (> %ld us): %ld (%.2f%%)\n", deadline_us, misses,
+           100.0 * (double)misses / (double)samples);
+    if (deadline_mode && restarts) {
+        // The rows above cover only the wakeups before the first restart.
+        printf("  period restarts: %ld; after the first one (re-anchored, lower bound):\n", restarts);
+        printf("    %" PRIu64 " samples, avg %.1f ns, p99 %" PRId64 " ns, p99.9 %" PRId64 " ns, max %" PRId64 " ns\n",
+               anchored.n, anchored.mean, latstat_percentile(&anchored, 99),
+               latstat_percentile(&anchored, 99.9), anchored.n ? anchored.max : 0);
+    }
 
     return 0;
 }
@@ -156,4 +337,27 @@ pinning (affinity) — исключается миграция между CPU, 
 99th percentile - это как часто случаются редкие, но большие задержки. Пример:
 Если 5000 измерений → 99% = позиция 4950-я после сортировки.
 Вот это число и называется 99-й персентиль.
-*/
\ No newline at end of file
+
+FIFO против DEADLINE (ВМ, 1 CPU, -n 5000 -w 300, период 2 мс):
+
+-m fifo (приоритет 50):
+  avg 56 us, p99 172 us, p99.9 6.80 ms, max 8.48 ms
+  response p99 507 us, deadline misses 25 (0.50%)
+
+-m deadline -r 500:
+  до первого перезапуска периода (686 сэмплов, точная сетка):
+    avg 30 us, p99 71 us, max 121 us
+  после него (4189 сэмплов, сетка от пробуждения — нижняя оценка):
+    avg 28 us, p99 321 us, p99.9 1.70 ms, max 1.99 ms
+  response p99 580 us, deadline misses 43 (0.86%), period restarts 125
+
+Промахи в обоих режимах дают паузы самой ВМ. Точно измерить DEADLINE
+удаётся только до первого промаха: дальше ядро начинает новый период в
+момент пополнения бюджета, а задача этот момент не видит. Сетка
+переносится на пробуждение после перезапуска, поэтому последующие
+задержки занижены примерно на одну латентность пробуждения, а всё, что
+дольше периода, считается новым перезапуском, а не задержкой (отсюда
+max < 2 ms). Сравнивать с FIFO честно только первую строку: на ней
+DEADLINE не хуже FIFO, но выборка короткая; вывод про «хвост на порядок
+короче» по второй строке сделать нельзя.
+*/
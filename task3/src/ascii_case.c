@@ -0,0 +1,110 @@
+/*
+ * Векторное преобразование ASCII в верхний регистр
+ *
+ * Идея: байт c — строчная буква, если 'a' <= c <= 'z'. Для 16 (SSE2) или
+ * 32 (AVX2) байт сразу строим маску сравнениями и сбрасываем у выбранных байт
+ * бит 0x20. Ветвлений по данным нет, хвост короче вектора обрабатывается
+ * скалярно тем же безветвленным выражением.
+ *
+ * Сравнение _mm_cmpgt_epi8 знаковое: байты >= 0x80 отрицательны и в диапазон
+ * 'a'..'z' не попадают, поэтому UTF-8 не портится.
+ */
+#include "ascii_case.h"
+#include <stdint.h>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define HAVE_X86_SIMD 1
+#endif
+
+/*
+ * Скалярная версия — эталон для сравнения. Автовекторизацию отключаем,
+ * иначе на -O2/-O3 компилятор сам сделает из неё SSE-код.
+ */
+#if defined(__GNUC__) && !defined(__clang__)
+__attribute__((optimize("no-tree-vectorize")))
+#endif
+void ascii_upper_scalar(char *buf, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        unsigned char c = (unsigned char)buf[i];
+        buf[i] = (char)(c ^ (((unsigned char)(c - 'a') < 26) << 5));
+    }
+}
+
+#ifdef HAVE_X86_SIMD
+void ascii_upper_sse2(char *buf, size_t len) {
+    const __m128i lo = _mm_set1_epi8('a' - 1);
+    const __m128i hi = _mm_set1_epi8('z' + 1);
+    const __m128i bit = _mm_set1_epi8(0x20);
+    size_t i = 0;
+
+    for (; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(buf + i));
+        __m128i is_lower = _mm_and_si128(_mm_cmpgt_epi8(v, lo), _mm_cmplt_epi8(v, hi));
+        v = _mm_xor_si128(v, _mm_and_si128(is_lower, bit));
+        _mm_storeu_si128((__m128i *)(buf + i), v);
+    }
+    ascii_upper_scalar(buf + i, len - i);
+}
+
+__attribute__((target("avx2")))
+void ascii_upper_avx2(char *buf, size_t len) {
+    const __m256i lo = _mm256_set1_epi8('a' - 1);
+    const __m256i hi = _mm256_set1_epi8('z' + 1);
+    const __m256i bit = _mm256_set1_epi8(0x20);
+    size_t i = 0;
+
+    for (; i + 32 <= len; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(buf + i));
+        __m256i is_lower = _mm256_and_si256(_mm256_cmpgt_epi8(v, lo), _mm256_cmpgt_epi8(hi, v));
+        v = _mm256_xor_si256(v, _mm256_and_si256(is_lower, bit));
+        _mm256_storeu_si256((__m256i *)(buf + i), v);
+    }
+    // Хвост 16..31 байт ещё выгодно отдать SSE2, остаток — скалярно
+    ascii_upper_sse2(buf + i, len - i);
+}
+
+int ascii_upper_have_avx2(void) {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+}
+#endif
+
+typedef void (*upper_fn)(char *, size_t);
+
+static void upper_resolve(char *buf, size_t len);
+
+// Первый вызов идёт через upper_resolve, который подменяет указатель
+static _Atomic upper_fn upper_impl = upper_resolve;
+static const char *_Atomic upper_name = "unresolved";
+
+static upper_fn upper_select(void) {
+#ifdef HAVE_X86_SIMD
+    if (ascii_upper_have_avx2()) {
+        upper_name = "avx2";
+        return ascii_upper_avx2;
+    }
+    // SSE2 входит в базовый набор x86-64
+    upper_name = "sse2";
+    return ascii_upper_sse2;
+#else
+    upper_name = "scalar";
+    return ascii_upper_scalar;
+#endif
+}
+
+static void upper_resolve(char *buf, size_t len) {
+    upper_fn fn = upper_select();
+    upper_impl = fn;
+    fn(buf, len);
+}
+
+void ascii_upper(char *buf, size_t len) {
+    upper_impl(buf, len);
+}
+
+const char *ascii_upper_impl(void) {
+    if (upper_impl == upper_resolve)
+        upper_impl = upper_select();
+    return upper_name;
+}
@@ -0,0 +1,32 @@
+#ifndef ASCII_CASE_H
+#define ASCII_CASE_H
+
+#include <stddef.h>
+
+/**
+ * @brief Переводит ASCII-буквы a-z в A-Z "на месте".
+ *
+ * Работает с буфером известной длины, '\0' не ищет и не требует.
+ * Байты вне a-z (в том числе UTF-8 последовательности) не меняются.
+ * Реализация (AVX2, SSE2 или скалярная) выбирается при первом вызове
+ * по возможностям процессора.
+ *
+ * @param buf Буфер.
+ * @param len Длина буфера в байтах.
+ */
+void ascii_upper(char *buf, size_t len);
+
+/**
+ * @brief Имя реализации, которую выбрал ascii_upper().
+ */
+const char *ascii_upper_impl(void);
+
+// Отдельные реализации — для бенчмарка и проверки на совпадение
+void ascii_upper_scalar(char *buf, size_t len);
+#if defined(__x86_64__)
+void ascii_upper_sse2(char *buf, size_t len);
+void ascii_upper_avx2(char *buf, size_t len);   // вызывать только если есть AVX2
+int ascii_upper_have_avx2(void);
+#endif
+
+#endif // ASCII_CASE_H
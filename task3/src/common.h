@@ -1,11 +1,43 @@
 #ifndef COMMON_H
 #define COMMON_H
 
+#include <stddef.h>
+#include <stdint.h>
+
 #define SERVER_QUEUE_NAME   "/mq_server_ex"
 #define CLIENT_QUEUE_NAME   "/mq_client_ex"
+// Очередь ответов у каждого клиента своя: CLIENT_QUEUE_NAME + "." + client_id
+#define CLIENT_QUEUE_FMT    CLIENT_QUEUE_NAME ".%u"
+#define CLIENT_QUEUE_NAME_MAX 64
 #define MAX_MSG_SIZE        256
 
 #define MSG_PRIO_NORMAL     1
 #define MSG_PRIO_HIGH       10
 
+/*
+ * Сообщение запроса/ответа. По очереди передаётся только MQ_HDR_SIZE + len байт.
+ * Сервер может упаковать несколько ответов одному клиенту в одно сообщение MQ:
+ * записи идут подряд, каждая начинается с границы MQ_REC_SIZE предыдущей.
+ *
+ * Новое поле заголовка нужно добавить и в MQ_HDR_FIELDS_SIZE: text
+ * сокращается на его размер, и сообщение по-прежнему равно mq_msgsize.
+ * Проверки ниже не дадут собрать программу, если об этом забыть.
+ */
+#define MQ_HDR_FIELDS_SIZE  (3 * sizeof(uint32_t) + sizeof(uint64_t))
+
+typedef struct {
+    uint32_t client_id;     // ключ кэша очередей ответа на сервере
+    uint32_t req_id;        // сопоставление ответа запросу
+    uint64_t t_send_ns;     // CLOCK_MONOTONIC клиента в момент отправки, сервер возвращает как есть
+    uint32_t len;           // длина текста без завершающего '\0'
+    char text[MAX_MSG_SIZE - MQ_HDR_FIELDS_SIZE];
+} mq_msg_t;
+
+#define MQ_HDR_SIZE         offsetof(mq_msg_t, text)
+#define MQ_MAX_TEXT         (MAX_MSG_SIZE - MQ_HDR_SIZE)
+#define MQ_REC_SIZE(len)    ((MQ_HDR_SIZE + (len) + 7) & ~(size_t)7)
+
+_Static_assert(MQ_HDR_SIZE == MQ_HDR_FIELDS_SIZE, "MQ_HDR_FIELDS_SIZE must match the mq_msg_t header");
+_Static_assert(sizeof(mq_msg_t) == MAX_MSG_SIZE, "mq_msg_t must fill exactly one MQ message");
+
 #endif // COMMON_H
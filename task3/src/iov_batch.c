@@ -0,0 +1,397 @@
+/*
+ * Пакетная (batched) передача сообщений через writev/readv
+ *
+ * iov_demo.c отправляет одно сообщение за один writev, поэтому поток мелких
+ * сообщений всё равно стоит одного системного вызова на сообщение.
+ * Здесь writer накапливает сообщения в пакет и сбрасывает его одним writev,
+ * когда срабатывает любой из порогов:
+ *  - число сегментов iovec достигло IOV_MAX (или заданного лимита сообщений);
+ *  - самое старое сообщение в пакете ждёт дольше max_delay (добавленная задержка).
+ * Reader симметрично читает сразу много кадров одним readv.
+ *
+ * Программа прогоняет pipe и UNIX-сокет с разными лимитами пакета и печатает
+ * число системных вызовов на сообщение, сообщения в секунду и задержку доставки.
+ *
+ * Запуск: ./bin/iov_batch [-n сообщений] [-d макс_задержка_мкс] [-g пауза_между_сообщениями_мкс]
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+
+#define SEGS_PER_MSG    4                           // type, id, timestamp, payload
+#define BATCH_MAX_MSGS  (IOV_MAX / SEGS_PER_MSG)    // столько сообщений влезает в один writev
+#define PAYLOAD_SIZE    20
+
+typedef struct {
+    uint32_t msg_type;
+    uint64_t msg_id;
+    uint64_t t_enq_ns;  // момент постановки в пакет — для оценки добавленной задержки
+    char payload[PAYLOAD_SIZE];
+} message_t;
+
+// Размер кадра "на проводе": поля без выравнивающих дыр структуры
+#define FRAME_SIZE (sizeof(uint32_t) + 2 * sizeof(uint64_t) + PAYLOAD_SIZE)
+
+typedef struct {
+    int fd;
+    // Сообщения живут в слотах до flush: iovec указывают прямо на поля,
+    // поэтому копирования в промежуточный буфер нет.
+    message_t slots[BATCH_MAX_MSGS];
+    struct iovec iov[BATCH_MAX_MSGS * SEGS_PER_MSG];
+    int count;              // сообщений в текущем пакете
+    int max_msgs;           // кадры одного размера, так что это и лимит в байтах
+    int64_t max_delay_ns;
+    int64_t oldest_ns;      // t_enq первого сообщения пакета
+    unsigned long syscalls;
+} batch_writer_t;
+
+typedef struct {
+    int fd;
+    message_t slots[BATCH_MAX_MSGS];
+    struct iovec iov[BATCH_MAX_MSGS * SEGS_PER_MSG];
+    int max_msgs;
+    unsigned long syscalls;
+} batch_reader_t;
+
+static int64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void sleep_until(int64_t t_ns) {
+    struct timespec ts = { .tv_sec = t_ns / 1000000000LL, .tv_nsec = t_ns % 1000000000LL };
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+        ;
+}
+
+static void fill_iov(struct iovec *iov, message_t *m) {
+    iov[0].iov_base = &m->msg_type;
+    iov[0].iov_len = sizeof(m->msg_type);
+    iov[1].iov_base = &m->msg_id;
+    iov[1].iov_len = sizeof(m->msg_id);
+    iov[2].iov_base = &m->t_enq_ns;
+    iov[2].iov_len = sizeof(m->t_enq_ns);
+    iov[3].iov_base = m->payload;
+    iov[3].iov_len = PAYLOAD_SIZE;
+}
+
+// Сдвигает массив iovec на n уже переданных байт (частичная запись/чтение)
+static void iov_advance(struct iovec **iov, int *cnt, size_t n) {
+    while (*cnt > 0 && n >= (*iov)->iov_len) {
+        n -= (*iov)->iov_len;
+        (*iov)++;
+        (*cnt)--;
+    }
+    if (*cnt > 0) {
+        (*iov)->iov_base = (char *)(*iov)->iov_base + n;
+        (*iov)->iov_len -= n;
+    }
+}
+
+// ---------------------------- Writer ----------------------------
+
+static void batch_writer_init(batch_writer_t *b, int fd, int max_msgs, int64_t max_delay_ns) {
+    memset(b, 0, sizeof(*b));
+    b->fd = fd;
+    b->max_msgs = max_msgs < 1 ? 1 : (max_msgs > BATCH_MAX_MSGS ? BATCH_MAX_MSGS : max_msgs);
+    b->max_delay_ns = max_delay_ns;
+}
+
+static int batch_flush(batch_writer_t *b) {
+    struct iovec *iov = b->iov;
+    int cnt = b->count * SEGS_PER_MSG;
+
+    while (cnt > 0) {
+        ssize_t n = writev(b->fd, iov, cnt);
+        b->syscalls++;
+        if (n == -1) {
+            if (errno == EINTR)
+                continue;
+            perror("writev");
+            return -1;
+        }
+        iov_advance(&iov, &cnt, (size_t)n);
+    }
+    b->count = 0;
+    return 0;
+}
+
+// Возвращает слот для заполнения; если пакет полон — сначала сбрасывает его.
+// NULL — сброс не удался
+static message_t *batch_next(batch_writer_t *b) {
+    if (b->count == b->max_msgs && batch_flush(b) == -1)
+        return NULL;
+    return &b->slots[b->count];
+}
+
+// Фиксирует заполненный слот в пакете и проверяет пороги сброса
+static int batch_commit(batch_writer_t *b) {
+    message_t *m = &b->slots[b->count];
+    fill_iov(&b->iov[b->count * SEGS_PER_MSG], m);
+    if (b->count == 0)
+        b->oldest_ns = (int64_t)m->t_enq_ns;
+    b->count++;
+
+    if (b->count >= b->max_msgs || now_ns() - b->oldest_ns >= b->max_delay_ns)
+        return batch_flush(b);
+    return 0;
+}
+
+// Момент, когда пакет обязан уйти по порогу задержки (-1, если пакет пуст)
+static int64_t batch_deadline(const batch_writer_t *b) {
+    return b->count > 0 ? b->oldest_ns + b->max_delay_ns : -1;
+}
+
+// ---------------------------- Reader ----------------------------
+
+static void batch_reader_init(batch_reader_t *r, int fd, int max_msgs) {
+    memset(r, 0, sizeof(*r));
+    r->fd = fd;
+    r->max_msgs = max_msgs < 1 ? 1 : (max_msgs > BATCH_MAX_MSGS ? BATCH_MAX_MSGS : max_msgs);
+}
+
+/*
+ * Читает до max_msgs кадров одним readv. Если последний кадр пришёл не целиком,
+ * дочитывает только его хвост. Возвращает число целых сообщений в slots,
+ * 0 при EOF и -1 при ошибке.
+ */
+static int batch_read(batch_reader_t *r) {
+    for (int i = 0; i < r->max_msgs; i++)
+        fill_iov(&r->iov[i * SEGS_PER_MSG], &r->slots[i]);
+
+    ssize_t n;
+    do {
+        n = readv(r->fd, r->iov, r->max_msgs * SEGS_PER_MSG);
+        r->syscalls++;
+    } while (n == -1 && errno == EINTR);
+    if (n <= 0) {
+        if (n == -1)
+            perror("readv");
+        return (int)n;
+    }
+
+    int msgs = (int)((size_t)n / FRAME_SIZE);
+    size_t rem = (size_t)n % FRAME_SIZE;
+    if (rem == 0)
+        return msgs;
+
+    struct iovec *iov = &r->iov[msgs * SEGS_PER_MSG];
+    int cnt = SEGS_PER_MSG;
+    iov_advance(&iov, &cnt, rem);
+    while (cnt > 0) {
+        n = readv(r->fd, iov, cnt);
+        r->syscalls++;
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n <= 0) {
+            fprintf(stderr, "readv: truncated frame\n");
+            return -1;
+        }
+        iov_advance(&iov, &cnt, (size_t)n);
+    }
+    return msgs + 1;
+}
+
+// ---------------------------- Benchmark ----------------------------
+
+typedef struct {
+    int fd;
+    int max_msgs;
+    long received;
+    long errors;
+    unsigned long syscalls;
+    int64_t lat_sum_ns;
+    int64_t lat_max_ns;
+} reader_ctx_t;
+
+static void *reader_thread(void *arg) {
+    reader_ctx_t *ctx = arg;
+    batch_reader_t *r = malloc(sizeof(*r));
+    if (!r) {
+        perror("malloc");
+        return NULL;
+    }
+    batch_reader_init(r, ctx->fd, ctx->max_msgs);
+
+    int got;
+    while ((got = batch_read(r)) > 0) {
+        int64_t t = now_ns();
+        for (int i = 0; i < got; i++) {
+            const message_t *m = &r->slots[i];
+            if (m->msg_id != (uint64_t)ctx->received)
+                ctx->errors++;
+            int64_t lat = t - (int64_t)m->t_enq_ns;
+            ctx->lat_sum_ns += lat;
+            if (lat > ctx->lat_max_ns)
+                ctx->lat_max_ns = lat;
+            ctx->received++;
+        }
+    }
+    ctx->syscalls = r->syscalls;
+    free(r);
+    return NULL;
+}
+
+// Ждёт момента отправки следующего сообщения, не пропуская дедлайн пакета
+static int wait_next_send(batch_writer_t *b, int64_t t_send) {
+    for (;;) {
+        int64_t dl = batch_deadline(b);
+        if (dl >= 0 && dl < t_send) {
+            sleep_until(dl);
+            if (batch_flush(b) == -1)
+                return -1;
+        } else {
+            sleep_until(t_send);
+            return 0;
+        }
+    }
+}
+
+static int run_case(const char *transport, int max_msgs, long n_msgs, int64_t max_delay_ns, int64_t gap_ns) {
+    int fds[2];
+    if (strcmp(transport, "pipe") == 0) {
+        if (pipe(fds) == -1) {
+            perror("pipe");
+            return -1;
+        }
+    } else {
+        int sv[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == -1) {
+            perror("socketpair");
+            return -1;
+        }
+        fds[0] = sv[0];
+        fds[1] = sv[1];
+    }
+
+    reader_ctx_t rctx = { .fd = fds[0], .max_msgs = max_msgs };
+    pthread_t th;
+    if (pthread_create(&th, NULL, reader_thread, &rctx) != 0) {
+        perror("pthread_create");
+        close(fds[0]);
+        close(fds[1]);
+        return -1;
+    }
+
+    batch_writer_t *b = malloc(sizeof(*b));
+    if (!b) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    batch_writer_init(b, fds[1], max_msgs, max_delay_ns);
+
+    int64_t t_start = now_ns();
+    int64_t t_send = t_start;
+    int failed = 0;
+    for (long i = 0; i < n_msgs && !failed; i++) {
+        if (gap_ns > 0) {
+            if (wait_next_send(b, t_send) == -1) {
+                failed = 1;
+                break;
+            }
+            t_send += gap_ns;
+        }
+        message_t *m = batch_next(b);
+        if (!m) {
+            failed = 1;
+            break;
+        }
+        m->msg_type = 1;
+        m->msg_id = (uint64_t)i;
+        snprintf(m->payload, PAYLOAD_SIZE, "msg %ld", i % 100000000);
+        m->t_enq_ns = (uint64_t)now_ns();
+        if (batch_commit(b) == -1)
+            failed = 1;
+    }
+    if (!failed && batch_flush(b) == -1)
+        failed = 1;
+    // Закрытие пишущего конца даёт читателю EOF
+    if (strcmp(transport, "pipe") == 0)
+        close(fds[1]);
+    else
+        shutdown(fds[1], SHUT_WR);
+
+    pthread_join(th, NULL);
+    int64_t elapsed = now_ns() - t_start;
+
+    double msgs = rctx.received > 0 ? (double)rctx.received : 1.0;
+    printf("%-6s %6d %12.3f %12.3f %14.0f %12.1f %12.1f%s\n",
+           transport, max_msgs,
+           (double)b->syscalls / msgs,
+           (double)rctx.syscalls / msgs,
+           rctx.received / (elapsed / 1e9),
+           rctx.lat_sum_ns / msgs / 1000.0,
+           rctx.lat_max_ns / 1000.0,
+           (rctx.errors || rctx.received != n_msgs) ? "  (MISMATCH)" : "");
+
+    if (strcmp(transport, "pipe") != 0)
+        close(fds[1]);
+    close(fds[0]);
+    free(b);
+    return failed ? -1 : 0;
+}
+
+int main(int argc, char *argv[]) {
+    long n_msgs = 200000;
+    long max_delay_us = 1000;
+    long gap_us = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:d:g:")) != -1) {
+        switch (opt) {
+        case 'n': n_msgs = atol(optarg); break;
+        case 'd': max_delay_us = atol(optarg); break;
+        case 'g': gap_us = atol(optarg); break;
+        default:
+            fprintf(stderr, "usage: %s [-n msgs] [-d max_delay_us] [-g gap_us]\n", argv[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (n_msgs <= 0) {
+        fprintf(stderr, "-n must be positive\n");
+        exit(EXIT_FAILURE);
+    }
+
+    const int limits[] = { 1, 4, 16, 64, BATCH_MAX_MSGS };
+    const char *transports[] = { "pipe", "socket" };
+
+    printf("messages=%ld, frame=%zu B, max added latency=%ld us, gap=%ld us, IOV_MAX=%d\n",
+           n_msgs, FRAME_SIZE, max_delay_us, gap_us, IOV_MAX);
+    printf("(batch=1 — небатченный путь: один writev на сообщение, как в iov_demo.c)\n\n");
+    printf("%-6s %6s %12s %12s %14s %12s %12s\n",
+           "fd", "batch", "writev/msg", "readv/msg", "msgs/s", "avg_lat_us", "max_lat_us");
+
+    for (size_t t = 0; t < sizeof(transports) / sizeof(transports[0]); t++) {
+        for (size_t i = 0; i < sizeof(limits) / sizeof(limits[0]); i++) {
+            if (run_case(transports[t], limits[i], n_msgs, max_delay_us * 1000, gap_us * 1000) == -1)
+                exit(EXIT_FAILURE);
+        }
+    }
+    return 0;
+}
+
+/*
+ * Выводы:
+ *  - При batch=1 на каждое сообщение приходится ровно один writev и один readv;
+ *    стоимость системного вызова доминирует над копированием 40 байт.
+ *  - С ростом пакета число вызовов на сообщение падает как 1/batch, а пропускная
+ *    способность растёт, пока не упрётся в копирование данных ядром.
+ *  - Цена — добавленная задержка: сообщение ждёт, пока пакет наполнится. -d
+ *    ограничивает таймер сброса, а не наблюдаемую задержку. При -g 50 -d 200
+ *    (1 CPU, ВМ) avg_lat_us растёт с 4-10 мкс при batch=1 до ~130 мкс при
+ *    batch>=16, то есть в пределах -d, но max_lat_us — 0.6-3.9 мс при любом
+ *    размере пакета, включая batch=1: хвост дают паузы планировщика и ВМ,
+ *    и таймер пакета их не ограничивает.
+ *  - Слоты пакета нельзя переиспользовать до flush: writev читает данные прямо
+ *    из них, поэтому writer сам владеет памятью сообщений.
+ */
@@ -0,0 +1,395 @@
+/*
+ * Передача через pipe без копирования: vmsplice/splice против writev/readv
+ *
+ * В iov_demo.c данные копируются дважды: writev копирует их из памяти
+ * процесса в буфер pipe, readv — обратно. Для полезной нагрузки в килобайты
+ * и больше эти копии становятся основной статьёй расходов CPU.
+ *
+ * Режим zerocopy:
+ *  - writer: vmsplice() "пришивает" страницы своего буфера к pipe без копирования;
+ *  - relay:  splice() перекладывает ссылки на страницы из pipe в сокет или файл,
+ *            не поднимая данные в пространство пользователя.
+ * Режим copy — тот же конвейер на writev/readv + write.
+ *
+ * Правило переиспользования буфера: после vmsplice (без SPLICE_F_GIFT) ядро
+ * держит ссылки на страницы писателя, пока данные не прочитаны конечным
+ * получателем. Писать в буфер раньше нельзя — получатель увидит новые байты.
+ * Поэтому буферы берутся из пула выровненных по странице блоков по кругу, и
+ * блок переиспользуется только когда получатель подтвердил, что дочитал его
+ * (счётчик consumed). В режиме copy буфер свободен сразу после writev.
+ *
+ * Запуск: ./bin/iov_splice [-t МиБ_на_замер] [-f файл]
+ *   без -f конечный получатель — поток, читающий UNIX-сокет;
+ *   с -f relay делает splice в указанный файл.
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+
+#define PIPE_CAPACITY   (1024 * 1024)       // F_SETPIPE_SZ: вмещает сообщение 1 МиБ
+#define POOL_BYTES      (8 * 1024 * 1024)   // суммарный размер пула буферов писателя
+#define DRAIN_BUF_SIZE  (256 * 1024)
+
+typedef enum { MODE_COPY, MODE_ZEROCOPY } xfer_mode_t;
+
+typedef struct {
+    xfer_mode_t mode;
+    size_t msg_size;
+    size_t total_bytes;
+    int pipe_fd[2];
+    int sink_fd;            // куда relay пишет данные (сокет или файл)
+    int drain_fd;           // другой конец сокета (-1 для файла)
+
+    // Прогресс конечного получателя: сколько байт потока уже дочитано
+    _Atomic uint64_t consumed;
+    atomic_int waiter;
+    atomic_int failed;      // relay или получатель остановились: consumed больше не растёт
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+} xfer_t;
+
+static int64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static int64_t cpu_ns(void) {
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return ((int64_t)ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000000000LL +
+           ((int64_t)ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) * 1000LL;
+}
+
+static void publish_consumed(xfer_t *x, uint64_t bytes) {
+    atomic_fetch_add(&x->consumed, bytes);
+    if (atomic_load(&x->waiter)) {
+        pthread_mutex_lock(&x->lock);
+        pthread_cond_broadcast(&x->cond);
+        pthread_mutex_unlock(&x->lock);
+    }
+}
+
+// Отметить сбой и разбудить писателя, ждущего в wait_consumed
+static void xfer_fail(xfer_t *x) {
+    pthread_mutex_lock(&x->lock);
+    atomic_store(&x->failed, 1);
+    pthread_cond_broadcast(&x->cond);
+    pthread_mutex_unlock(&x->lock);
+}
+
+// Писатель ждёт, пока получатель дочитает поток до смещения upto; -1 — сбой
+static int wait_consumed(xfer_t *x, uint64_t upto) {
+    if (atomic_load(&x->consumed) >= upto)
+        return 0;
+    pthread_mutex_lock(&x->lock);
+    atomic_store(&x->waiter, 1);
+    while (atomic_load(&x->consumed) < upto && !atomic_load(&x->failed))
+        pthread_cond_wait(&x->cond, &x->lock);
+    atomic_store(&x->waiter, 0);
+    pthread_mutex_unlock(&x->lock);
+    return atomic_load(&x->consumed) >= upto ? 0 : -1;
+}
+
+// Конечный получатель для режима с сокетом
+static void *drain_thread(void *arg) {
+    xfer_t *x = arg;
+    char *buf = malloc(DRAIN_BUF_SIZE);
+    if (!buf) {
+        perror("malloc");
+        // relay получит ошибку записи в сокет вместо вечного ожидания места
+        shutdown(x->drain_fd, SHUT_RDWR);
+        xfer_fail(x);
+        return NULL;
+    }
+    for (;;) {
+        ssize_t n = read(x->drain_fd, buf, DRAIN_BUF_SIZE);
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break;
+        publish_consumed(x, (uint64_t)n);
+    }
+    free(buf);
+    return NULL;
+}
+
+static int write_all(int fd, const char *p, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n == -1) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        p += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+// Relay: pipe -> сокет/файл. При ошибке закрывает чтение из pipe, чтобы
+// vmsplice/writev писателя вернули EPIPE, а не ждали места в pipe вечно.
+static void *relay_thread(void *arg) {
+    xfer_t *x = arg;
+    int to_file = x->drain_fd == -1;
+    int err = 0;
+
+    if (x->mode == MODE_ZEROCOPY) {
+        for (;;) {
+            ssize_t n = splice(x->pipe_fd[0], NULL, x->sink_fd, NULL, x->msg_size,
+                               SPLICE_F_MOVE | SPLICE_F_MORE);
+            if (n == -1 && errno == EINTR)
+                continue;
+            if (n == -1) {
+                perror("splice");
+                err = 1;
+                break;
+            }
+            if (n == 0)
+                break;
+            // splice в файл копирует данные в page cache до возврата
+            if (to_file)
+                publish_consumed(x, (uint64_t)n);
+        }
+    } else {
+        char *buf = malloc(x->msg_size);
+        if (!buf)
+            perror("malloc");
+        err = !buf;
+        struct iovec iov = { .iov_base = buf, .iov_len = x->msg_size };
+        while (buf) {
+            ssize_t n = readv(x->pipe_fd[0], &iov, 1);
+            if (n == -1 && errno == EINTR)
+                continue;
+            if (n == -1) {
+                perror("readv");
+                err = 1;
+            }
+            if (n <= 0)
+                break;
+            if (write_all(x->sink_fd, buf, (size_t)n) == -1) {
+                perror("write");
+                err = 1;
+                break;
+            }
+            if (to_file)
+                publish_consumed(x, (uint64_t)n);
+        }
+        free(buf);
+    }
+    if (err) {
+        xfer_fail(x);
+        close(x->pipe_fd[0]);
+        x->pipe_fd[0] = -1;     // run_case читает поле только после pthread_join
+    }
+    // EOF для drain-потока
+    if (!to_file)
+        shutdown(x->sink_fd, SHUT_WR);
+    return NULL;
+}
+
+static int send_message(xfer_t *x, char *buf, size_t len) {
+    struct iovec iov = { .iov_base = buf, .iov_len = len };
+    while (iov.iov_len > 0) {
+        if (atomic_load(&x->failed))
+            return -1;      // о причине уже сообщил relay или получатель
+        ssize_t n = x->mode == MODE_ZEROCOPY
+                        ? vmsplice(x->pipe_fd[1], &iov, 1, 0)
+                        : writev(x->pipe_fd[1], &iov, 1);
+        if (n == -1) {
+            if (errno == EINTR || (errno == EPIPE && atomic_load(&x->failed)))
+                continue;
+            perror(x->mode == MODE_ZEROCOPY ? "vmsplice" : "writev");
+            return -1;
+        }
+        iov.iov_base = (char *)iov.iov_base + n;
+        iov.iov_len -= (size_t)n;
+    }
+    return 0;
+}
+
+static int run_case(xfer_mode_t mode, size_t msg_size, size_t total_bytes, const char *file_path) {
+    xfer_t x;
+    memset(&x, 0, sizeof(x));
+    x.mode = mode;
+    x.msg_size = msg_size;
+    x.total_bytes = total_bytes - total_bytes % msg_size;
+    x.pipe_fd[0] = x.pipe_fd[1] = -1;
+    x.sink_fd = x.drain_fd = -1;
+    pthread_mutex_init(&x.lock, NULL);
+    pthread_cond_init(&x.cond, NULL);
+
+    int ret = -1;
+    char **pool = NULL;
+    size_t nbufs = 0;
+
+    if (pipe(x.pipe_fd) == -1) {
+        perror("pipe");
+        goto out;
+    }
+    if (fcntl(x.pipe_fd[1], F_SETPIPE_SZ, PIPE_CAPACITY) == -1)
+        perror("WARNING: F_SETPIPE_SZ");
+
+    if (file_path) {
+        x.sink_fd = open(file_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (x.sink_fd == -1) {
+            perror("open");
+            goto out;
+        }
+    } else {
+        int sv[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == -1) {
+            perror("socketpair");
+            goto out;
+        }
+        x.sink_fd = sv[0];
+        x.drain_fd = sv[1];
+    }
+
+    // Пул буферов, выровненных по странице: vmsplice работает со страницами целиком
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t want = POOL_BYTES / msg_size;
+    if (want < 2)
+        want = 2;
+    pool = calloc(want, sizeof(char *));
+    if (!pool) {
+        perror("calloc");
+        goto out;
+    }
+    for (; nbufs < want; nbufs++) {
+        if (posix_memalign((void **)&pool[nbufs], page, msg_size) != 0) {
+            fprintf(stderr, "posix_memalign failed\n");
+            goto out;
+        }
+        memset(pool[nbufs], 0, msg_size); // заранее получить страницы
+    }
+
+    pthread_t th_relay, th_drain;
+    int64_t cpu0 = cpu_ns();
+    int64_t t0 = now_ns();
+    int rc = pthread_create(&th_relay, NULL, relay_thread, &x);
+    if (rc != 0) {
+        fprintf(stderr, "pthread_create: %s\n", strerror(rc));
+        goto out;
+    }
+    if (x.drain_fd != -1) {
+        rc = pthread_create(&th_drain, NULL, drain_thread, &x);
+        if (rc != 0) {
+            fprintf(stderr, "pthread_create: %s\n", strerror(rc));
+            // EOF в канале завершает relay-поток; сокет он закроет на запись сам
+            close(x.pipe_fd[1]);
+            x.pipe_fd[1] = -1;
+            pthread_join(th_relay, NULL);
+            goto out;
+        }
+    }
+
+    size_t n_msgs = x.total_bytes / msg_size;
+    unsigned long reuse_waits = 0;
+    for (size_t i = 0; i < n_msgs; i++) {
+        char *buf = pool[i % nbufs];
+        if (mode == MODE_ZEROCOPY && i >= nbufs) {
+            // Блок последний раз отправлялся сообщением i - nbufs
+            uint64_t upto = (uint64_t)(i - nbufs + 1) * msg_size;
+            if (atomic_load(&x.consumed) < upto)
+                reuse_waits++;
+            if (wait_consumed(&x, upto) == -1)
+                break;
+        }
+        memset(buf, (int)(i & 0xff), msg_size); // "производим" данные
+        if (send_message(&x, buf, msg_size) == -1)
+            break;
+    }
+    close(x.pipe_fd[1]);
+    x.pipe_fd[1] = -1;
+
+    pthread_join(th_relay, NULL);
+    if (x.drain_fd != -1)
+        pthread_join(th_drain, NULL);
+    int64_t elapsed = now_ns() - t0;
+    int64_t cpu = cpu_ns() - cpu0;
+
+    uint64_t got = atomic_load(&x.consumed);
+    printf("%-8s %8zu %10.1f %10.1f %8.0f%% %12lu%s\n",
+           mode == MODE_ZEROCOPY ? "zerocopy" : "copy",
+           msg_size / 1024,
+           got / (elapsed / 1e9) / (1024.0 * 1024.0),
+           cpu / 1e6 / ((double)got / (1024.0 * 1024.0 * 1024.0)),
+           100.0 * (double)cpu / (double)elapsed,
+           reuse_waits,
+           got != x.total_bytes ? "  (SHORT)" : "");
+    ret = atomic_load(&x.failed) ? -1 : 0;
+
+out:
+    for (int i = 0; i < 2; i++)
+        if (x.pipe_fd[i] != -1)
+            close(x.pipe_fd[i]);
+    if (x.sink_fd != -1)
+        close(x.sink_fd);
+    if (x.drain_fd != -1)
+        close(x.drain_fd);
+    for (size_t i = 0; i < nbufs; i++)
+        free(pool[i]);
+    free(pool);
+    pthread_mutex_destroy(&x.lock);
+    pthread_cond_destroy(&x.cond);
+    return ret;
+}
+
+int main(int argc, char *argv[]) {
+    size_t total_mib = 512;
+    const char *file_path = NULL;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "t:f:")) != -1) {
+        switch (opt) {
+        case 't': total_mib = (size_t)atol(optarg); break;
+        case 'f': file_path = optarg; break;
+        default:
+            fprintf(stderr, "usage: %s [-t MiB] [-f file]\n", argv[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    // Ошибку записи в pipe без читателя обрабатываем сами (EPIPE), без SIGPIPE
+    signal(SIGPIPE, SIG_IGN);
+
+    const size_t sizes[] = { 4 << 10, 16 << 10, 64 << 10, 256 << 10, 1 << 20 };
+
+    printf("pipe -> %s, %zu MiB per case\n\n", file_path ? file_path : "unix socket", total_mib);
+    printf("%-8s %8s %10s %10s %9s %12s\n",
+           "mode", "msg_KiB", "MiB/s", "cpu_ms/GiB", "cpu", "reuse_waits");
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        if (run_case(MODE_COPY, sizes[i], total_mib << 20, file_path) == -1 ||
+            run_case(MODE_ZEROCOPY, sizes[i], total_mib << 20, file_path) == -1)
+            exit(EXIT_FAILURE);
+    }
+    return 0;
+}
+
+/*
+ * Выводы:
+ *  - copy: каждое сообщение копируется в pipe (writev) и из него (readv), затем
+ *    ещё раз в сокет (write). cpu_ms/GiB почти не зависит от размера сообщения.
+ *  - zerocopy: vmsplice и splice передают ссылки на страницы; пользовательских
+ *    копий нет, и начиная с десятков КиБ выигрыш по CPU на гигабайт заметен.
+ *    На 4 КиБ накладные расходы вызовов сравнимы с копированием, разница мала.
+ *  - reuse_waits показывает, сколько раз писателю пришлось ждать получателя,
+ *    прежде чем переписать буфер: это цена корректности без копий. Если пул
+ *    слишком мал, zerocopy вырождается в синхронную передачу.
+ *  - Получатель-сокет всё равно копирует данные при read(); выигрыш тем больше,
+ *    чем меньше последний шаг касается байтов (файл, сетевая карта).
+ */
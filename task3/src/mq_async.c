@@ -0,0 +1,375 @@
+/*
+ * Асинхронный клиент POSIX Message Queues (см. mq_async.h)
+ *
+ * Очередь ответов открыта с O_NONBLOCK и зарегистрирована в epoll на EPOLLIN.
+ * Очередь сервера тоже неблокирующая: если mq_send вернул EAGAIN, запрос
+ * ждёт во внутренней FIFO. Очередь сервера зарегистрирована в epoll без
+ * событий; пока FIFO не пуста, подписываемся на EPOLLOUT и досылаем её,
+ * как только сервер освободит место. Без отложенных запросов EPOLLOUT
+ * снят: очередь сервера почти всегда доступна на запись, и epoll_wait
+ * просыпался бы вхолостую.
+ *
+ * Почему не mq_notify: уведомление одноразовое, его нужно перевзводить после
+ * каждого опустошения очереди, и приходит оно сигналом или в отдельном потоке
+ * (SIGEV_THREAD). epoll на дескрипторе очереди даёт то же самое без гонки
+ * перевзвода и позволяет ждать очереди вместе с сокетами, таймерами и т.п.
+ *
+ * Незавершённые запросы лежат в таблице размером степень двойки >= 2 *
+ * max_inflight, слот — req_id & mask. Если слот очередного req_id ещё занят
+ * "отставшим" запросом, req_id пропускается; при заполнении не больше
+ * половины свободный слот всегда найдётся рядом.
+ *
+ * Срок у всех запросов одинаковый и отсчитывается от submit, поэтому
+ * раньше всех истекает самый старый живой req_id. Его и помнит oldest:
+ * проверка сроков — не обход таблицы, а сдвиг oldest вперёд, каждый req_id
+ * проходится один раз.
+ */
+#define _GNU_SOURCE
+#include "mq_async.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <mqueue.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <time.h>
+#include <unistd.h>
+
+typedef struct {
+    int busy;
+    unsigned int prio;
+    uint64_t deadline_ns;
+    mq_async_cb cb;
+    void *arg;
+    mq_future_t *future;
+    mq_msg_t msg;           // нужен, пока запрос ждёт места в очереди сервера
+} req_slot_t;
+
+struct mq_async {
+    uint32_t client_id;
+    char name[CLIENT_QUEUE_NAME_MAX];
+    mqd_t mq_server;
+    mqd_t mq_reply;
+    int epfd;
+    int want_out;           // подписка на EPOLLOUT очереди сервера включена
+
+    uint32_t next_req;
+    uint32_t oldest;        // req_id, раньше которого живых запросов нет
+    uint32_t mask;
+    uint64_t timeout_ns;
+    int max_inflight;
+    int inflight;
+    req_slot_t *slots;
+
+    uint32_t *backlog;      // req_id, ждущие места в очереди сервера (FIFO)
+    uint32_t bl_head;
+    uint32_t bl_count;
+};
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+mq_async_t *mq_async_open(uint32_t client_id, int max_inflight, int timeout_ms) {
+    if (max_inflight < 1 || timeout_ms < 1) {
+        errno = EINVAL;
+        return NULL;
+    }
+    mq_async_t *c = calloc(1, sizeof(*c));
+    if (!c)
+        return NULL;
+
+    uint32_t cap = 2;
+    while (cap < 2u * (uint32_t)max_inflight)
+        cap <<= 1;
+    c->client_id = client_id;
+    c->max_inflight = max_inflight;
+    c->mask = cap - 1;
+    c->timeout_ns = (uint64_t)timeout_ms * 1000000ULL;
+    c->mq_server = c->mq_reply = (mqd_t)-1;
+    c->epfd = -1;
+    c->slots = calloc(cap, sizeof(req_slot_t));
+    c->backlog = calloc(cap, sizeof(uint32_t));
+    if (!c->slots || !c->backlog)
+        goto fail;
+
+    struct mq_attr attr = { .mq_maxmsg = 10, .mq_msgsize = MAX_MSG_SIZE };
+    snprintf(c->name, sizeof(c->name), CLIENT_QUEUE_FMT, client_id);
+    c->mq_reply = mq_open(c->name, O_CREAT | O_RDONLY | O_NONBLOCK, 0644, &attr);
+    if (c->mq_reply == (mqd_t)-1)
+        goto fail;
+    c->mq_server = mq_open(SERVER_QUEUE_NAME, O_WRONLY | O_NONBLOCK);
+    if (c->mq_server == (mqd_t)-1)
+        goto fail;
+
+    c->epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (c->epfd == -1)
+        goto fail;
+    struct epoll_event ev = { .events = EPOLLIN, .data.fd = c->mq_reply };
+    if (epoll_ctl(c->epfd, EPOLL_CTL_ADD, c->mq_reply, &ev) == -1)
+        goto fail;
+    ev = (struct epoll_event){ .events = 0, .data.fd = c->mq_server };
+    if (epoll_ctl(c->epfd, EPOLL_CTL_ADD, c->mq_server, &ev) == -1)
+        goto fail;
+    return c;
+
+fail: {
+        int saved = errno;
+        mq_async_close(c);
+        errno = saved;
+        return NULL;
+    }
+}
+
+void mq_async_close(mq_async_t *c) {
+    if (!c)
+        return;
+    if (c->epfd != -1)
+        close(c->epfd);
+    if (c->mq_server != (mqd_t)-1)
+        mq_close(c->mq_server);
+    if (c->mq_reply != (mqd_t)-1) {
+        mq_close(c->mq_reply);
+        mq_unlink(c->name);
+    }
+    free(c->slots);
+    free(c->backlog);
+    free(c);
+}
+
+int mq_async_fd(const mq_async_t *c) {
+    return c->epfd;
+}
+
+int mq_async_inflight(const mq_async_t *c) {
+    return c->inflight;
+}
+
+// EPOLLOUT на очереди сервера нужен, только пока есть отложенные запросы
+static void watch_server(mq_async_t *c) {
+    int want = c->bl_count > 0;
+    if (want == c->want_out)
+        return;
+    struct epoll_event ev = { .events = want ? EPOLLOUT : 0, .data.fd = c->mq_server };
+    if (epoll_ctl(c->epfd, EPOLL_CTL_MOD, c->mq_server, &ev) == 0)
+        c->want_out = want;
+}
+
+// 1 — отправлен, 0 — очередь сервера полна, -1 — ошибка
+static int try_send(mq_async_t *c, req_slot_t *s) {
+    if (mq_send(c->mq_server, (const char *)&s->msg, MQ_HDR_SIZE + s->msg.len, s->prio) == 0)
+        return 1;
+    return errno == EAGAIN ? 0 : -1;
+}
+
+// Живой ли запрос req_id: слот мог освободиться или достаться другому запросу
+static req_slot_t *live_slot(mq_async_t *c, uint32_t req_id) {
+    req_slot_t *s = &c->slots[req_id & c->mask];
+    return s->busy && s->msg.req_id == req_id ? s : NULL;
+}
+
+// reply == NULL — ошибка, причина в errno
+static void complete(mq_async_t *c, req_slot_t *s, const mq_msg_t *reply) {
+    // Слот освобождаем до callback: из него можно сразу отправить следующий запрос
+    int err = errno;
+    mq_async_cb cb = s->cb;
+    void *arg = s->arg;
+    mq_future_t *f = s->future;
+    s->busy = 0;
+    c->inflight--;
+
+    if (f) {
+        if (reply) {
+            memcpy(&f->reply, reply, MQ_HDR_SIZE + reply->len);
+            f->done = 1;
+        } else {
+            f->error = err;
+            f->done = -1;
+        }
+    } else if (cb) {
+        errno = err;
+        cb(arg, reply);
+    }
+}
+
+static long submit(mq_async_t *c, const char *text, size_t len, unsigned int prio,
+                   mq_async_cb cb, void *arg, mq_future_t *f) {
+    if (len > MQ_MAX_TEXT) {
+        errno = EMSGSIZE;
+        return -1;
+    }
+    if (c->inflight >= c->max_inflight) {
+        errno = EAGAIN;
+        return -1;
+    }
+
+    while (c->slots[c->next_req & c->mask].busy)
+        c->next_req++;
+    uint32_t req_id = c->next_req++;
+    req_slot_t *s = &c->slots[req_id & c->mask];
+
+    s->prio = prio;
+    s->cb = cb;
+    s->arg = arg;
+    s->future = f;
+    s->msg.client_id = c->client_id;
+    s->msg.req_id = req_id;
+    s->msg.t_send_ns = now_ns();
+    s->deadline_ns = s->msg.t_send_ns + c->timeout_ns;
+    s->msg.len = (uint32_t)len;
+    memcpy(s->msg.text, text, len);
+    if (f)
+        f->done = 0;
+
+    // Пока есть отложенные запросы, новый встаёт за ними, чтобы не обгонять
+    int rc = c->bl_count == 0 ? try_send(c, s) : 0;
+    if (rc == -1)
+        return -1;
+    if (rc == 0) {
+        c->backlog[(c->bl_head + c->bl_count) & c->mask] = req_id;
+        c->bl_count++;
+        watch_server(c);
+    }
+    s->busy = 1;
+    c->inflight++;
+    return (long)req_id;
+}
+
+long mq_async_submit(mq_async_t *c, const char *text, size_t len, unsigned int prio,
+                     mq_async_cb cb, void *arg) {
+    return submit(c, text, len, prio, cb, arg, NULL);
+}
+
+long mq_async_submit_future(mq_async_t *c, const char *text, size_t len, unsigned int prio,
+                            mq_future_t *f) {
+    return submit(c, text, len, prio, NULL, NULL, f);
+}
+
+static int flush_backlog(mq_async_t *c) {
+    int failed = 0;
+    while (c->bl_count > 0) {
+        req_slot_t *s = live_slot(c, c->backlog[c->bl_head]);
+        if (!s) {
+            // Истёк, пока ждал места в очереди сервера
+            c->bl_head = (c->bl_head + 1) & c->mask;
+            c->bl_count--;
+            continue;
+        }
+        int rc = try_send(c, s);
+        if (rc == 0)
+            break;
+        c->bl_head = (c->bl_head + 1) & c->mask;
+        c->bl_count--;
+        if (rc == -1) {
+            complete(c, s, NULL);
+            failed++;
+        }
+    }
+    watch_server(c);
+    return failed;
+}
+
+// Разбирает одно сообщение MQ: в нём может быть несколько упакованных ответов
+static int dispatch_replies(mq_async_t *c, const char *buf, size_t n) {
+    int completed = 0;
+    size_t off = 0;
+    while (off + MQ_HDR_SIZE <= n) {
+        const mq_msg_t *r = (const mq_msg_t *)(buf + off);
+        if (r->len > MQ_MAX_TEXT || off + MQ_HDR_SIZE + r->len > n)
+            break;
+        req_slot_t *s = live_slot(c, r->req_id);
+        // Ответ на чужой, уже завершённый или просроченный запрос молча отбрасываем
+        if (s) {
+            complete(c, s, r);
+            completed++;
+        }
+        off += MQ_REC_SIZE(r->len);
+    }
+    return completed;
+}
+
+// Самый старый живой запрос или NULL
+static req_slot_t *oldest_slot(mq_async_t *c) {
+    if (c->inflight == 0) {
+        c->oldest = c->next_req;
+        return NULL;
+    }
+    req_slot_t *s;
+    while (!(s = live_slot(c, c->oldest)))
+        c->oldest++;
+    return s;
+}
+
+// Завершает с ETIMEDOUT запросы, чей срок истёк к моменту now
+static int expire(mq_async_t *c, uint64_t now) {
+    int expired = 0;
+    req_slot_t *s;
+    while ((s = oldest_slot(c)) && s->deadline_ns <= now) {
+        errno = ETIMEDOUT;
+        complete(c, s, NULL);
+        expired++;
+    }
+    return expired;
+}
+
+int mq_async_poll(mq_async_t *c, int timeout_ms) {
+    // Не спим дольше срока самого старого запроса
+    req_slot_t *old = oldest_slot(c);
+    if (old) {
+        uint64_t now = now_ns();
+        int left = old->deadline_ns <= now ? 0
+                 : (int)((old->deadline_ns - now + 999999) / 1000000);
+        if (timeout_ms < 0 || left < timeout_ms)
+            timeout_ms = left;
+    }
+
+    struct epoll_event ev[2];
+    int n = epoll_wait(c->epfd, ev, 2, timeout_ms);
+    if (n == -1)
+        return errno == EINTR ? 0 : -1;
+
+    int completed = 0;
+    int readable = 0;
+    for (int i = 0; i < n; i++)
+        if (ev[i].data.fd == c->mq_reply)
+            readable = 1;
+    if (readable) {
+        mq_msg_t buf;
+        ssize_t got;
+        for (;;) {
+            got = mq_receive(c->mq_reply, (char *)&buf, MAX_MSG_SIZE, NULL);
+            if (got >= 0) {
+                completed += dispatch_replies(c, (const char *)&buf, (size_t)got);
+                continue;
+            }
+            // EINTR — как EAGAIN: callback'и уже отработали, их нельзя потерять
+            if (errno == EAGAIN || errno == EINTR)
+                break;
+            if (completed == 0)
+                return -1;
+            break;
+        }
+    }
+    // Место в очереди сервера (EPOLLOUT) или ответы — досылаем отложенное
+    if (c->bl_count > 0)
+        completed += flush_backlog(c);
+    return completed + expire(c, now_ns());
+}
+
+int mq_async_wait(mq_async_t *c, mq_future_t *f) {
+    while (f->done == 0) {
+        if (c->inflight == 0) {
+            errno = EINVAL;     // future не привязан к запросу этого клиента
+            return -1;
+        }
+        if (mq_async_poll(c, -1) == -1)
+            return -1;
+    }
+    if (f->done == 1)
+        return 0;
+    errno = f->error;
+    return -1;
+}
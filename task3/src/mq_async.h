@@ -0,0 +1,107 @@
+#ifndef MQ_ASYNC_H
+#define MQ_ASYNC_H
+
+#include <stddef.h>
+#include "common.h"
+
+/*
+ * Асинхронный клиент posix_mq_server.
+ *
+ * Держит много запросов "в полёте", сопоставляя ответы по req_id. Очереди
+ * сообщений в Linux — это файловые дескрипторы, поэтому очередь ответов
+ * регистрируется в epoll, и клиент можно встроить в чужой цикл событий
+ * через mq_async_fd(). Завершение запроса сообщается через
+ * callback или через mq_future_t.
+ *
+ * Callback вызывается из mq_async_poll()/mq_async_wait() в потоке вызывающего.
+ * Один mq_async_t не потокобезопасен: используйте его из одного потока.
+ * Из callback можно вызывать mq_async_submit(), но не mq_async_poll().
+ *
+ * Поле t_send_ns запроса заполняется в момент mq_async_submit(), сервер
+ * возвращает его как есть — по ответу можно посчитать полную латентность,
+ * включая ожидание во внутренней очереди.
+ *
+ * Ответ может не прийти вовсе: сервер выбрасывает ответы клиенту, который
+ * не успевает их читать. Поэтому у каждого запроса есть срок (timeout_ms из
+ * mq_async_open(), считая от submit); по его истечении запрос завершается
+ * с ошибкой ETIMEDOUT, а опоздавший ответ отбрасывается.
+ */
+
+typedef struct mq_async mq_async_t;
+
+/**
+ * @brief Callback завершения запроса.
+ *
+ * @param arg Пользовательский аргумент из mq_async_submit().
+ * @param reply Ответ сервера (text не завершён '\0', длина в reply->len) или NULL при ошибке
+ *              (причина в errno: ETIMEDOUT — истёк срок запроса).
+ */
+typedef void (*mq_async_cb)(void *arg, const mq_msg_t *reply);
+
+typedef struct {
+    int done;           // 0 — ждём, 1 — ответ в reply, -1 — ошибка (см. error)
+    int error;          // errno при done == -1: ETIMEDOUT или ошибка mq_send
+    mq_msg_t reply;
+} mq_future_t;
+
+/**
+ * @brief Создаёт клиента и его очередь ответов.
+ *
+ * @param client_id Идентификатор клиента (имя очереди ответов строится из него).
+ * @param max_inflight Максимум одновременно незавершённых запросов.
+ * @param timeout_ms Срок ответа на запрос, > 0.
+ * @return Клиент или NULL в случае ошибки (errno установлен).
+ */
+mq_async_t *mq_async_open(uint32_t client_id, int max_inflight, int timeout_ms);
+
+/**
+ * @brief Закрывает очереди и удаляет очередь ответов. Незавершённые запросы теряются.
+ */
+void mq_async_close(mq_async_t *c);
+
+/**
+ * @brief Дескриптор epoll клиента: становится читаемым, когда пришли ответы
+ * или освободилось место для отложенных запросов.
+ */
+int mq_async_fd(const mq_async_t *c);
+
+/**
+ * @brief Отправляет запрос, не дожидаясь ответа.
+ *
+ * Если очередь сервера заполнена, запрос ждёт во внутренней очереди и уйдёт
+ * из mq_async_poll(), когда в очереди сервера освободится место.
+ *
+ * @return req_id запроса или -1 (errno = EAGAIN, если достигнут max_inflight).
+ */
+long mq_async_submit(mq_async_t *c, const char *text, size_t len, unsigned int prio,
+                     mq_async_cb cb, void *arg);
+
+/**
+ * @brief То же, что mq_async_submit(), но результат кладётся в future.
+ */
+long mq_async_submit_future(mq_async_t *c, const char *text, size_t len, unsigned int prio,
+                            mq_future_t *f);
+
+/**
+ * @brief Обрабатывает готовые события: досылает отложенные запросы, завершает
+ * принятые и просроченные.
+ *
+ * @param timeout_ms Сколько ждать событий (-1 — бесконечно, 0 — не ждать); не
+ *                   дольше срока самого старого запроса.
+ * @return Число завершённых запросов или -1 при ошибке.
+ */
+int mq_async_poll(mq_async_t *c, int timeout_ms);
+
+/**
+ * @brief Крутит mq_async_poll(), пока future не завершится (не дольше срока запроса).
+ *
+ * @return 0 — готово, -1 — ошибка (errno = f->error).
+ */
+int mq_async_wait(mq_async_t *c, mq_future_t *f);
+
+/**
+ * @brief Число запросов, ожидающих ответа.
+ */
+int mq_async_inflight(const mq_async_t *c);
+
+#endif // MQ_ASYNC_H
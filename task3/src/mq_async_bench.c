@@ -0,0 +1,218 @@
+/*
+ * Бенчмарк конвейера запросов через mq_async
+ *
+ * C клиентских потоков, у каждого свой mq_async_t. Поток держит в полёте
+ * до D запросов: из callback завершения сразу отправляется следующий, а сам
+ * поток только крутит mq_async_poll(). При D = 1 это тот же синхронный
+ * send -> receive, что в posix_mq_bench; рост D показывает, сколько даёт
+ * конвейеризация без дополнительных потоков.
+ *
+ * Латентность считается от mq_async_submit() (поле t_send_ns) до callback,
+ * то есть включает ожидание места в очереди сервера.
+ *
+ *   ./bin/posix_mq_server &
+ *   ./bin/mq_async_bench                 # глубины 1, 8, 64
+ *   ./bin/mq_async_bench -c 4 -d 16
+ *
+ * Запуск: ./bin/mq_async_bench [-c клиентов] [-n запросов_на_клиента] [-s размер_текста] [-d глубина]
+ */
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "mq_async.h"
+
+#define MAX_CLIENTS 64
+#define REQUEST_TIMEOUT_MS 1000     // сервер может выбросить ответ медленному клиенту
+
+static uint32_t base_client_id;
+
+typedef struct {
+    uint32_t client_id;
+    int depth;
+    int n_requests;
+    size_t text_len;
+    char text[MQ_MAX_TEXT];
+    mq_async_t *mq;
+    int submitted;
+    int done;
+    int errors;
+    int64_t *lat_ns;
+} client_ctx_t;
+
+static int64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static int compare_i64(const void *a, const void *b) {
+    int64_t va = *(const int64_t *)a;
+    int64_t vb = *(const int64_t *)b;
+    return (va > vb) - (va < vb);
+}
+
+static void on_reply(void *arg, const mq_msg_t *reply);
+
+static void submit_next(client_ctx_t *ctx) {
+    while (ctx->submitted < ctx->n_requests &&
+           mq_async_inflight(ctx->mq) < ctx->depth) {
+        if (mq_async_submit(ctx->mq, ctx->text, ctx->text_len, MSG_PRIO_NORMAL, on_reply, ctx) == -1) {
+            perror("mq_async_submit");
+            ctx->errors++;
+            ctx->done++;
+        }
+        ctx->submitted++;
+    }
+}
+
+static void on_reply(void *arg, const mq_msg_t *reply) {
+    client_ctx_t *ctx = arg;
+    if (reply) {
+        ctx->lat_ns[ctx->done - ctx->errors] = now_ns() - (int64_t)reply->t_send_ns;
+    } else {
+        ctx->errors++;
+    }
+    ctx->done++;
+    submit_next(ctx);
+}
+
+static void *client_thread(void *arg) {
+    client_ctx_t *ctx = arg;
+
+    submit_next(ctx);
+    // Потерянные ответы завершаются по сроку запроса и считаются в errors
+    while (ctx->done < ctx->n_requests) {
+        if (mq_async_poll(ctx->mq, -1) == -1) {
+            perror("mq_async_poll");
+            break;
+        }
+    }
+    return NULL;
+}
+
+static int run(int n_clients, int depth, int n_requests, size_t text_len) {
+    client_ctx_t *ctx = calloc((size_t)n_clients, sizeof(client_ctx_t));
+    pthread_t threads[MAX_CLIENTS];
+    if (!ctx) {
+        perror("calloc");
+        return -1;
+    }
+
+    for (int i = 0; i < n_clients; i++) {
+        ctx[i].client_id = base_client_id + (uint32_t)i;
+        ctx[i].depth = depth;
+        ctx[i].n_requests = n_requests;
+        ctx[i].text_len = text_len;
+        memset(ctx[i].text, 'a', text_len);
+        ctx[i].lat_ns = malloc((size_t)n_requests * sizeof(int64_t));
+        ctx[i].mq = mq_async_open(ctx[i].client_id, depth, REQUEST_TIMEOUT_MS);
+        if (!ctx[i].lat_ns || !ctx[i].mq) {
+            perror("mq_async_open — is posix_mq_server running?");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    int64_t t0 = now_ns();
+    for (int i = 0; i < n_clients; i++)
+        pthread_create(&threads[i], NULL, client_thread, &ctx[i]);
+    for (int i = 0; i < n_clients; i++)
+        pthread_join(threads[i], NULL);
+    int64_t elapsed = now_ns() - t0;
+
+    size_t total = 0;
+    int errors = 0;
+    for (int i = 0; i < n_clients; i++) {
+        total += (size_t)(ctx[i].done - ctx[i].errors);
+        errors += ctx[i].errors;
+    }
+    int64_t *all = malloc((total ? total : 1) * sizeof(int64_t));
+    size_t k = 0;
+    for (int i = 0; i < n_clients; i++) {
+        memcpy(all + k, ctx[i].lat_ns, (size_t)(ctx[i].done - ctx[i].errors) * sizeof(int64_t));
+        k += (size_t)(ctx[i].done - ctx[i].errors);
+        mq_async_close(ctx[i].mq);
+        free(ctx[i].lat_ns);
+    }
+
+    printf("%6d %10.0f", depth, total / (elapsed / 1e9));
+    if (total > 0) {
+        qsort(all, total, sizeof(int64_t), compare_i64);
+        int64_t sum = 0;
+        for (size_t i = 0; i < total; i++)
+            sum += all[i];
+        printf(" %10.1f %10.1f %10.1f %10.1f", sum / (double)total / 1000.0,
+               all[total / 2] / 1000.0, all[(total * 99) / 100] / 1000.0, all[total - 1] / 1000.0);
+    }
+    if (errors)
+        printf("  errors=%d", errors);
+    printf("\n");
+
+    free(all);
+    free(ctx);
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    int n_clients = 1;
+    int n_requests = 100000;
+    size_t text_len = 32;
+    int depth = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "c:n:s:d:")) != -1) {
+        switch (opt) {
+        case 'c': n_clients = atoi(optarg); break;
+        case 'n': n_requests = atoi(optarg); break;
+        case 's': text_len = (size_t)atol(optarg); break;
+        case 'd': depth = atoi(optarg); break;
+        default:
+            fprintf(stderr, "usage: %s [-c clients] [-n requests] [-s text_len] [-d depth]\n", argv[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (n_clients < 1 || n_clients > MAX_CLIENTS || n_requests < 1 ||
+        text_len > MQ_MAX_TEXT || depth < 0) {
+        fprintf(stderr, "bad arguments (clients 1..%d, text_len <= %zu)\n", MAX_CLIENTS, MQ_MAX_TEXT);
+        exit(EXIT_FAILURE);
+    }
+
+    base_client_id = (uint32_t)getpid() << 8;
+    printf("clients=%d, requests per client=%d, text=%zu B\n", n_clients, n_requests, text_len);
+    printf("%6s %10s %10s %10s %10s %10s\n", "depth", "req/s", "avg_us", "p50_us", "p99_us", "max_us");
+    if (depth > 0)
+        return run(n_clients, depth, n_requests, text_len) == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+
+    static const int depths[] = { 1, 8, 64 };
+    for (size_t i = 0; i < sizeof(depths) / sizeof(depths[0]); i++)
+        if (run(n_clients, depths[i], n_requests, text_len) != 0)
+            return EXIT_FAILURE;
+    return EXIT_SUCCESS;
+}
+
+/*
+ * Результаты (4 воркера, -b 16, текст 32 B, 100000 запросов на клиента):
+ *
+ *   клиентов  глубина    req/s   avg_us   p99_us
+ *          1        1   120059      8.3     11.9
+ *          1        8   199243     40.1     69.4
+ *          1       64   217936    293.5    398.6
+ *          4        1   123684     32.2     77.0
+ *          4        8   324208     96.8    293.7
+ *          4       64   264024    951.4   2252.3
+ *
+ *  - Один поток с глубиной 8 делает почти вдвое больше запросов, чем с
+ *    глубиной 1: пока сервер обрабатывает один запрос, следующие уже лежат
+ *    в очереди, а ответы приходят пачками (упакованными по несколько).
+ *  - Дальше упираемся в сервер: очередь на 10 сообщений заполнена, лишние
+ *    запросы ждут у клиента, и глубина 64 только растит латентность (закон
+ *    Литтла: latency ~= depth / throughput).
+ *  - Отложенные запросы досылаются по EPOLLOUT очереди сервера, и
+ *    подписка на него держится, только пока они есть. Если оставить
+ *    EPOLLOUT включённым всегда, epoll_wait возвращается сразу, как только в
+ *    очереди есть место: на одном CPU клиенты крутятся вхолостую и отнимают
+ *    время у воркеров сервера (4 клиента, глубина 8: 82k req/s, p99 11.8 мс).
+ */
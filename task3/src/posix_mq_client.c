@@ -3,57 +3,59 @@
  *
  * Отправляет сообщения на сервер и ждет ответа.
  * Демонстрирует отправку сообщений с разными приоритетами.
+ *
+ * У каждого клиента своя очередь ответов (CLIENT_QUEUE_FMT с client_id = pid),
+ * поэтому несколько клиентов могут работать с сервером одновременно.
+ *
+ * Работает через асинхронный клиент mq_async: все сообщения отправляются
+ * сразу, без ожидания ответа на предыдущее, а ответы сопоставляются запросам
+ * по req_id. Раньше клиент ждал каждый ответ в mq_receive и спал секунду.
  */
-#include <mqueue.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
-#include "common.h"
-
-int main() {
-    mqd_t mq_server, mq_client;
-    struct mq_attr attr;
+#include "mq_async.h"
 
-    attr.mq_flags = 0;
-    attr.mq_maxmsg = 10;
-    attr.mq_msgsize = MAX_MSG_SIZE;
-    attr.mq_curmsgs = 0;
+#define N_MESSAGES 3
+#define REPLY_TIMEOUT_MS 1000
 
-    mq_server = mq_open(SERVER_QUEUE_NAME, O_WRONLY);
-    if (mq_server == (mqd_t)-1) {
-        perror("mq_open (server)");
-        exit(1);
-    }
+int main() {
+    uint32_t client_id = (uint32_t)getpid();
 
-    mq_client = mq_open(CLIENT_QUEUE_NAME, O_CREAT | O_RDONLY, 0644, &attr);
-    if (mq_client == (mqd_t)-1) {
-        perror("mq_open (client)");
+    mq_async_t *client = mq_async_open(client_id, N_MESSAGES, REPLY_TIMEOUT_MS);
+    if (!client) {
+        perror("mq_async_open");
         exit(1);
     }
 
     char *messages[] = {"ordinary message 1", "urgent message!", "ordinary message 2"};
     unsigned int priorities[] = {MSG_PRIO_NORMAL, MSG_PRIO_HIGH, MSG_PRIO_NORMAL};
+    mq_future_t answers[N_MESSAGES];
+    int sent[N_MESSAGES] = {0};
 
-    for (int i = 0; i < 3; ++i) {
+    for (int i = 0; i < N_MESSAGES; ++i) {
         printf("Send message with priority %u: \"%s\"\n", priorities[i], messages[i]);
-        if (mq_send(mq_server, messages[i], strlen(messages[i]) + 1, priorities[i]) == -1) {
-            perror("mq_send");
-            continue;
+        if (mq_async_submit_future(client, messages[i], strlen(messages[i]), priorities[i], &answers[i]) == -1) {
+            perror("mq_async_submit");
+        } else {
+            sent[i] = 1;
         }
+    }
+    printf("\n");
 
-        char buffer[MAX_MSG_SIZE];
-        if (mq_receive(mq_client, buffer, MAX_MSG_SIZE, NULL) >= 0) {
-            printf("Received answer: \"%s\"\n\n", buffer);
+    // Запрос мог завершиться по сроку раньше, чем до него дошла очередь ожидания
+    for (int i = 0; i < N_MESSAGES; ++i) {
+        if (!sent[i])
+            continue;
+        if (mq_async_wait(client, &answers[i]) == 0) {
+            printf("Received answer: \"%.*s\"\n", (int)answers[i].reply.len, answers[i].reply.text);
         } else {
-            perror("mq_receive");
+            perror("mq_async_wait");
         }
-        sleep(1); 
     }
 
-    mq_close(mq_server);
-    mq_close(mq_client);
-    mq_unlink(CLIENT_QUEUE_NAME);
+    mq_async_close(client);
 
     return 0;
 }
@@ -3,15 +3,12 @@
 #include <unistd.h>
 #include <time.h>
 #include <sys/resource.h>
+#include "latstat.h"
 
 #define ARRAY_SIZE (512 * 1024 * 1024) // 512 MB
 #define PAGE_SIZE 4096
 #define NUM_ITERATIONS 1000
 
-long long timespec_diff_ns(struct timespec start, struct timespec end) {
-    return (end.tv_sec - start.tv_sec) * 1000000000LL + (end.tv_nsec - start.tv_nsec);
-}
-
 int main() {
     printf("Task 1: Demonstrating Page Faults\n");
 
@@ -24,6 +21,10 @@ int main() {
 
     struct timespec start_time, end_time;
     struct rusage usage_before, usage_after;
+    // Отдельно обращения, вызвавшие page fault, и обращения без него
+    latstat faulted, clean;
+    latstat_init(&faulted);
+    latstat_init(&clean);
 
     printf("Iter\tLatency (ns)\tMinor Faults\tMajor Faults\n");
 
@@ -45,13 +46,21 @@ int main() {
         // Получить статистику использования ресурсов ПОСЛЕ доступа
         getrusage(RUSAGE_SELF, &usage_after);
 
-        long long latency = timespec_diff_ns(start_time, end_time);
+        long long latency = latstat_diff_ns(&start_time, &end_time);
         long minor_faults = usage_after.ru_minflt - usage_before.ru_minflt;
         long major_faults = usage_after.ru_majflt - usage_before.ru_majflt;
+        latstat_add(minor_faults + major_faults ? &faulted : &clean, latency);
 
         printf("%d\t%lld\t\t%ld\t\t%ld\n", i, latency, minor_faults, major_faults);
     }
 
+    latstat all = faulted;
+    latstat_merge(&all, &clean);
+    printf("\n");
+    latstat_emit(stdout, LATSTAT_TEXT, "faulted", &faulted);
+    latstat_emit(stdout, LATSTAT_TEXT, "clean", &clean);
+    latstat_emit(stdout, LATSTAT_TEXT, "all", &all);
+
     free(array);
     return 0;
 }
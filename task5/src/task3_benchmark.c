@@ -1,41 +1,41 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <time.h>
+#include <sys/mman.h>
+#include "latstat.h"
 #include "mempool.h"
 
 #define BENCH_ITERATIONS 1000000
 #define BLOCK_SIZE 128
 
-long long timespec_diff_ns(struct timespec start, struct timespec end) {
-    return (end.tv_sec - start.tv_sec) * 1000000000LL + (end.tv_nsec - start.tv_nsec);
-}
+// 8 МБ указателей не помещаются в стек по умолчанию
+static void* ptrs[BENCH_ITERATIONS];
 
 void benchmark_malloc() {
     printf("Benchmarking malloc/free...\n");
     struct timespec start, end;
-    long long max_latency = 0;
-    void* ptrs[BENCH_ITERATIONS];
+    latstat st;
+    latstat_init(&st);
 
     for (int i = 0; i < BENCH_ITERATIONS; ++i) {
         clock_gettime(CLOCK_MONOTONIC, &start);
         ptrs[i] = malloc(BLOCK_SIZE);
         clock_gettime(CLOCK_MONOTONIC, &end);
-        long long latency = timespec_diff_ns(start, end);
-        if (latency > max_latency) max_latency = latency;
+        latstat_add(&st, latstat_diff_ns(&start, &end));
     }
 
     for (int i = 0; i < BENCH_ITERATIONS; ++i) {
         free(ptrs[i]);
     }
 
-    printf("malloc/free max latency: %lld ns\n", max_latency);
+    latstat_emit(stdout, LATSTAT_TEXT, "malloc", &st);
 }
 
 void benchmark_mempool() {
     printf("Benchmarking memory pool...\n");
     struct timespec start, end;
-    long long max_latency = 0;
-    void* ptrs[BENCH_ITERATIONS];
+    latstat st;
+    latstat_init(&st);
 
     // Создать пул с достаточным количеством блоков
     MemoryPool* pool = pool_create(BLOCK_SIZE, BENCH_ITERATIONS);
@@ -49,8 +49,7 @@ void benchmark_mempool() {
         clock_gettime(CLOCK_MONOTONIC, &start);
         ptrs[i] = pool_alloc(pool);
         clock_gettime(CLOCK_MONOTONIC, &end);
-        long long latency = timespec_diff_ns(start, end);
-        if (latency > max_latency) max_latency = latency;
+        latstat_add(&st, latstat_diff_ns(&start, &end));
     }
 
     // Освободить блоки
@@ -58,7 +57,7 @@ void benchmark_mempool() {
         pool_free(pool, ptrs[i]);
     }
 
-    printf("pool_alloc max latency: %lld ns\n", max_latency);
+    latstat_emit(stdout, LATSTAT_TEXT, "pool_alloc", &st);
 
     // Уничтожить пул
     pool_destroy(pool);
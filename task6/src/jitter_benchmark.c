@@ -5,13 +5,10 @@
 #include <time.h>
 #include <sched.h>
 #include <math.h>
+#include "latstat.h"
 
 #define NUM_ITERATIONS 1000
 
-long long timespec_diff_ns(struct timespec start, struct timespec end) {
-    return (end.tv_sec - start.tv_sec) * 1000000000LL + (end.tv_nsec - start.tv_nsec);
-}
-
 void work_function() {
     double result = 0.0;
     for (int i = 0; i < 100000; ++i) {
@@ -21,9 +18,20 @@ void work_function() {
 
 int main(int argc, char *argv[]) {
     int target_cpu = -1;
-    if (argc > 1) {
-        target_cpu = atoi(argv[1]);
-        printf("Target CPU specified: %d\n", target_cpu);
+    int fmt = LATSTAT_TEXT;
+    int opt;
+    while ((opt = getopt(argc, argv, "f:")) != -1) {
+        fmt = opt == 'f' ? latstat_format(optarg) : -1;
+        if (fmt < 0) {
+            fprintf(stderr, "Usage: %s [-f text|csv|json] [cpu]\n", argv[0]);
+            return 1;
+        }
+    }
+    // В csv/json stdout — только данные, сообщения о настройке уходят в stderr
+    FILE *info = fmt == LATSTAT_TEXT ? stdout : stderr;
+    if (optind < argc) {
+        target_cpu = atoi(argv[optind]);
+        fprintf(info, "Target CPU specified: %d\n", target_cpu);
     }
 
     /* --- ЗАДАНИЕ 2: УСТАНОВКА CPU AFFINITY --- */
@@ -38,7 +46,7 @@ int main(int argc, char *argv[]) {
             perror("sched_setaffinity failed. Try with sudo.");
             return 1;
         }
-        printf("Process pinned to CPU %d\n", target_cpu);
+        fprintf(info, "Process pinned to CPU %d\n", target_cpu);
     }
 
     /* --- ЗАДАНИЕ 1: УСТАНОВКА REAL-TIME ПРИОРИТЕТА --- */
@@ -49,12 +57,12 @@ int main(int argc, char *argv[]) {
         perror("sched_setscheduler failed. Try with sudo.");
         return 1;
     }
-    printf("Scheduler policy set to SCHED_FIFO with priority %d\n", sp.sched_priority);
+    fprintf(info, "Scheduler policy set to SCHED_FIFO with priority %d\n", sp.sched_priority);
 
-    long long latencies[NUM_ITERATIONS];
-    long long min_latency = -1, max_latency = 0, total_latency = 0;
+    latstat st;
+    latstat_init(&st);
 
-    printf("Starting benchmark...\n");
+    fprintf(info, "Starting benchmark...\n");
     for (int i = 0; i < NUM_ITERATIONS; ++i) {
         struct timespec start, end;
         clock_gettime(CLOCK_MONOTONIC, &start);
@@ -62,25 +70,22 @@ int main(int argc, char *argv[]) {
         work_function();
         
         clock_gettime(CLOCK_MONOTONIC, &end);
-        latencies[i] = timespec_diff_ns(start, end);
-
-        if (min_latency == -1 || latencies[i] < min_latency) {
-            min_latency = latencies[i];
-        }
-        if (latencies[i] > max_latency) {
-            max_latency = latencies[i];
-        }
-        total_latency += latencies[i];
+        latstat_add(&st, latstat_diff_ns(&start, &end));
     }
 
-    double avg_latency = (double)total_latency / NUM_ITERATIONS;
-    long long jitter = max_latency - min_latency;
+    if (fmt != LATSTAT_TEXT) {
+        latstat_emit_header(stdout, fmt);
+        latstat_emit(stdout, fmt, "work", &st);
+        return 0;
+    }
 
     printf("\n--- Benchmark Results ---\n");
-    printf("Min latency:    %lld ns\n", min_latency);
-    printf("Max latency:    %lld ns\n", max_latency);
-    printf("Avg latency:    %.2f ns\n", avg_latency);
-    printf("Jitter (max-min): %lld ns\n", jitter);
+    printf("Min latency:    %lld ns\n", (long long)st.min);
+    printf("Max latency:    %lld ns\n", (long long)st.max);
+    printf("Avg latency:    %.2f ns\n", st.mean);
+    printf("Std deviation:  %.2f ns\n", latstat_stddev(&st));
+    printf("p99 latency:    %lld ns\n", (long long)latstat_percentile(&st, 99));
+    printf("Jitter (max-min): %lld ns\n", (long long)(st.max - st.min));
 
     return 0;
 }